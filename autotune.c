@@ -0,0 +1,236 @@
+/**
+ * Pick the fastest transpose kernel for the actual page shape and number of threads
+ *
+ * All supported kernels from deinterleave_variants are timed on a buffer with the real
+ * number of tabs, channels, and padded_size, but only the first AUTOTUNE_NTIMES samples,
+ * with the processing stages of the observation: downsampling and requantization run the kernels
+ * on small reduced tiles, so the fastest kernel depends on them.
+ *
+ * The result can be cached in a file, with one line per host, page shape, threading setup and stages:
+ *    hostname ntabs nchannels ntimes padded_size nthreads threading block kernel nstokes tdec fdec nbit stages
+ * where stages lists the fused steps (stats, mask, zerodm) separated by commas, or is "none".
+ * Lines of older versions end after the kernel or nstokes, they hold for a plain transpose.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "autotune.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int get_nthreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Look up a previous result in the cache file
+ *
+ * @returns {deinterleave_variant_t *} The cached kernel, or NULL if not (validly) cached
+ */
+static const deinterleave_variant_t *cache_lookup(const char *cache_file, const char *hostname,
+    const int ntabs, const int nchannels, const int nstokes, const int ntimes, const int padded_size, const int nthreads,
+    const char *threading, const int block, const deinterleave_stages_t *stages, const char *steps) {
+  const deinterleave_variant_t *variant = NULL;
+
+  FILE *cache = fopen(cache_file, "r");
+  if (! cache) {
+    return NULL;
+  }
+
+  char line[512];
+  while (fgets(line, sizeof(line), cache)) {
+    char host[256], c_threading[16], name[64], c_steps[64] = "none";
+    int c_ntabs, c_nchannels, c_ntimes, c_padded_size, c_nthreads, c_block, c_nstokes = 1, c_tdec = 1, c_fdec = 1, c_nbit = 8;
+
+    if (sscanf(line, "%255s %i %i %i %i %i %15s %i %63s %i %i %i %i %63s", host, &c_ntabs, &c_nchannels, &c_ntimes, &c_padded_size,
+          &c_nthreads, c_threading, &c_block, name, &c_nstokes, &c_tdec, &c_fdec, &c_nbit, c_steps) < 9) {
+      continue;
+    }
+    if (strcmp(host, hostname) == 0 && c_ntabs == ntabs && c_nchannels == nchannels && c_nstokes == nstokes &&
+        c_ntimes == ntimes && c_padded_size == padded_size && c_nthreads == nthreads &&
+        strcmp(c_threading, threading) == 0 && c_block == block &&
+        c_tdec == stages->tdec && c_fdec == stages->fdec && c_nbit == stages->nbit && strcmp(c_steps, steps) == 0) {
+      // later entries take precedence
+      variant = deinterleave_find(name);
+    }
+  }
+  fclose(cache);
+
+  return variant;
+}
+
+static void cache_store(const char *cache_file, const char *hostname,
+    const int ntabs, const int nchannels, const int nstokes, const int ntimes, const int padded_size, const int nthreads,
+    const char *threading, const int block, const deinterleave_stages_t *stages, const char *steps,
+    const deinterleave_variant_t *variant) {
+
+  FILE *cache = fopen(cache_file, "a");
+  if (! cache) {
+    return;
+  }
+  fprintf(cache, "%s %i %i %i %i %i %s %i %s %i %i %i %i %s\n", hostname, ntabs, nchannels, ntimes, padded_size,
+      nthreads, threading, block, variant->name, nstokes, stages->tdec, stages->fdec, stages->nbit, steps);
+  fclose(cache);
+}
+
+/**
+ * Name the fused steps of the stages for the cache file
+ */
+static void stage_steps(const deinterleave_stages_t *stages, char *steps, const size_t size) {
+  snprintf(steps, size, "%s%s%s", stages->stats ? ",stats" : "", stages->mask ? ",mask" : "", stages->zerodm ? ",zerodm" : "");
+  if (steps[0]) {
+    memmove(steps, &steps[1], strlen(steps));
+  } else {
+    snprintf(steps, size, "none");
+  }
+}
+
+/**
+ * Select the fastest kernel
+ *
+ * @param {const char *} cache_file File to read and store results, can be NULL
+ * @param {deinterleave_threading_t} threading Threading mode used for the page
+ * @param {int} block Number of channels per block
+ * @param {deinterleave_stages_t *} stages Processing of the observation; the kernels are timed with its tdec, fdec, nbit,
+ *                                         mask and zero-DM, and scratch statistics when it has statistics
+ * @param {double *} timings Per kernel time in ms to transpose a full page, or -1 when not measured
+ * @param {int *} cached Set to 1 if the kernel was read from the cache file, 0 otherwise
+ * @returns {deinterleave_variant_t *} The fastest kernel
+ */
+const deinterleave_variant_t *autotune(
+    const char *cache_file,
+    const deinterleave_threading_t threading,
+    const int block,
+    const int ntabs,
+    const int nchannels,
+    const int nstokes,
+    const int ntimes,
+    const int padded_size,
+    const deinterleave_stages_t *stages,
+    double *timings,
+    int *cached) {
+
+  const int nthreads = get_nthreads();
+  char hostname[256];
+  int v;
+
+  for (v = 0; v < deinterleave_nvariants; v++) {
+    timings[v] = -1;
+  }
+
+  if (gethostname(hostname, sizeof(hostname)) != 0) {
+    strcpy(hostname, "unknown");
+  }
+  hostname[sizeof(hostname) - 1] = '\0';
+
+  // IQUV pages are only transposed
+  deinterleave_stages_t plain = {.tdec = 1, .fdec = 1, .nbit = 8};
+  if (nstokes > 1) {
+    stages = &plain;
+  }
+  char steps[64];
+  stage_steps(stages, steps, sizeof(steps));
+
+  if (cache_file) {
+    const deinterleave_variant_t *variant = cache_lookup(cache_file, hostname, ntabs, nchannels, nstokes, ntimes, padded_size, nthreads,
+        deinterleave_threading_name(threading), block, stages, steps);
+    if (variant) {
+      *cached = 1;
+      return variant;
+    }
+  }
+  *cached = 0;
+
+  // a whole number of downsampled samples
+  int nsamples = ntimes < AUTOTUNE_NTIMES ? ntimes : AUTOTUNE_NTIMES;
+  nsamples = nsamples > stages->tdec ? nsamples - nsamples % stages->tdec : stages->tdec;
+  const size_t page_size = (size_t) ntabs * nchannels * nstokes * padded_size;
+  const size_t tab_size = (size_t) (nsamples / stages->tdec) * (nchannels / stages->fdec) * nstokes * stages->nbit / 8;
+  char *page = malloc(page_size);
+  char *transposed = malloc(ntabs * tab_size);
+  char *tabs[ntabs];
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    tabs[tab] = &transposed[tab * tab_size];
+  }
+
+  // the same stages, with statistics into scratch arrays of the TABs of the buffer
+  deinterleave_stages_t tuning = *stages;
+  tuning.seconds = NULL;
+  deinterleave_stats_t *stats = NULL;
+  uint64_t *counters = NULL;
+  if (stages->stats) {
+    stats = malloc(ntabs * sizeof(deinterleave_stats_t));
+    counters = calloc((size_t) 3 * ntabs * nchannels, sizeof(uint64_t));
+    for (tab = 0; tab < ntabs; tab++) {
+      stats[tab].sum = &counters[(size_t) (3 * tab) * nchannels];
+      stats[tab].sum2 = &counters[(size_t) (3 * tab + 1) * nchannels];
+      stats[tab].clipped = &counters[(size_t) (3 * tab + 2) * nchannels];
+    }
+    tuning.stats = stats;
+  }
+
+  // touch all memory, so we do not time page faults
+  memset(page, 1, page_size);
+  memset(transposed, 0, ntabs * tab_size);
+
+  const deinterleave_variant_t *best = NULL;
+  double best_time = 0;
+
+  for (v = 0; v < deinterleave_nvariants; v++) {
+    const deinterleave_variant_t *variant = &deinterleave_variants[v];
+    if (! variant->supported() || (variant->nchannels && variant->nchannels != nchannels)) {
+      continue;
+    }
+
+    // untimed warm up run, then keep the fastest run until the budget is spent
+    double fastest = -1;
+    double spent = 0;
+    int run;
+    for (run = 0; run < 3 || spent < AUTOTUNE_BUDGET; run++) {
+      double start = now();
+
+      deinterleave_page(variant->kernel, threading, block, page, tabs, ntabs, nchannels, nstokes, nsamples, padded_size, &tuning);
+
+      double elapsed = now() - start;
+      if (run > 0) {
+        spent += elapsed;
+        if (fastest < 0 || elapsed < fastest) {
+          fastest = elapsed;
+        }
+      }
+    }
+
+    // scale to a full page
+    timings[v] = fastest * 1e3 * ntimes / nsamples;
+    if (! best || fastest < best_time) {
+      best = variant;
+      best_time = fastest;
+    }
+  }
+
+  free(page);
+  free(transposed);
+  free(stats);
+  free(counters);
+
+  if (cache_file) {
+    cache_store(cache_file, hostname, ntabs, nchannels, nstokes, ntimes, padded_size, nthreads,
+        deinterleave_threading_name(threading), block, stages, steps, best);
+  }
+
+  return best;
+}
@@ -0,0 +1,24 @@
+#ifndef __HAVE_AUTOTUNE_H__
+#define __HAVE_AUTOTUNE_H__
+
+#include "deinterleave.h"
+
+// Number of samples per channel used to time the kernels
+#define AUTOTUNE_NTIMES 4096
+
+// Minimum time spent on a single kernel, in seconds
+#define AUTOTUNE_BUDGET 0.005
+
+extern const deinterleave_variant_t *autotune(
+    const char *cache_file,
+    const deinterleave_threading_t threading,
+    const int block,
+    const int ntabs,
+    const int nchannels,
+    const int nstokes,
+    const int ntimes,
+    const int padded_size,
+    const deinterleave_stages_t *stages,
+    double *timings,
+    int *cached);
+#endif
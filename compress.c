@@ -0,0 +1,521 @@
+/**
+ * Compressed output: the TABs are cut in chunks of COMPRESS_CHUNK_SAMPLES samples, that are bitshuffled
+ * and compressed with LZ4 or zstd by a pool of compression threads, and written with the output backend.
+ *
+ * The filterbank header is written as is, followed by the compressed chunks. A chunk does not cross a page,
+ * so the last chunk of a page can be shorter. Bitshuffle stores the bit planes of every COMPRESS_BLOCK bytes
+ * together: plane b holds bit b of every byte of the block, 8 bytes to a byte, starting at the lowest bit.
+ * Neighbouring channels have similar values, so the high bit planes are long runs that compress well.
+ * The bytes after the last multiple of 16 in a chunk are not shuffled. A chunk that does not get smaller
+ * is stored as is, without the bitshuffle.
+ *
+ * Every file has an index sidecar, to seek by sample. It starts with four 32 bit integers: the codec (1 for LZ4,
+ * 2 for zstd), the bytes per sample, the samples per chunk (fewer for short pages), and the bitshuffle block size.
+ * Then follows a record per chunk: the first sample in the observation and the offset in the file (64 bit integers),
+ * and the compressed size and number of samples (32 bit integers). A chunk with a compressed size of samples x bytes
+ * per sample is stored as is; dropped data (see overload.c) has a record per page with size 0 and nothing in the file.
+ * Everything is in the native (little endian) byte order.
+ *
+ * The writer thread of a TAB hands the chunks of a page to the compression threads, waits for them,
+ * and then writes the chunks in order, so the file and index are written from the same thread as before.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "output.h"
+#include "compress.h"
+#include "config.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+typedef struct {
+  int64_t sample;
+  int64_t offset;
+  uint32_t size;
+  uint32_t nsamples;
+} index_record_t;
+
+typedef struct {
+  const char *src;
+  size_t size;
+  char *dst;
+  size_t *result;
+  int writer;
+} job_t;
+
+typedef struct {
+  char *out;          // compressed chunks, per TAB of the writer
+  size_t *sizes;
+  index_record_t *records;
+  int pending;
+} writer_t;
+
+typedef struct {
+  pthread_t thread;
+  char *shuffled;
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+#endif
+} worker_t;
+
+static compress_codec_t codec;
+static int level;
+static int nthreads;
+static int ntabs;
+static int nwriters;
+static size_t tab_size;
+static size_t sample_size;
+static size_t chunk_size;
+static size_t chunk_bound;
+static int nchunks; // per page
+
+static writer_t *writers;
+static worker_t *workers;
+static int *index_fds;
+static off_t *offsets;
+static uint64_t *bytes_in;
+static uint64_t *bytes_out;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static job_t *jobs;
+static int njobs;   // queue capacity
+static long head;   // next job to run
+static long tail;   // next free entry
+static int stopping;
+
+/**
+ * Parse a codec with an optional level, like lz4, or zstd:3
+ *
+ * @param {int *} level Set to the level, or 0 for the default of the codec
+ * @returns {int} 0 on success, -1 for an unknown codec
+ */
+int compress_codec_parse(const char *name, compress_codec_t *codec, int *level) {
+  const char *colon = strchr(name, ':');
+  const size_t length = colon ? (size_t) (colon - name) : strlen(name);
+  if (length == 3 && strncmp(name, "lz4", 3) == 0) {
+    *codec = COMPRESS_LZ4;
+  } else if (length == 4 && strncmp(name, "zstd", 4) == 0) {
+    *codec = COMPRESS_ZSTD;
+  } else {
+    return -1;
+  }
+  *level = colon ? atoi(colon + 1) : 0;
+  return 0;
+}
+
+const char *compress_codec_name(const compress_codec_t codec) {
+  switch (codec) {
+    case COMPRESS_LZ4: return "lz4";
+    case COMPRESS_ZSTD: return "zstd";
+    default: return "none";
+  }
+}
+
+/**
+ * Suffix appended to the name of a compressed filterbank file
+ */
+const char *compress_codec_suffix(const compress_codec_t codec) {
+  switch (codec) {
+    case COMPRESS_LZ4: return ".lz4";
+    case COMPRESS_ZSTD: return ".zst";
+    default: return "";
+  }
+}
+
+/**
+ * Whether the codec was found at build time
+ */
+int compress_codec_available(const compress_codec_t codec) {
+  switch (codec) {
+#ifdef HAVE_LZ4
+    case COMPRESS_LZ4: return 1;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD: return 1;
+#endif
+    default: return 0;
+  }
+}
+
+static size_t bound(const size_t size) {
+  switch (codec) {
+#ifdef HAVE_LZ4
+    case COMPRESS_LZ4: return LZ4_compressBound(size);
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD: return ZSTD_compressBound(size);
+#endif
+    default: return size;
+  }
+}
+
+/**
+ * Bitshuffle n bytes, a multiple of 16: bit b of byte i goes to bit i % 8 of byte b * n / 8 + i / 8
+ */
+#ifdef __SSE2__
+static void shuffle_block(const char *in, char *out, const size_t n) {
+  const size_t plane = n / 8;
+  size_t i;
+  for (i = 0; i < n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) &in[i]);
+    int b;
+    // the highest bit of every byte, shifting the next bit up every time
+    for (b = 7; b >= 0; b--) {
+      const int mask = _mm_movemask_epi8(x);
+      out[b * plane + i / 8] = mask & 0xff;
+      out[b * plane + i / 8 + 1] = mask >> 8;
+      x = _mm_slli_epi16(x, 1);
+    }
+  }
+}
+#else
+static void shuffle_block(const char *in, char *out, const size_t n) {
+  const unsigned char *x = (const unsigned char *) in;
+  const size_t plane = n / 8;
+  size_t i;
+  for (i = 0; i < n; i += 8) {
+    int b;
+    for (b = 0; b < 8; b++) {
+      unsigned char bits = 0;
+      int j;
+      for (j = 0; j < 8; j++) {
+        bits |= ((x[i + j] >> b) & 1) << j;
+      }
+      out[b * plane + i / 8] = bits;
+    }
+  }
+}
+#endif
+
+static void bitshuffle(const char *in, char *out, const size_t size) {
+  size_t start;
+  for (start = 0; start < size; start += COMPRESS_BLOCK) {
+    const size_t length = size - start < COMPRESS_BLOCK ? size - start : COMPRESS_BLOCK;
+    const size_t n = length / 16 * 16;
+    shuffle_block(&in[start], &out[start], n);
+    memcpy(&out[start + n], &in[start + n], length - n);
+  }
+}
+
+/**
+ * Compress a chunk into dst, of chunk_bound bytes
+ *
+ * @returns {size_t} Compressed size, or the size of the chunk when it is stored as is
+ */
+static size_t compress_chunk(worker_t *worker, const char *src, const size_t size, char *dst) {
+  bitshuffle(src, worker->shuffled, size);
+
+  size_t compressed = 0;
+  switch (codec) {
+#ifdef HAVE_LZ4
+    case COMPRESS_LZ4:
+      compressed = LZ4_compress_fast(worker->shuffled, dst, size, chunk_bound, level > 0 ? level : 1);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+      compressed = ZSTD_compressCCtx(worker->cctx, dst, chunk_bound, worker->shuffled, size, level > 0 ? level : 1);
+      if (ZSTD_isError(compressed)) {
+        compressed = 0;
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+
+  if (compressed == 0 || compressed >= size) {
+    memcpy(dst, src, size);
+    return size;
+  }
+  return compressed;
+}
+
+static void *worker_thread(void *arg) {
+  worker_t *worker = arg;
+
+  pthread_mutex_lock(&lock);
+  while (1) {
+    while (head == tail && ! stopping) {
+      pthread_cond_wait(&work_cond, &lock);
+    }
+    if (head == tail) {
+      break;
+    }
+    const job_t job = jobs[head % njobs];
+    head++;
+    pthread_mutex_unlock(&lock);
+
+    *job.result = compress_chunk(worker, job.src, job.size, job.dst);
+
+    pthread_mutex_lock(&lock);
+    if (--writers[job.writer].pending == 0) {
+      pthread_cond_broadcast(&done_cond);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+/**
+ * Start the compression threads, call after pipeline_init
+ *
+ * @param {int} level Level of the codec, or 0 for the default (acceleration for LZ4)
+ * @param {int} nthreads Number of compression threads
+ * @param {int} ntabs Number of files
+ * @param {int} nwriters Number of writer threads of the pipeline
+ * @param {size_t} tab_size Bytes per TAB per page
+ * @param {size_t} sample_size Bytes per sample, the chunks are a number of samples
+ */
+void compress_init(const compress_codec_t codec_, const int level_, const int nthreads_,
+    const int ntabs_, const int nwriters_, const size_t tab_size_, const size_t sample_size_) {
+  codec = codec_;
+  level = level_;
+  nthreads = nthreads_;
+  ntabs = ntabs_;
+  nwriters = nwriters_;
+  tab_size = tab_size_;
+  sample_size = sample_size_;
+
+  const size_t samples = tab_size / sample_size;
+  chunk_size = (samples < COMPRESS_CHUNK_SAMPLES ? samples : COMPRESS_CHUNK_SAMPLES) * sample_size;
+  chunk_bound = bound(chunk_size);
+  nchunks = (tab_size + chunk_size - 1) / chunk_size;
+
+  // every writer handles the TABs tab % nwriters == w, see pipeline.c
+  const int ntabs_per_writer = (ntabs + nwriters - 1) / nwriters;
+  writers = calloc(nwriters, sizeof(writer_t));
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    writers[w].out = malloc((size_t) ntabs_per_writer * nchunks * chunk_bound);
+    writers[w].sizes = malloc(nchunks * sizeof(size_t));
+    writers[w].records = malloc(nchunks * sizeof(index_record_t));
+    if (! writers[w].out || ! writers[w].sizes || ! writers[w].records) {
+      LOG("ERROR: cannot allocate memory for compression\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  index_fds = malloc(ntabs * sizeof(int));
+  offsets = calloc(ntabs, sizeof(off_t));
+  bytes_in = calloc(ntabs, sizeof(uint64_t));
+  bytes_out = calloc(ntabs, sizeof(uint64_t));
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    index_fds[tab] = -1;
+  }
+
+  njobs = nwriters * nchunks;
+  jobs = calloc(njobs, sizeof(job_t));
+  head = 0;
+  tail = 0;
+  stopping = 0;
+
+  workers = calloc(nthreads, sizeof(worker_t));
+  int t;
+  for (t = 0; t < nthreads; t++) {
+    workers[t].shuffled = malloc(chunk_size);
+#ifdef HAVE_ZSTD
+    workers[t].cctx = codec == COMPRESS_ZSTD ? ZSTD_createCCtx() : NULL;
+#endif
+    if (pthread_create(&workers[t].thread, NULL, worker_thread, &workers[t]) != 0) {
+      LOG("ERROR: cannot start compression thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  LOG("Compression: %s, %i threads, chunks of %zu samples\n", compress_codec_name(codec), nthreads, chunk_size / sample_size);
+}
+
+static int write_all(const int fd, const char *data, const size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t n = write(fd, &data[written], size - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    written += n;
+  }
+  return 0;
+}
+
+/**
+ * Create the index sidecar of a file, call after output_set_file; the index of the previous file is closed
+ *
+ * @param {char *} file_name Name of the index
+ * @param {int} header_size Length of the filterbank header, where the first chunk starts
+ * @returns {int} 0 on success, -1 when the file could not be created
+ */
+int compress_open(const int tab, const char *file_name, const int header_size) {
+  if (index_fds[tab] >= 0) {
+    close(index_fds[tab]);
+  }
+  index_fds[tab] = open(file_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  if (index_fds[tab] < 0) {
+    LOG("ERROR: cannot create %s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+  const int32_t header[4] = {codec, sample_size, chunk_size / sample_size, COMPRESS_BLOCK};
+  if (write_all(index_fds[tab], (const char *) header, sizeof(header)) < 0) {
+    LOG("ERROR: cannot write %s: %s\n", file_name, strerror(errno));
+    close(index_fds[tab]);
+    index_fds[tab] = -1;
+    return -1;
+  }
+  offsets[tab] = header_size;
+  return 0;
+}
+
+static void write_records(const int tab, const index_record_t *records, const int n) {
+  if (index_fds[tab] >= 0 && write_all(index_fds[tab], (const char *) records, n * sizeof(index_record_t)) < 0) {
+    LOG("ERROR writing the index of TAB %i: %s\n", tab, strerror(errno));
+  }
+}
+
+/**
+ * Compress and write a transposed TAB, called from the writer threads instead of output_write
+ *
+ * @param {char *} data The TAB, or NULL for a gap
+ */
+void compress_write(const int w, const int tab, char *data, const size_t size, const long page) {
+  writer_t *writer = &writers[w];
+  const int64_t first = page * (int64_t) (tab_size / sample_size);
+
+  if (! data) {
+    // a record per page, the pages can be in different files (see output_segment)
+    size_t gap;
+    long p = page;
+    for (gap = 0; gap < size; gap += tab_size) {
+      output_segment(w, tab, p);
+      index_record_t record = {p * (int64_t) (tab_size / sample_size), offsets[tab], 0, tab_size / sample_size};
+      write_records(tab, &record, 1);
+      p++;
+    }
+    return;
+  }
+
+  // roll over to the next file before the offsets of the chunks are known
+  output_segment(w, tab, page);
+
+  // the chunks of this TAB stay valid until the writer flushes
+  char *out = &writer->out[(size_t) (tab / nwriters) * nchunks * chunk_bound];
+  const int n = (size + chunk_size - 1) / chunk_size;
+
+  pthread_mutex_lock(&lock);
+  int c;
+  for (c = 0; c < n; c++) {
+    job_t *job = &jobs[tail % njobs];
+    job->src = &data[c * chunk_size];
+    job->size = size - c * chunk_size < chunk_size ? size - c * chunk_size : chunk_size;
+    job->dst = &out[c * chunk_bound];
+    job->result = &writer->sizes[c];
+    job->writer = w;
+    tail++;
+  }
+  writer->pending += n;
+  pthread_cond_broadcast(&work_cond);
+  while (writer->pending > 0) {
+    pthread_cond_wait(&done_cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+
+  for (c = 0; c < n; c++) {
+    const size_t length = size - c * chunk_size < chunk_size ? size - c * chunk_size : chunk_size;
+    index_record_t *record = &writer->records[c];
+    record->sample = first + c * (chunk_size / sample_size);
+    record->offset = offsets[tab];
+    record->size = writer->sizes[c];
+    record->nsamples = length / sample_size;
+
+    output_write(w, tab, &out[c * chunk_bound], writer->sizes[c], page);
+    offsets[tab] += writer->sizes[c];
+  }
+  write_records(tab, writer->records, n);
+  bytes_in[tab] += size;
+  bytes_out[tab] += offsets[tab] - writer->records[0].offset;
+}
+
+/**
+ * Wait for all writes of a writer thread to complete
+ */
+void compress_flush(const int w) {
+  output_flush(w);
+}
+
+/**
+ * Close the index files of an observation, call after the writers are done
+ */
+void compress_close() {
+  uint64_t in = 0, out = 0;
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    if (index_fds[tab] >= 0) {
+      close(index_fds[tab]);
+      index_fds[tab] = -1;
+    }
+    in += bytes_in[tab];
+    out += bytes_out[tab];
+  }
+  if (out > 0) {
+    LOG("Compression: %lu bytes written for %lu bytes of data, ratio %.2f\n", out, in, (double) in / out);
+  }
+  memset(bytes_in, 0, ntabs * sizeof(uint64_t));
+  memset(bytes_out, 0, ntabs * sizeof(uint64_t));
+}
+
+/**
+ * Stop the compression threads, call after pipeline_finish
+ */
+void compress_finish() {
+  compress_close();
+
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+
+  int t;
+  for (t = 0; t < nthreads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    free(workers[t].shuffled);
+#ifdef HAVE_ZSTD
+    if (workers[t].cctx) {
+      ZSTD_freeCCtx(workers[t].cctx);
+    }
+#endif
+  }
+  free(workers);
+
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    free(writers[w].out);
+    free(writers[w].sizes);
+    free(writers[w].records);
+  }
+  free(writers);
+  free(jobs);
+  free(index_fds);
+  free(offsets);
+  free(bytes_in);
+  free(bytes_out);
+}
@@ -0,0 +1,33 @@
+#ifndef __HAVE_COMPRESS_H__
+#define __HAVE_COMPRESS_H__
+
+#include <stddef.h>
+
+typedef enum {
+  COMPRESS_NONE,
+  COMPRESS_LZ4,
+  COMPRESS_ZSTD
+} compress_codec_t;
+
+// Samples per compressed chunk, the last chunk of a page can be shorter
+#define COMPRESS_CHUNK_SAMPLES 1024
+
+// Bytes per bitshuffle block, the bit planes of a block are stored together
+#define COMPRESS_BLOCK 8192
+
+// Default number of compression threads
+#define COMPRESS_THREADS 4
+
+extern int compress_codec_parse(const char *name, compress_codec_t *codec, int *level);
+extern const char *compress_codec_name(const compress_codec_t codec);
+extern const char *compress_codec_suffix(const compress_codec_t codec);
+extern int compress_codec_available(const compress_codec_t codec);
+
+extern void compress_init(const compress_codec_t codec, const int level, const int nthreads,
+    const int ntabs, const int nwriters, const size_t tab_size, const size_t sample_size);
+extern int compress_open(const int tab, const char *file_name, const int header_size);
+extern void compress_write(const int writer, const int tab, char *data, const size_t size, const long page);
+extern void compress_flush(const int writer);
+extern void compress_close();
+extern void compress_finish();
+#endif
@@ -0,0 +1,801 @@
+/**
+ * Coordination of the instances that share the TABs of an observation, over a TCP connection.
+ *
+ * One instance is the coordinator (-K <port>), the others join it (-J <host>:<port>). At the start
+ * of every observation an instance registers, and the coordinator answers with the TABs it writes,
+ * the rollover of the files, and the filename prefix; after the observation it reports its throughput.
+ * The protocol is a line of text per message:
+ *
+ *    REGISTER <instance> <MJD_START> <NTABS> <TAB list>|auto
+ *    ASSIGN <TAB list>|- <pages per file> <filename prefix>
+ *    REPORT <instance> <MJD_START> <pages> <bytes> <seconds>
+ *
+ * An instance is named by its host and process id. The answers wait until the given number of instances
+ * registered for the observation, or for COORDINATOR_HOLD seconds. Then every instance gets the TABs of its
+ * list that no instance before it asked for, and the remaining TABs are dealt round robin to the instances
+ * that asked for auto, in the order they connected, with the coordinator first. The observations are
+ * told apart by MJD_START.
+ *
+ * The coordinator itself takes part like the other instances, through direct calls. The server thread
+ * polls the connections, and the state of the observations is shared under a mutex.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "coordinator.h"
+
+typedef struct {
+  char name[COORDINATOR_NAME];
+  int rank;           // position in the connection order, 0 for the coordinator
+  char *request;      // TAB list, or auto
+  int fd;             // connection to answer, or -1 for the coordinator itself or a closed connection
+  int pending;        // waiting for its TABs
+  int ntabs;          // TABs it writes
+  int reported;
+  long pages;
+  uint64_t bytes;
+  double seconds;
+} instance_t;
+
+typedef struct {
+  double mjd;         // MJD_START, 0 for an unused entry
+  int ntabs;
+  int *owners;        // per TAB the instance writing it, or -1
+  int ninstances;     // registered, in order
+  instance_t instances[COORDINATOR_MAXCLIENTS + 1];
+  int resolved;       // the TABs are assigned
+  double deadline;    // to assign the TABs without all instances
+} observation_t;
+
+typedef struct {
+  int fd;
+  char line[COORDINATOR_LINE];
+  int nline;
+} client_t;
+
+static char name[COORDINATOR_NAME];
+
+// coordinator
+static int serving = 0;
+static int ninstances;
+static long serve_segment_pages;
+static char *serve_prefix = NULL;
+static int listen_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+static pthread_t server;
+static client_t clients[COORDINATOR_MAXCLIENTS]; // in the order they connected
+static int nclients = 0;
+static observation_t observations[COORDINATOR_NOBSERVATIONS];
+static int next_observation = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolved = PTHREAD_COND_INITIALIZER;
+
+// member
+static char *host = NULL;
+static char service[16];
+static int fd = -1;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int send_line(const int socket, const char *line) {
+  const size_t size = strlen(line);
+  size_t sent = 0;
+  while (sent < size) {
+    const ssize_t n = send(socket, &line[sent], size - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    sent += n;
+  }
+  return 0;
+}
+
+/**
+ * Name the instance by its host and process id
+ */
+static void set_name() {
+  char hostname[64] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+  snprintf(name, sizeof(name), "%s:%i", hostname, (int) getpid());
+}
+
+/**
+ * Format the TABs written by an instance as a list like 0,3-5, or - for none
+ */
+static void format_tabs(const observation_t *observation, const int owner, char *list, const size_t size) {
+  size_t n = 0;
+  int t = 0;
+  list[0] = '\0';
+  while (t < observation->ntabs && n < size) {
+    if (observation->owners[t] != owner) {
+      t++;
+      continue;
+    }
+    int last = t;
+    while (last + 1 < observation->ntabs && observation->owners[last + 1] == owner) {
+      last++;
+    }
+    if (last == t) {
+      n += snprintf(&list[n], size - n, "%s%i", n ? "," : "", t);
+    } else {
+      n += snprintf(&list[n], size - n, "%s%i-%i", n ? "," : "", t, last);
+    }
+    t = last + 1;
+  }
+  if (! list[0]) {
+    snprintf(list, size, "-");
+  }
+}
+
+/**
+ * Mark the TABs of a list like 0,3-5
+ *
+ * @param {char *} wanted Set to 1 for every TAB in the list, of ntabs entries
+ * @returns {int} 0 on success, -1 for an illegal list
+ */
+static int parse_tabs(const char *list, const int ntabs, char *wanted) {
+  char *copy = strdup(list);
+  int result = 0;
+  char *saveptr;
+  char *token = strtok_r(copy, ",", &saveptr);
+  while (token) {
+    int first, last;
+    if (sscanf(token, "%d-%d", &first, &last) != 2) {
+      if (sscanf(token, "%d", &first) != 1) {
+        result = -1;
+        break;
+      }
+      last = first;
+    }
+    if (first < 0 || last < first || last >= ntabs) {
+      result = -1;
+      break;
+    }
+    for (; first <= last; first++) {
+      wanted[first] = 1;
+    }
+    token = strtok_r(NULL, ",", &saveptr);
+  }
+  free(copy);
+  return result;
+}
+
+/**
+ * The entry of an observation, a new one replaces the oldest
+ */
+static observation_t *find_observation(const double mjd, const int ntabs, const int create) {
+  int o;
+  for (o = 0; o < COORDINATOR_NOBSERVATIONS; o++) {
+    if (observations[o].mjd != 0 && fabs(observations[o].mjd - mjd) < 1e-8) {
+      return &observations[o];
+    }
+  }
+  if (! create) {
+    return NULL;
+  }
+
+  observation_t *observation = &observations[next_observation];
+  next_observation = (next_observation + 1) % COORDINATOR_NOBSERVATIONS;
+  free(observation->owners);
+  int i;
+  for (i = 0; i < observation->ninstances; i++) {
+    free(observation->instances[i].request);
+  }
+  memset(observation, 0, sizeof(observation_t));
+  observation->mjd = mjd;
+  observation->ntabs = ntabs;
+  observation->owners = malloc(ntabs * sizeof(int));
+  for (o = 0; o < ntabs; o++) {
+    observation->owners[o] = -1;
+  }
+  observation->deadline = now() + COORDINATOR_HOLD;
+  return observation;
+}
+
+/**
+ * Give an instance the TABs of its list that no other instance writes
+ */
+static void claim(observation_t *observation, const int i) {
+  instance_t *entry = &observation->instances[i];
+  char *wanted = calloc(observation->ntabs, 1);
+  if (parse_tabs(entry->request, observation->ntabs, wanted) < 0) {
+    LOG("Warning: coordinator: illegal TAB list '%s' from %s\n", entry->request, entry->name);
+    memset(wanted, 0, observation->ntabs);
+  }
+  int t;
+  for (t = 0; t < observation->ntabs; t++) {
+    if (! wanted[t]) {
+      continue;
+    }
+    if (observation->owners[t] >= 0) {
+      LOG("Warning: coordinator: TAB %i of observation %.6f is written by %s, not by %s\n", t, observation->mjd,
+          observation->instances[observation->owners[t]].name, entry->name);
+      continue;
+    }
+    observation->owners[t] = i;
+  }
+  free(wanted);
+}
+
+/**
+ * Tell an instance its TABs, call with the lock held
+ */
+static void answer(observation_t *observation, const int i) {
+  instance_t *entry = &observation->instances[i];
+  entry->ntabs = 0;
+  int t;
+  for (t = 0; t < observation->ntabs; t++) {
+    entry->ntabs += observation->owners[t] == i;
+  }
+  entry->reported = entry->ntabs == 0; // an instance without TABs skips the observation
+  entry->pending = 0;
+
+  char assigned[COORDINATOR_LINE];
+  format_tabs(observation, i, assigned, sizeof(assigned));
+  LOG("Coordinator: %s writes %i TABs of observation %.6f: %s\n", entry->name, entry->ntabs, observation->mjd, assigned);
+  if (entry->fd >= 0) {
+    char reply[2 * COORDINATOR_LINE];
+    snprintf(reply, sizeof(reply), "ASSIGN %s %li %s\n", assigned, serve_segment_pages, serve_prefix);
+    send_line(entry->fd, reply);
+  }
+  pthread_cond_broadcast(&resolved);
+}
+
+/**
+ * Assign the TABs of an observation to the registered instances, call with the lock held
+ *
+ * The lists are handed out first, in the order the instances registered; the remaining TABs are
+ * dealt round robin to the instances that asked for auto, in the order they connected.
+ */
+static void resolve(observation_t *observation) {
+  int auto_instances[COORDINATOR_MAXCLIENTS + 1];
+  int nauto = 0;
+  int i, j;
+  for (i = 0; i < observation->ninstances; i++) {
+    if (strcmp(observation->instances[i].request, "auto") != 0) {
+      claim(observation, i);
+      continue;
+    }
+    // keep them sorted by rank
+    for (j = nauto; j > 0 && observation->instances[auto_instances[j - 1]].rank > observation->instances[i].rank; j--) {
+      auto_instances[j] = auto_instances[j - 1];
+    }
+    auto_instances[j] = i;
+    nauto++;
+  }
+  int t, k = 0;
+  for (t = 0; nauto && t < observation->ntabs; t++) {
+    if (observation->owners[t] < 0) {
+      observation->owners[t] = auto_instances[k++ % nauto];
+    }
+  }
+
+  observation->resolved = 1;
+  for (i = 0; i < observation->ninstances; i++) {
+    answer(observation, i);
+  }
+
+  char unowned[COORDINATOR_LINE];
+  format_tabs(observation, -1, unowned, sizeof(unowned));
+  if (strcmp(unowned, "-") != 0) {
+    LOG("Warning: coordinator: no instance writes TABs %s of observation %.6f\n", unowned, observation->mjd);
+  }
+}
+
+/**
+ * Assign the TABs of observations that waited too long for their instances, call with the lock held
+ */
+static void resolve_expired() {
+  const double time = now();
+  int o;
+  for (o = 0; o < COORDINATOR_NOBSERVATIONS; o++) {
+    observation_t *observation = &observations[o];
+    if (observation->mjd != 0 && ! observation->resolved && time >= observation->deadline) {
+      LOG("Warning: coordinator: %i of %i instances registered for observation %.6f, assigning the TABs\n",
+          observation->ninstances, ninstances, observation->mjd);
+      resolve(observation);
+    }
+  }
+}
+
+/**
+ * Register an instance for an observation, call with the lock held
+ *
+ * The TABs are assigned once all instances registered, or after COORDINATOR_HOLD seconds.
+ * An instance registering later gets its list, or the TABs nobody writes.
+ *
+ * @param {int} rank Position of the instance in the connection order, 0 for the coordinator
+ * @param {char *} tabs TAB list, or auto
+ * @param {int} reply Connection to send the answer to, or -1
+ * @returns {instance_t *} The entry of the instance, or NULL when it cannot be registered
+ */
+static instance_t *register_instance(const char *instance, const int rank, const double mjd, const int ntabs,
+    const char *tabs, const int reply) {
+  observation_t *observation = find_observation(mjd, ntabs, 1);
+  if (observation->ntabs != ntabs) {
+    LOG("Warning: coordinator: %s has %i TABs in observation %.6f, not %i\n", instance, ntabs, mjd, observation->ntabs);
+    return NULL;
+  }
+
+  // a registration replaces the previous one of the instance
+  int i;
+  for (i = 0; i < observation->ninstances && strcmp(observation->instances[i].name, instance) != 0; i++);
+  if (i == observation->ninstances) {
+    if (i == COORDINATOR_MAXCLIENTS + 1) {
+      LOG("Warning: coordinator: too many instances in observation %.6f\n", mjd);
+      return NULL;
+    }
+    snprintf(observation->instances[i].name, COORDINATOR_NAME, "%s", instance);
+    observation->ninstances++;
+  }
+  instance_t *entry = &observation->instances[i];
+  free(entry->request);
+  entry->request = strdup(tabs);
+  entry->rank = rank;
+  entry->fd = reply;
+  entry->pending = 1;
+  int t;
+  for (t = 0; t < ntabs; t++) {
+    if (observation->owners[t] == i) {
+      observation->owners[t] = -1;
+    }
+  }
+
+  if (observation->resolved) {
+    if (strcmp(tabs, "auto") == 0) {
+      for (t = 0; t < ntabs; t++) {
+        if (observation->owners[t] < 0) {
+          observation->owners[t] = i;
+        }
+      }
+    } else {
+      claim(observation, i);
+    }
+    answer(observation, i);
+  } else if (observation->ninstances >= ninstances) {
+    resolve(observation);
+  }
+  return entry;
+}
+
+/**
+ * Log the throughput of an instance, and the total once all registered instances reported, call with the lock held
+ */
+static void report(const char *instance, const double mjd, const long pages, const uint64_t bytes, const double seconds) {
+  observation_t *observation = find_observation(mjd, 0, 0);
+  int i = 0;
+  if (observation) {
+    for (i = 0; i < observation->ninstances && strcmp(observation->instances[i].name, instance) != 0; i++);
+  }
+  if (! observation || i == observation->ninstances) {
+    LOG("Warning: coordinator: report of %s for unknown observation %.6f\n", instance, mjd);
+    return;
+  }
+
+  instance_t *entry = &observation->instances[i];
+  entry->reported = 1;
+  entry->pages = pages;
+  entry->bytes = bytes;
+  entry->seconds = seconds;
+  LOG("Coordinator: %s wrote %i TABs, %li pages, %.2f GB in %.3f s, %.2f GB/s\n", instance, entry->ntabs, pages,
+      bytes * 1e-9, seconds, seconds > 0 ? bytes / seconds * 1e-9 : 0);
+
+  uint64_t total = 0;
+  double longest = 0;
+  for (i = 0; i < observation->ninstances; i++) {
+    if (! observation->instances[i].reported) {
+      return;
+    }
+    total += observation->instances[i].bytes;
+    if (observation->instances[i].seconds > longest) {
+      longest = observation->instances[i].seconds;
+    }
+  }
+  LOG("Coordinator: observation %.6f, %i instances wrote %.2f GB in %.3f s, %.2f GB/s\n", mjd, observation->ninstances,
+      total * 1e-9, longest, longest > 0 ? total / longest * 1e-9 : 0);
+}
+
+/**
+ * Handle a line from a connected instance
+ */
+static void handle_line(const int c, const char *line) {
+  char instance[COORDINATOR_NAME];
+  char tabs[COORDINATOR_LINE];
+  double mjd, seconds;
+  int ntabs;
+  long pages;
+  uint64_t bytes;
+
+  if (sscanf(line, "REGISTER %127s %lf %i %2047s", instance, &mjd, &ntabs, tabs) == 4) {
+    if (ntabs < 1 || ntabs > COORDINATOR_MAXTABS) {
+      LOG("Warning: coordinator: %s has %i TABs, at most %i are supported\n", instance, ntabs, COORDINATOR_MAXTABS);
+      send_line(clients[c].fd, "ASSIGN - 0 -\n");
+      return;
+    }
+    pthread_mutex_lock(&lock);
+    if (! register_instance(instance, c + 1, mjd, ntabs, tabs, clients[c].fd)) {
+      send_line(clients[c].fd, "ASSIGN - 0 -\n");
+    }
+    pthread_mutex_unlock(&lock);
+  } else if (sscanf(line, "REPORT %127s %lf %li %" SCNu64 " %lf", instance, &mjd, &pages, &bytes, &seconds) == 5) {
+    pthread_mutex_lock(&lock);
+    report(instance, mjd, pages, bytes, seconds);
+    pthread_mutex_unlock(&lock);
+  } else {
+    LOG("Warning: coordinator: ignoring '%s'\n", line);
+  }
+}
+
+/**
+ * Read the lines a client sent
+ *
+ * @returns {int} 0 on success, -1 when the connection should be closed
+ */
+static int read_client(const int c) {
+  client_t *client = &clients[c];
+  const ssize_t n = read(client->fd, &client->line[client->nline], sizeof(client->line) - 1 - client->nline);
+  if (n < 0 && errno == EINTR) {
+    return 0;
+  }
+  if (n <= 0) {
+    return -1;
+  }
+  client->nline += n;
+  client->line[client->nline] = '\0';
+
+  char *start = client->line;
+  char *end;
+  while ((end = strchr(start, '\n'))) {
+    *end = '\0';
+    if (end > start && end[-1] == '\r') {
+      end[-1] = '\0';
+    }
+    if (*start) {
+      handle_line(c, start);
+    }
+    start = end + 1;
+  }
+  client->nline -= start - client->line;
+  memmove(client->line, start, client->nline);
+  if (client->nline == sizeof(client->line) - 1) {
+    LOG("Warning: coordinator: line too long, closing the connection\n");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Close a connection, and do not answer on it any more
+ */
+static void close_client(const int c) {
+  pthread_mutex_lock(&lock);
+  int o, i;
+  for (o = 0; o < COORDINATOR_NOBSERVATIONS; o++) {
+    for (i = 0; i < observations[o].ninstances; i++) {
+      if (observations[o].instances[i].fd == clients[c].fd) {
+        observations[o].instances[i].fd = -1;
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  close(clients[c].fd);
+  clients[c].fd = -1;
+}
+
+static void *server_thread(void *arg) {
+  while (1) {
+    struct pollfd fds[COORDINATOR_MAXCLIENTS + 2];
+    fds[0].fd = stop_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd;
+    fds[1].events = POLLIN;
+    int c;
+    for (c = 0; c < nclients; c++) {
+      fds[2 + c].fd = clients[c].fd;
+      fds[2 + c].events = POLLIN;
+    }
+    // wake up every second for the observations waiting for their instances
+    if (poll(fds, 2 + nclients, 1000) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[0].revents) {
+      break;
+    }
+
+    int closed = 0;
+    for (c = 0; c < nclients; c++) {
+      if (fds[2 + c].revents && read_client(c) < 0) {
+        close_client(c);
+        closed = 1;
+      }
+    }
+
+    // keep the connection order, it gives the ranks
+    pthread_mutex_lock(&lock);
+    resolve_expired();
+    if (closed) {
+      int n = 0;
+      for (c = 0; c < nclients; c++) {
+        if (clients[c].fd >= 0) {
+          clients[n++] = clients[c];
+        }
+      }
+      nclients = n;
+    }
+    if (fds[1].revents & POLLIN) {
+      const int client = accept(listen_fd, NULL, NULL);
+      if (client >= 0 && nclients == COORDINATOR_MAXCLIENTS) {
+        LOG("Warning: coordinator: at most %i instances can join\n", COORDINATOR_MAXCLIENTS);
+        close(client);
+      } else if (client >= 0) {
+        clients[nclients].fd = client;
+        clients[nclients].nline = 0;
+        nclients++;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+/**
+ * Coordinate the instances, this one included, from a server thread
+ *
+ * @param {int} port Port to listen on
+ * @param {int} ninstances Number of instances to wait for, including this one
+ * @param {long} segment_pages Pages per file for all instances, 0 for one file per TAB
+ * @param {char *} prefix Filename prefix for all instances, with %s and %m expanded by every instance
+ * @returns {int} 0 on success, -1 on failure
+ */
+int coordinator_serve(const int port, const int ninstances_, const long segment_pages, const char *prefix) {
+  set_name();
+  ninstances = ninstances_;
+  serve_segment_pages = segment_pages;
+  serve_prefix = strdup(prefix);
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  const int on = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, 4) < 0) {
+    LOG("ERROR: cannot coordinate on port %i: %s\n", port, strerror(errno));
+    if (listen_fd >= 0) {
+      close(listen_fd);
+    }
+    listen_fd = -1;
+    return -1;
+  }
+  if (pipe(stop_pipe) < 0 || pthread_create(&server, NULL, server_thread, NULL) != 0) {
+    LOG("ERROR: cannot start the coordinator\n");
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  serving = 1;
+  LOG("Coordinating %i instances on port %i as %s\n", ninstances, port, name);
+  return 0;
+}
+
+/**
+ * Set the coordinator to join, see coordinator_connect
+ *
+ * @param {char *} address Like <host>:<port>
+ * @returns {int} 0 on success, -1 for an illegal address
+ */
+int coordinator_join(const char *address) {
+  const char *colon = strrchr(address, ':');
+  if (! colon || colon == address || atoi(colon + 1) <= 0 || atoi(colon + 1) > 65535) {
+    return -1;
+  }
+  host = strndup(address, colon - address);
+  snprintf(service, sizeof(service), "%i", atoi(colon + 1));
+  set_name();
+  return 0;
+}
+
+int coordinator_enabled() {
+  return serving || host != NULL;
+}
+
+/**
+ * Connect to the coordinator set with coordinator_join, before the first observation so it counts this instance
+ *
+ * @returns {int} 0 on success, -1 on failure, the next registration tries again
+ */
+int coordinator_connect() {
+  if (fd >= 0) {
+    return 0;
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  const int error = getaddrinfo(host, service, &hints, &addresses);
+  if (error != 0) {
+    LOG("Warning: cannot resolve the coordinator %s: %s\n", host, gai_strerror(error));
+    return -1;
+  }
+
+  struct addrinfo *address;
+  for (address = addresses; address; address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    LOG("Warning: cannot connect to the coordinator %s port %s: %s\n", host, service, strerror(errno));
+    return -1;
+  }
+
+  struct timeval timeout = {.tv_sec = COORDINATOR_TIMEOUT, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  LOG("Joined the coordinator %s port %s as %s\n", host, service, name);
+  return 0;
+}
+
+static int receive_line(char *line, const size_t size) {
+  size_t n = 0;
+  while (n + 1 < size) {
+    const ssize_t r = read(fd, &line[n], 1);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    if (line[n] == '\n') {
+      break;
+    }
+    n++;
+  }
+  line[n] = '\0';
+  return 0;
+}
+
+/**
+ * Register the instance for an observation, and get its TABs, rollover, and filename prefix
+ *
+ * @param {double} mjd MJD_START of the observation
+ * @param {char *} tabs TAB list the instance wants to write, or auto
+ * @param {char *} assigned Set to the list of TABs to write, empty for none
+ * @param {long *} segment_pages Set to the pages per file
+ * @param {char *} prefix Set to the filename prefix
+ * @returns {int} 0 on success, -1 when there is no answer from the coordinator
+ */
+int coordinator_register(const double mjd, const int ntabs, const char *tabs, char *assigned, const size_t size,
+    long *segment_pages, char *prefix, const size_t prefix_size) {
+  if (serving) {
+    snprintf(assigned, size, "-");
+    pthread_mutex_lock(&lock);
+    instance_t *entry = ntabs <= COORDINATOR_MAXTABS ? register_instance(name, 0, mjd, ntabs, tabs, -1) : NULL;
+    // wait for the other instances to register
+    while (entry && entry->pending) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;
+      pthread_cond_timedwait(&resolved, &lock, &ts);
+      resolve_expired();
+    }
+    if (entry) {
+      const observation_t *observation = find_observation(mjd, ntabs, 0);
+      format_tabs(observation, (int) (entry - observation->instances), assigned, size);
+    }
+    pthread_mutex_unlock(&lock);
+    *segment_pages = serve_segment_pages;
+    snprintf(prefix, prefix_size, "%s", serve_prefix);
+  } else {
+    if (coordinator_connect() < 0) {
+      return -1;
+    }
+    char line[2 * COORDINATOR_LINE];
+    snprintf(line, sizeof(line), "REGISTER %s %.10f %i %s\n", name, mjd, ntabs, tabs);
+    int offset = 0;
+    if (send_line(fd, line) < 0 || receive_line(line, sizeof(line)) < 0 ||
+        sscanf(line, "ASSIGN %2047s %li %n", assigned, segment_pages, &offset) != 2 || offset == 0) {
+      LOG("Warning: no answer from the coordinator\n");
+      close(fd);
+      fd = -1;
+      return -1;
+    }
+    snprintf(prefix, prefix_size, "%s", &line[offset]);
+  }
+
+  if (strcmp(assigned, "-") == 0) {
+    assigned[0] = '\0';
+  }
+  return 0;
+}
+
+/**
+ * Report the throughput of the instance for an observation
+ *
+ * @param {uint64_t} bytes Data written, over all its TABs
+ */
+void coordinator_report(const double mjd, const long pages, const uint64_t bytes, const double seconds) {
+  if (serving) {
+    pthread_mutex_lock(&lock);
+    report(name, mjd, pages, bytes, seconds);
+    pthread_mutex_unlock(&lock);
+  } else if (fd >= 0) {
+    char line[COORDINATOR_LINE];
+    snprintf(line, sizeof(line), "REPORT %s %.10f %li %" PRIu64 " %.6f\n", name, mjd, pages, bytes, seconds);
+    if (send_line(fd, line) < 0) {
+      LOG("Warning: cannot report to the coordinator\n");
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+/**
+ * Stop the coordinator, or leave it
+ */
+void coordinator_close() {
+  if (serving) {
+    const char stop = 1;
+    if (write(stop_pipe[1], &stop, 1) == 1) {
+      pthread_join(server, NULL);
+    }
+    int c;
+    for (c = 0; c < nclients; c++) {
+      close(clients[c].fd);
+    }
+    nclients = 0;
+    close(listen_fd);
+    listen_fd = -1;
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    for (c = 0; c < COORDINATOR_NOBSERVATIONS; c++) {
+      free(observations[c].owners);
+      observations[c].owners = NULL;
+    }
+    for (c = 0; c < COORDINATOR_NOBSERVATIONS; c++) {
+      int i;
+      for (i = 0; i < observations[c].ninstances; i++) {
+        free(observations[c].instances[i].request);
+      }
+    }
+    free(serve_prefix);
+    serving = 0;
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef __HAVE_COORDINATOR_H__
+#define __HAVE_COORDINATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum length of a line of the protocol, and of the name of an instance
+#define COORDINATOR_LINE 2048
+#define COORDINATOR_NAME 128
+
+// Maximum number of TABs in an observation, so that every TAB list fits in a line
+#define COORDINATOR_MAXTABS 256
+
+// Instances connected to the coordinator, and the observations it keeps track of
+#define COORDINATOR_MAXCLIENTS 32
+#define COORDINATOR_NOBSERVATIONS 8
+
+// Seconds the coordinator waits for all instances to register, and an instance for the answer
+#define COORDINATOR_HOLD 30
+#define COORDINATOR_TIMEOUT (COORDINATOR_HOLD + 10)
+
+extern int coordinator_serve(const int port, const int ninstances, const long segment_pages, const char *prefix);
+extern int coordinator_join(const char *address);
+extern int coordinator_connect();
+extern int coordinator_enabled();
+extern int coordinator_register(const double mjd, const int ntabs, const char *tabs, char *assigned, const size_t size,
+    long *segment_pages, char *prefix, const size_t prefix_size);
+extern void coordinator_report(const double mjd, const long pages, const uint64_t bytes, const double seconds);
+extern void coordinator_close();
+#endif
@@ -0,0 +1,1152 @@
+/**
+ * Transpose from the ringbuffer layout [channel, time(padded_size)] to the
+ * filterbank layout [time, channel], reversing the frequency order on the way.
+ *
+ * The SIMD kernels work on blocks of 16 channels by 16 (SSE2), 32 (AVX2) or 64 (AVX-512) samples.
+ * The 16 channel rows are loaded in reverse order, so the frequency flip comes for free,
+ * and are transposed in registers using 4 rounds of unpack instructions.
+ * AVX2 and AVX-512 do a 16x16 transpose per 128 bit lane, one lane per 16 samples.
+ *
+ * Kernels are registered in deinterleave_variants, and only used when the CPU supports them
+ * (checked at runtime using CPUID), so a binary can run on older nodes.
+ * The SIMD kernels are also generated for the channel counts in use (384, 768, 1536, 3072),
+ * and the autotuner picks between the specialized and general versions.
+ * The *_nt variants write the output with non-temporal stores, in full cache lines, and prefetch the input.
+ *
+ * Time and frequency downsampling is fused with the transpose: a tile is averaged in the input layout,
+ * a chunk of samples at a time, into a small per thread buffer that stays in cache, and that buffer is transposed
+ * by the kernel. The page is read from memory once, and only the downsampled data is written.
+ * Requantization to 4, 2 or 1 bits also works on these buffers, with a per channel scale and offset
+ * from a first pass over the tile.
+ *
+ * Bandpass statistics (sum, sum of squares and clipped samples per input channel) are fused the same way:
+ * the tile is transposed a chunk of samples at a time, and the statistics of the input rows of the chunk
+ * are taken right after the kernel has read them, while they are still in cache.
+ *
+ * Channel flagging and zero-DM filtering need the mean over all channels of a sample, so with those a TAB is cut
+ * in strips of samples instead of blocks of channels. A strip is cleaned a chunk at a time into a per thread
+ * buffer in the input layout, which is then downsampled and transposed like above.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "deinterleave.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Reference implementation, also used for the edges of the tile not covered by the SIMD blocks
+ */
+void deinterleave_generic(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  int channel;
+  for (channel = 0; channel < nchan; channel++) {
+    const char *row = &in[channel * in_stride];
+    char *col = &out[nchan - channel - 1];
+
+    int time;
+    for (time = 0; time < ntime; time++) {
+      col[time * out_stride] = row[time];
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// After the unpack rounds, register i holds the time sample with the bit reversed index of i
+static const int bitreverse16[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+
+/**
+ * Handle the channels not covered by full blocks of 16, and the last ntime % block samples
+ */
+static void deinterleave_edges(const char *in, const int in_stride, char *out, const int out_stride,
+    const int nchan, const int ntime, const int nchan_block, const int ntime_block) {
+
+  // remaining channels for all samples, these go to the start of the output rows
+  if (nchan_block < nchan) {
+    deinterleave_generic(&in[nchan_block * in_stride], in_stride, out, out_stride, nchan - nchan_block, ntime);
+  }
+
+  // remaining samples for the blocked channels
+  if (ntime_block < ntime && nchan_block > 0) {
+    deinterleave_generic(&in[ntime_block], in_stride,
+        &out[ntime_block * out_stride + nchan - nchan_block], out_stride, nchan_block, ntime - ntime_block);
+  }
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void sse2_tile(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  const int nchan_block = nchan & ~15;
+  const int ntime_block = ntime & ~15;
+
+  int time;
+  for (time = 0; time < ntime_block; time += 16) {
+    int channel;
+    for (channel = 0; channel < nchan_block; channel += 16) {
+      __m128i a[16], b[16];
+      int i;
+
+      // load channel rows in reverse order to flip the frequency axis
+      for (i = 0; i < 16; i++) {
+        a[i] = _mm_loadu_si128((const __m128i *) &in[(channel + 15 - i) * in_stride + time]);
+      }
+
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm_unpacklo_epi8(a[2*i], a[2*i+1]);
+        b[i+8] = _mm_unpackhi_epi8(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm_unpacklo_epi16(b[2*i], b[2*i+1]);
+        a[i+8] = _mm_unpackhi_epi16(b[2*i], b[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm_unpacklo_epi32(a[2*i], a[2*i+1]);
+        b[i+8] = _mm_unpackhi_epi32(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm_unpacklo_epi64(b[2*i], b[2*i+1]);
+        a[i+8] = _mm_unpackhi_epi64(b[2*i], b[2*i+1]);
+      }
+
+      char *dst = &out[time * out_stride + nchan - channel - 16];
+      for (i = 0; i < 16; i++) {
+        _mm_storeu_si128((__m128i *) &dst[bitreverse16[i] * out_stride], a[i]);
+      }
+    }
+  }
+
+  deinterleave_edges(in, in_stride, out, out_stride, nchan, ntime, nchan_block, ntime_block);
+}
+
+__attribute__((target("sse2")))
+void deinterleave_sse2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  sse2_tile(in, in_stride, out, out_stride, nchan, ntime);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void avx2_tile(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  const int nchan_block = nchan & ~15;
+  const int ntime_block = ntime & ~31;
+
+  int time;
+  for (time = 0; time < ntime_block; time += 32) {
+    int channel;
+    for (channel = 0; channel < nchan_block; channel += 16) {
+      __m256i a[16], b[16];
+      int i;
+
+      for (i = 0; i < 16; i++) {
+        a[i] = _mm256_loadu_si256((const __m256i *) &in[(channel + 15 - i) * in_stride + time]);
+      }
+
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm256_unpacklo_epi8(a[2*i], a[2*i+1]);
+        b[i+8] = _mm256_unpackhi_epi8(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm256_unpacklo_epi16(b[2*i], b[2*i+1]);
+        a[i+8] = _mm256_unpackhi_epi16(b[2*i], b[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm256_unpacklo_epi32(a[2*i], a[2*i+1]);
+        b[i+8] = _mm256_unpackhi_epi32(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm256_unpacklo_epi64(b[2*i], b[2*i+1]);
+        a[i+8] = _mm256_unpackhi_epi64(b[2*i], b[2*i+1]);
+      }
+
+      // lane 0 holds samples [time, time + 16), lane 1 [time + 16, time + 32)
+      char *dst = &out[time * out_stride + nchan - channel - 16];
+      for (i = 0; i < 16; i++) {
+        _mm_storeu_si128((__m128i *) &dst[bitreverse16[i] * out_stride], _mm256_castsi256_si128(a[i]));
+        _mm_storeu_si128((__m128i *) &dst[(bitreverse16[i] + 16) * out_stride], _mm256_extracti128_si256(a[i], 1));
+      }
+    }
+  }
+
+  // finish the last samples with the narrower kernel
+  if (ntime_block < ntime) {
+    deinterleave_sse2(&in[ntime_block], in_stride, &out[ntime_block * out_stride], out_stride, nchan, ntime - ntime_block);
+  }
+  if (nchan_block < nchan && ntime_block > 0) {
+    deinterleave_generic(&in[nchan_block * in_stride], in_stride, out, out_stride, nchan - nchan_block, ntime_block);
+  }
+}
+
+__attribute__((target("avx2")))
+void deinterleave_avx2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  avx2_tile(in, in_stride, out, out_stride, nchan, ntime);
+}
+
+__attribute__((target("avx512f,avx512bw"), always_inline))
+static inline void avx512_tile(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  const int nchan_block = nchan & ~15;
+  const int ntime_block = ntime & ~63;
+
+  int time;
+  for (time = 0; time < ntime_block; time += 64) {
+    int channel;
+    for (channel = 0; channel < nchan_block; channel += 16) {
+      __m512i a[16], b[16];
+      int i;
+
+      for (i = 0; i < 16; i++) {
+        a[i] = _mm512_loadu_si512((const void *) &in[(channel + 15 - i) * in_stride + time]);
+      }
+
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm512_unpacklo_epi8(a[2*i], a[2*i+1]);
+        b[i+8] = _mm512_unpackhi_epi8(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm512_unpacklo_epi16(b[2*i], b[2*i+1]);
+        a[i+8] = _mm512_unpackhi_epi16(b[2*i], b[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        b[i]   = _mm512_unpacklo_epi32(a[2*i], a[2*i+1]);
+        b[i+8] = _mm512_unpackhi_epi32(a[2*i], a[2*i+1]);
+      }
+      for (i = 0; i < 8; i++) {
+        a[i]   = _mm512_unpacklo_epi64(b[2*i], b[2*i+1]);
+        a[i+8] = _mm512_unpackhi_epi64(b[2*i], b[2*i+1]);
+      }
+
+      // lane l holds samples [time + 16 * l, time + 16 * (l + 1))
+      char *dst = &out[time * out_stride + nchan - channel - 16];
+      for (i = 0; i < 16; i++) {
+        _mm_storeu_si128((__m128i *) &dst[(bitreverse16[i] +  0) * out_stride], _mm512_extracti32x4_epi32(a[i], 0));
+        _mm_storeu_si128((__m128i *) &dst[(bitreverse16[i] + 16) * out_stride], _mm512_extracti32x4_epi32(a[i], 1));
+        _mm_storeu_si128((__m128i *) &dst[(bitreverse16[i] + 32) * out_stride], _mm512_extracti32x4_epi32(a[i], 2));
+        _mm_storeu_si128((__m128i *) &dst[(bitreverse16[i] + 48) * out_stride], _mm512_extracti32x4_epi32(a[i], 3));
+      }
+    }
+  }
+
+  if (ntime_block < ntime) {
+    deinterleave_avx2(&in[ntime_block], in_stride, &out[ntime_block * out_stride], out_stride, nchan, ntime - ntime_block);
+  }
+  if (nchan_block < nchan && ntime_block > 0) {
+    deinterleave_generic(&in[nchan_block * in_stride], in_stride, out, out_stride, nchan - nchan_block, ntime_block);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void deinterleave_avx512(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  avx512_tile(in, in_stride, out, out_stride, nchan, ntime);
+}
+
+/**
+ * Kernels specialized for the channel counts in use: the output stride and the default channel block
+ * are constants, so the compiler can fold the addressing and fully unroll the channel loop.
+ * Other tiles (the last block of a TAB, or another block size) use the general code.
+ */
+#define DEINTERLEAVE_SPECIALIZE(isa, target_, nchannels) \
+__attribute__((target(target_))) \
+static void deinterleave_##isa##_##nchannels(const char *in, const int in_stride, char *out, const int out_stride, \
+    const int nchan, const int ntime) { \
+  if (out_stride == nchannels && nchan == DEINTERLEAVE_CHANNEL_BLOCK) { \
+    isa##_tile(in, in_stride, out, nchannels, DEINTERLEAVE_CHANNEL_BLOCK, ntime); \
+  } else { \
+    isa##_tile(in, in_stride, out, out_stride, nchan, ntime); \
+  } \
+}
+
+#define DEINTERLEAVE_SPECIALIZE_SHAPES(isa, target_) \
+  DEINTERLEAVE_SPECIALIZE(isa, target_, 384) \
+  DEINTERLEAVE_SPECIALIZE(isa, target_, 768) \
+  DEINTERLEAVE_SPECIALIZE(isa, target_, 1536) \
+  DEINTERLEAVE_SPECIALIZE(isa, target_, 3072)
+
+DEINTERLEAVE_SPECIALIZE_SHAPES(sse2, "sse2")
+DEINTERLEAVE_SPECIALIZE_SHAPES(avx2, "avx2")
+DEINTERLEAVE_SPECIALIZE_SHAPES(avx512, "avx512f,avx512bw")
+
+/**
+ * Kernels with non-temporal stores: the output is only read again by the writer, so it does not need to be in cache.
+ * The output rows are cut in cache lines. A tile of the 64 channels of a line by DEINTERLEAVE_NT_TIME samples is transposed
+ * into a buffer on the stack (that stays in L1), and then every row of the tile is streamed out as a complete cache line.
+ * The input rows of the next samples are prefetched DEINTERLEAVE_PREFETCH bytes ahead.
+ * The columns before the first and after the last complete line, and the last samples, use the normal kernel,
+ * as do outputs with rows that are not a multiple of a cache line.
+ */
+#define DEINTERLEAVE_STREAMING(isa, target_) \
+__attribute__((target(target_))) \
+static void deinterleave_##isa##_nt(const char *in, const int in_stride, char *out, const int out_stride, \
+    const int nchan, const int ntime) { \
+  const int head = (64 - (uintptr_t) out % 64) % 64; \
+  const int nlines = nchan > head ? (nchan - head) / 64 : 0; \
+  const int ntime_block = ntime / DEINTERLEAVE_NT_TIME * DEINTERLEAVE_NT_TIME; \
+  if (out_stride % 64 || nlines == 0 || ntime_block == 0) { \
+    isa##_tile(in, in_stride, out, out_stride, nchan, ntime); \
+    return; \
+  } \
+  const int tail = head + 64 * nlines; \
+  char tile[DEINTERLEAVE_NT_TIME * 64] __attribute__((aligned(64))); \
+\
+  int time; \
+  for (time = 0; time < ntime_block; time += DEINTERLEAVE_NT_TIME) { \
+    int column; \
+    for (column = head; column < tail; column += 64) { \
+      /* output columns [column, column + 64) hold input channels [nchan - column - 64, nchan - column) */ \
+      const char *src = &in[(nchan - column - 64) * in_stride + time]; \
+      int i; \
+      if (time + DEINTERLEAVE_NT_TIME < ntime_block) { \
+        for (i = 0; i < 64; i++) { \
+          _mm_prefetch(&src[i * in_stride + DEINTERLEAVE_PREFETCH], _MM_HINT_T0); \
+        } \
+      } \
+      isa##_tile(src, in_stride, tile, 64, 64, DEINTERLEAVE_NT_TIME); \
+\
+      char *dst = &out[time * out_stride + column]; \
+      for (i = 0; i < DEINTERLEAVE_NT_TIME; i++) { \
+        const __m128i *row = (const __m128i *) &tile[i * 64]; \
+        __m128i *line = (__m128i *) &dst[i * out_stride]; \
+        _mm_stream_si128(&line[0], _mm_load_si128(&row[0])); \
+        _mm_stream_si128(&line[1], _mm_load_si128(&row[1])); \
+        _mm_stream_si128(&line[2], _mm_load_si128(&row[2])); \
+        _mm_stream_si128(&line[3], _mm_load_si128(&row[3])); \
+      } \
+    } \
+  } \
+  _mm_sfence(); \
+\
+  /* partial lines at the start and end of the rows, output columns [c0, c1) hold channels [nchan - c1, nchan - c0) */ \
+  if (head > 0) { \
+    isa##_tile(&in[(nchan - head) * in_stride], in_stride, out, out_stride, head, ntime_block); \
+  } \
+  if (tail < nchan) { \
+    isa##_tile(in, in_stride, &out[tail], out_stride, nchan - tail, ntime_block); \
+  } \
+  if (ntime_block < ntime) { \
+    isa##_tile(&in[ntime_block], in_stride, &out[ntime_block * out_stride], out_stride, nchan, ntime - ntime_block); \
+  } \
+}
+
+DEINTERLEAVE_STREAMING(sse2, "sse2")
+DEINTERLEAVE_STREAMING(avx2, "avx2")
+DEINTERLEAVE_STREAMING(avx512, "avx512f,avx512bw")
+
+// registry entries for the specialized kernels
+#define DEINTERLEAVE_SHAPE_VARIANTS(isa, check) \
+  {.name = #isa "_384",  .kernel = deinterleave_##isa##_384,  .supported = check, .nchannels = 384}, \
+  {.name = #isa "_768",  .kernel = deinterleave_##isa##_768,  .supported = check, .nchannels = 768}, \
+  {.name = #isa "_1536", .kernel = deinterleave_##isa##_1536, .supported = check, .nchannels = 1536}, \
+  {.name = #isa "_3072", .kernel = deinterleave_##isa##_3072, .supported = check, .nchannels = 3072},
+#endif
+
+/**
+ * Loop variants from the tune directory, adapted to work on a tile
+ *
+ * loopct_rN: channel loop outside, time loop inside, N channels unrolled
+ * looptc_cN: time loop outside, N complete output rows built in a temporary array and copied at once
+ */
+static inline void loopct(const char *in, const int in_stride, char *out, const int out_stride,
+    const int nchan, const int ntime, const int unroll) {
+  int channel;
+  for (channel = 0; channel + unroll <= nchan; channel += unroll) {
+    int time;
+    for (time = 0; time < ntime; time++) {
+      int i;
+      for (i = 0; i < unroll; i++) {
+        // reverse freq order to comply with header
+        out[time * out_stride + nchan - (channel + i) - 1] = in[(channel + i) * in_stride + time];
+      }
+    }
+  }
+
+  // remaining channels
+  if (channel < nchan) {
+    deinterleave_generic(&in[channel * in_stride], in_stride, out, out_stride, nchan - channel, ntime);
+  }
+}
+
+static inline void looptc(const char *in, const int in_stride, char *out, const int out_stride,
+    const int nchan, const int ntime, const int unroll) {
+  char temp[unroll * nchan];
+
+  int time;
+  for (time = 0; time < ntime; time += unroll) {
+    const int nrows = time + unroll <= ntime ? unroll : ntime - time;
+
+    int channel;
+    for (channel = 0; channel < nchan; channel++) {
+      int i;
+      for (i = 0; i < nrows; i++) {
+        // reverse freq order to comply with header
+        temp[(i + 1) * nchan - channel - 1] = in[channel * in_stride + time + i];
+      }
+    }
+
+    // copy full rows at once
+    int i;
+    for (i = 0; i < nrows; i++) {
+      memcpy(&out[(time + i) * out_stride], &temp[i * nchan], nchan);
+    }
+  }
+}
+
+// the plain loopct variant is deinterleave_generic
+static void loopct_r2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  loopct(in, in_stride, out, out_stride, nchan, ntime, 2);
+}
+static void loopct_r4(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  loopct(in, in_stride, out, out_stride, nchan, ntime, 4);
+}
+static void loopct_r6(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  loopct(in, in_stride, out, out_stride, nchan, ntime, 6);
+}
+static void loopct_r8(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  loopct(in, in_stride, out, out_stride, nchan, ntime, 8);
+}
+
+static void looptc_plain(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  int time;
+  for (time = 0; time < ntime; time++) {
+    int channel;
+    for (channel = 0; channel < nchan; channel++) {
+      out[time * out_stride + nchan - channel - 1] = in[channel * in_stride + time];
+    }
+  }
+}
+static void looptc_c1(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  looptc(in, in_stride, out, out_stride, nchan, ntime, 1);
+}
+static void looptc_c2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  looptc(in, in_stride, out, out_stride, nchan, ntime, 2);
+}
+static void looptc_c4(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  looptc(in, in_stride, out, out_stride, nchan, ntime, 4);
+}
+static void looptc_c6(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime) {
+  looptc(in, in_stride, out, out_stride, nchan, ntime, 6);
+}
+
+static int always_supported() {
+  return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static int sse2_supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+static int avx2_supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static int avx512_supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+/**
+ * All available kernels, the autotuner picks one of these
+ */
+const deinterleave_variant_t deinterleave_variants[] = {
+  {.name = "loopct", .kernel = deinterleave_generic, .supported = always_supported},
+  {.name = "loopct_r2", .kernel = loopct_r2, .supported = always_supported},
+  {.name = "loopct_r4", .kernel = loopct_r4, .supported = always_supported},
+  {.name = "loopct_r6", .kernel = loopct_r6, .supported = always_supported},
+  {.name = "loopct_r8", .kernel = loopct_r8, .supported = always_supported},
+  {.name = "looptc", .kernel = looptc_plain, .supported = always_supported},
+  {.name = "looptc_c1", .kernel = looptc_c1, .supported = always_supported},
+  {.name = "looptc_c2", .kernel = looptc_c2, .supported = always_supported},
+  {.name = "looptc_c4", .kernel = looptc_c4, .supported = always_supported},
+  {.name = "looptc_c6", .kernel = looptc_c6, .supported = always_supported},
+#if defined(__x86_64__) || defined(__i386__)
+  {.name = "sse2", .kernel = deinterleave_sse2, .supported = sse2_supported},
+  {.name = "avx2", .kernel = deinterleave_avx2, .supported = avx2_supported},
+  {.name = "avx512", .kernel = deinterleave_avx512, .supported = avx512_supported},
+  {.name = "sse2_nt", .kernel = deinterleave_sse2_nt, .supported = sse2_supported},
+  {.name = "avx2_nt", .kernel = deinterleave_avx2_nt, .supported = avx2_supported},
+  {.name = "avx512_nt", .kernel = deinterleave_avx512_nt, .supported = avx512_supported},
+  DEINTERLEAVE_SHAPE_VARIANTS(sse2, sse2_supported)
+  DEINTERLEAVE_SHAPE_VARIANTS(avx2, avx2_supported)
+  DEINTERLEAVE_SHAPE_VARIANTS(avx512, avx512_supported)
+#endif
+};
+
+const int deinterleave_nvariants = sizeof(deinterleave_variants) / sizeof(deinterleave_variant_t);
+
+/**
+ * Find a kernel by name
+ *
+ * @param {const char *} name Name of the kernel
+ * @returns {deinterleave_variant_t *} The kernel, or NULL when not found or not supported by this CPU
+ */
+const deinterleave_variant_t *deinterleave_find(const char *name) {
+  int v;
+  for (v = 0; v < deinterleave_nvariants; v++) {
+    if (strcmp(deinterleave_variants[v].name, name) == 0) {
+      return deinterleave_variants[v].supported() ? &deinterleave_variants[v] : NULL;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Sum, sum of squares, and number of clipped samples (0 or 255) of a row of samples, added to the totals
+ */
+#ifdef __SSE2__
+static void row_statistics(const char *row, const int n, uint64_t *sum, uint64_t *sum2, uint64_t *clipped) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i full = _mm_set1_epi8(-1);
+  __m128i s = zero, c = zero; // two 64 bit sums, from _mm_sad_epu8
+  uint64_t squares = 0;
+
+  int i = 0;
+  while (i + 16 <= n) {
+    // four 32 bit sums of squares, added to the total before they can overflow
+    __m128i s2 = zero;
+    const int end = i + 16 * 4096 < n ? i + 16 * 4096 : n;
+    for (; i + 16 <= end; i += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i *) &row[i]);
+      s = _mm_add_epi64(s, _mm_sad_epu8(x, zero));
+      const __m128i lo = _mm_unpacklo_epi8(x, zero);
+      const __m128i hi = _mm_unpackhi_epi8(x, zero);
+      s2 = _mm_add_epi32(s2, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+      const __m128i clip = _mm_or_si128(_mm_cmpeq_epi8(x, zero), _mm_cmpeq_epi8(x, full));
+      c = _mm_add_epi64(c, _mm_sad_epu8(_mm_and_si128(clip, ones), zero));
+    }
+    uint32_t q[4];
+    _mm_storeu_si128((__m128i *) q, s2);
+    squares += (uint64_t) q[0] + q[1] + q[2] + q[3];
+  }
+
+  uint64_t r[2], k[2];
+  _mm_storeu_si128((__m128i *) r, s);
+  _mm_storeu_si128((__m128i *) k, c);
+  *sum += r[0] + r[1];
+  *sum2 += squares;
+  *clipped += k[0] + k[1];
+
+  for (; i < n; i++) {
+    const unsigned char x = row[i];
+    *sum += x;
+    *sum2 += x * x;
+    *clipped += x == 0 || x == 255;
+  }
+}
+#else
+static void row_statistics(const char *row, const int n, uint64_t *sum, uint64_t *sum2, uint64_t *clipped) {
+  const unsigned char *x = (const unsigned char *) row;
+  uint64_t s = 0, s2 = 0, c = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    s += x[i];
+    s2 += x[i] * x[i];
+    c += x[i] == 0 || x[i] == 255;
+  }
+  *sum += s;
+  *sum2 += s2;
+  *clipped += c;
+}
+#endif
+
+/**
+ * Statistics of input rows [first, first + nrows) of a TAB, from the totals per row
+ */
+static void store_statistics(deinterleave_stats_t *stats, const int first, const int nrows, const int nchannels,
+    const uint64_t *sum, const uint64_t *sum2, const uint64_t *clipped) {
+  int r;
+  for (r = 0; r < nrows; r++) {
+    const int c = nchannels - first - r - 1;
+    stats->sum[c] = sum[r];
+    stats->sum2[c] = sum2[r];
+    stats->clipped[c] = clipped[r];
+  }
+}
+
+/**
+ * Transpose channels [channel, channel + block) of a TAB
+ */
+static inline void deinterleave_block(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int channel, const int block, const int nchannels, const int ntimes, const int padded_size) {
+  const int nchan = channel + block < nchannels ? block : nchannels - channel;
+
+  // channels [channel, channel + nchan) end up at [nchannels - channel - nchan, nchannels - channel)
+  kernel(&page[channel * padded_size], padded_size,
+      &transposed[nchannels - channel - nchan], nchannels, nchan, ntimes);
+}
+
+/**
+ * Transpose channels [channel, channel + block) of a TAB, with their statistics
+ *
+ * The chunks are a multiple of 64 samples, so the kernels with non-temporal stores still write complete tiles.
+ */
+static void deinterleave_stats_block(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int channel, const int block, const int nchannels, const int ntimes, const int padded_size,
+    deinterleave_stats_t *stats) {
+  const int nchan = channel + block < nchannels ? block : nchannels - channel;
+  const char *in = &page[(size_t) channel * padded_size];
+
+  int chunk = DEINTERLEAVE_SCRATCH / nchan / 64 * 64;
+  if (chunk < 64) {
+    chunk = 64;
+  }
+
+  uint64_t sum[nchan], sum2[nchan], clipped[nchan];
+  memset(sum, 0, sizeof(sum));
+  memset(sum2, 0, sizeof(sum2));
+  memset(clipped, 0, sizeof(clipped));
+
+  int time;
+  for (time = 0; time < ntimes; time += chunk) {
+    const int ntime = time + chunk < ntimes ? chunk : ntimes - time;
+    kernel(&in[time], padded_size, &transposed[(size_t) time * nchannels + nchannels - channel - nchan], nchannels, nchan, ntime);
+
+    int c;
+    for (c = 0; c < nchan; c++) {
+      row_statistics(&in[(size_t) c * padded_size + time], ntime, &sum[c], &sum2[c], &clipped[c]);
+    }
+  }
+  store_statistics(stats, channel, nchan, nchannels, sum, sum2, clipped);
+}
+
+/**
+ * Average fdec channels and tdec samples, from in [nchan * fdec, ntime * tdec] to out [nchan, ntime]
+ *
+ * Inlined with constant tdec, so the compiler can vectorize the strided loads.
+ */
+static inline void reduce_tile(const char *in, const int in_stride, char *out, const int out_stride,
+    const int nchan, const int ntime, const int tdec, const int fdec) {
+  const float scale = 1.0f / (tdec * fdec);
+  unsigned short sum[ntime];
+
+  int channel;
+  for (channel = 0; channel < nchan; channel++) {
+    memset(sum, 0, ntime * sizeof(unsigned short));
+
+    int f;
+    for (f = 0; f < fdec; f++) {
+      const unsigned char *row = (const unsigned char *) &in[(channel * fdec + f) * in_stride];
+      int i, time;
+      for (i = 0; i < tdec; i++) {
+        for (time = 0; time < ntime; time++) {
+          sum[time] += row[time * tdec + i];
+        }
+      }
+    }
+
+    unsigned char *dst = (unsigned char *) &out[channel * out_stride];
+    int time;
+    for (time = 0; time < ntime; time++) {
+      dst[time] = (unsigned char) (sum[time] * scale + 0.5f);
+    }
+  }
+}
+
+static void reduce(const char *in, const int in_stride, char *out, const int out_stride,
+    const int nchan, const int ntime, const int tdec, const int fdec) {
+  switch (tdec) {
+    case 1: reduce_tile(in, in_stride, out, out_stride, nchan, ntime, 1, fdec); break;
+    case 2: reduce_tile(in, in_stride, out, out_stride, nchan, ntime, 2, fdec); break;
+    case 4: reduce_tile(in, in_stride, out, out_stride, nchan, ntime, 4, fdec); break;
+    case 8: reduce_tile(in, in_stride, out, out_stride, nchan, ntime, 8, fdec); break;
+    default: reduce_tile(in, in_stride, out, out_stride, nchan, ntime, tdec, fdec); break;
+  }
+}
+
+/**
+ * Per channel offset and scale for requantization, from the mean and standard deviation of the (downsampled) data
+ *
+ * Samples are quantized as floor((x - offset) * scale), clipped to [0, 2^nbit - 1],
+ * using the step size of the optimal uniform quantizer for Gaussian noise (Max, 1960).
+ */
+static void quantization(const double sum, const double sum2, const long n, const int nbit, float *offset, float *scale) {
+  const int levels = 1 << nbit;
+  const double step = nbit == 1 ? 1.596 : nbit == 2 ? 0.9957 : 0.3352; // in standard deviations
+  const double mean = sum / n;
+  const double variance = sum2 / n - mean * mean;
+  const double sigma = variance > 0 ? sqrt(variance) : 0;
+
+  if (sigma > 0) {
+    *scale = 1.0 / (step * sigma);
+    *offset = mean - 0.5 * levels * step * sigma;
+  } else {
+    // a flat channel ends up in the middle
+    *scale = 1.0;
+    *offset = mean - 0.5 * levels;
+  }
+}
+
+static void quantize(char *data, const int stride, const int nchan, const int ntime,
+    const float *offsets, const float *scales, const int nbit) {
+  const float maximum = (1 << nbit) - 1;
+  int channel;
+  for (channel = 0; channel < nchan; channel++) {
+    unsigned char *row = (unsigned char *) &data[channel * stride];
+    const float offset = offsets[channel];
+    const float scale = scales[channel];
+    int time;
+    for (time = 0; time < ntime; time++) {
+      float q = (row[time] - offset) * scale;
+      q = q < 0 ? 0 : q > maximum ? maximum : q;
+      row[time] = (unsigned char) q;
+    }
+  }
+}
+
+/**
+ * Pack rows of nchan samples of nbit bits, in SIGPROC order: the first channel in the least significant bits
+ *
+ * Inlined with constant nbit, so the compiler can vectorize the loop.
+ */
+static inline void pack_rows(const char *in, const int nchan, const int ntime, char *out, const int out_stride, const int nbit) {
+  const int per_byte = 8 / nbit;
+  int time;
+  for (time = 0; time < ntime; time++) {
+    const unsigned char *row = (const unsigned char *) &in[time * nchan];
+    unsigned char *dst = (unsigned char *) &out[time * out_stride];
+    int b;
+    for (b = 0; b < nchan / per_byte; b++) {
+      unsigned char v = 0;
+      int i;
+      for (i = 0; i < per_byte; i++) {
+        v |= row[b * per_byte + i] << (i * nbit);
+      }
+      dst[b] = v;
+    }
+  }
+}
+
+static void pack(const char *in, const int nchan, const int ntime, char *out, const int out_stride, const int nbit) {
+  switch (nbit) {
+    case 1: pack_rows(in, nchan, ntime, out, out_stride, 1); break;
+    case 2: pack_rows(in, nchan, ntime, out, out_stride, 2); break;
+    default: pack_rows(in, nchan, ntime, out, out_stride, 4); break;
+  }
+}
+
+/**
+ * Downsample, requantize, and transpose output channels [channel, channel + block) of a TAB
+ *
+ * The tile is processed in chunks of samples that fit in DEINTERLEAVE_SCRATCH bytes.
+ * When requantizing, a first pass over the tile computes the statistics per channel,
+ * and the quantized chunks are transposed to a second buffer, to be packed into the output.
+ * The bandpass statistics of the input rows are taken in the (first) pass, after reducing a chunk.
+ */
+static void deinterleave_reduced_block(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int channel, const int block, const int nchannels, const int ntimes, const int padded_size,
+    const deinterleave_stages_t *stages, deinterleave_stats_t *stats) {
+  const int tdec = stages->tdec;
+  const int fdec = stages->fdec;
+  const int nbit = stages->nbit;
+  const int nout = nchannels / fdec;
+  const int ntout = ntimes / tdec;
+  const int nchan = channel + block < nout ? block : nout - channel;
+  const char *in = &page[(size_t) channel * fdec * padded_size];
+
+  int chunk = DEINTERLEAVE_SCRATCH / nchan / 16 * 16;
+  if (chunk < 16) {
+    chunk = 16;
+  }
+  char scratch[nchan * chunk];
+
+  // bandpass statistics of the input rows
+  const int nrows = nchan * fdec;
+  uint64_t row_sum[nrows], row_sum2[nrows], row_clipped[nrows];
+  memset(row_sum, 0, sizeof(row_sum));
+  memset(row_sum2, 0, sizeof(row_sum2));
+  memset(row_clipped, 0, sizeof(row_clipped));
+
+  if (nbit == 8) {
+    int time;
+    for (time = 0; time < ntout; time += chunk) {
+      const int ntime = time + chunk < ntout ? chunk : ntout - time;
+      reduce(&in[time * tdec], padded_size, scratch, chunk, nchan, ntime, tdec, fdec);
+      kernel(scratch, chunk, &transposed[(size_t) time * nout + nout - channel - nchan], nout, nchan, ntime);
+      if (stats) {
+        int r;
+        for (r = 0; r < nrows; r++) {
+          row_statistics(&in[(size_t) r * padded_size + time * tdec], ntime * tdec, &row_sum[r], &row_sum2[r], &row_clipped[r]);
+        }
+      }
+    }
+    if (stats) {
+      store_statistics(stats, channel * fdec, nrows, nchannels, row_sum, row_sum2, row_clipped);
+    }
+    return;
+  }
+
+  // statistics of the downsampled data, per channel
+  double sum[nchan], sum2[nchan];
+  memset(sum, 0, sizeof(sum));
+  memset(sum2, 0, sizeof(sum2));
+
+  int time;
+  for (time = 0; time < ntout; time += chunk) {
+    const int ntime = time + chunk < ntout ? chunk : ntout - time;
+    reduce(&in[time * tdec], padded_size, scratch, chunk, nchan, ntime, tdec, fdec);
+
+    int c;
+    for (c = 0; c < nchan; c++) {
+      const unsigned char *row = (const unsigned char *) &scratch[c * chunk];
+      unsigned int s = 0, s2 = 0;
+      int t;
+      for (t = 0; t < ntime; t++) {
+        s += row[t];
+        s2 += row[t] * row[t];
+      }
+      sum[c] += s;
+      sum2[c] += s2;
+    }
+    if (stats) {
+      int r;
+      for (r = 0; r < nrows; r++) {
+        row_statistics(&in[(size_t) r * padded_size + time * tdec], ntime * tdec, &row_sum[r], &row_sum2[r], &row_clipped[r]);
+      }
+    }
+  }
+  if (stats) {
+    store_statistics(stats, channel * fdec, nrows, nchannels, row_sum, row_sum2, row_clipped);
+  }
+
+  float offsets[nchan], scales[nchan];
+  int c;
+  for (c = 0; c < nchan; c++) {
+    quantization(sum[c], sum2[c], ntout, nbit, &offsets[c], &scales[c]);
+  }
+
+  // quantize, transpose, and pack
+  char packing[chunk * nchan];
+  const int out_stride = nout * nbit / 8;
+  char *out = &transposed[(nout - channel - nchan) * nbit / 8];
+  for (time = 0; time < ntout; time += chunk) {
+    const int ntime = time + chunk < ntout ? chunk : ntout - time;
+    reduce(&in[time * tdec], padded_size, scratch, chunk, nchan, ntime, tdec, fdec);
+    quantize(scratch, chunk, nchan, ntime, offsets, scales, nbit);
+    kernel(scratch, chunk, packing, nchan, nchan, ntime);
+    pack(packing, nchan, ntime, &out[(size_t) time * out_stride], out_stride, nbit);
+  }
+}
+
+/**
+ * Flag channels and zero-DM filter a chunk of all channels of a TAB, from in [nchannels, ntime] to out [nchannels, ntime]
+ *
+ * The mean of a sample is taken over the channels that are not flagged. With zero-DM, it is subtracted from every
+ * channel and DEINTERLEAVE_ZERODM_LEVEL is added, so the data stays in the 8 bit range. Flagged channels are set
+ * to the mean, which is DEINTERLEAVE_ZERODM_LEVEL after zero-DM.
+ * With row_sum, the bandpass statistics of the input rows are added to row_sum, row_sum2 and row_clipped
+ * in the same pass. The loops run over the samples, so the compiler can vectorize them.
+ */
+static void clean(const char *in, const int in_stride, char *out, const int nchannels, const int ntime,
+    const unsigned char *mask, const int zerodm, uint64_t *row_sum, uint64_t *row_sum2, uint64_t *row_clipped) {
+  uint32_t sum[ntime];
+  unsigned char mean[ntime], fill[ntime];
+  memset(sum, 0, sizeof(sum));
+
+  int nkept = 0;
+  int channel, time;
+  for (channel = 0; channel < nchannels; channel++) {
+    const unsigned char *row = (const unsigned char *) &in[(size_t) channel * in_stride];
+    if (row_sum) {
+      row_statistics((const char *) row, ntime, &row_sum[channel], &row_sum2[channel], &row_clipped[channel]);
+    }
+    if (mask && mask[nchannels - channel - 1]) {
+      continue;
+    }
+    for (time = 0; time < ntime; time++) {
+      sum[time] += row[time];
+    }
+    nkept++;
+  }
+
+  for (time = 0; time < ntime; time++) {
+    mean[time] = nkept ? (sum[time] + nkept / 2) / nkept : DEINTERLEAVE_ZERODM_LEVEL;
+    fill[time] = zerodm ? DEINTERLEAVE_ZERODM_LEVEL : mean[time];
+  }
+
+  for (channel = 0; channel < nchannels; channel++) {
+    const unsigned char *row = (const unsigned char *) &in[(size_t) channel * in_stride];
+    unsigned char *dst = (unsigned char *) &out[(size_t) channel * ntime];
+    if (mask && mask[nchannels - channel - 1]) {
+      memcpy(dst, fill, ntime);
+    } else if (zerodm) {
+      for (time = 0; time < ntime; time++) {
+        const int x = row[time] - mean[time] + DEINTERLEAVE_ZERODM_LEVEL;
+        dst[time] = x < 0 ? 0 : x > 255 ? 255 : x;
+      }
+    } else {
+      memcpy(dst, row, ntime);
+    }
+  }
+}
+
+/**
+ * Transpose a strip of samples of all channels of a TAB, flagging channels and zero-DM filtering, see clean
+ *
+ * The mean over the channels needs every channel of a sample, so the tiles of a TAB are strips in time instead of
+ * blocks of channels. A strip is processed a chunk of samples at a time: the chunk is cleaned from the page into
+ * a per thread buffer that stays in cache, downsampled when needed, and the buffer is transposed into the output.
+ * The bandpass statistics of the input rows are taken while cleaning, and added to stats, which is cleared for the page.
+ *
+ * @param {int} strip Index of the strip in the TAB
+ * @param {int} nstrips Number of strips per TAB
+ */
+static void deinterleave_clean_strip(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int strip, const int nstrips, const int nchannels, const int ntimes, const int padded_size,
+    const deinterleave_stages_t *stages, deinterleave_stats_t *stats) {
+  const int tdec = stages->tdec;
+  const int fdec = stages->fdec;
+  const int nout = nchannels / fdec;
+  const int ntout = ntimes / tdec;
+  const int reduced = tdec > 1 || fdec > 1;
+
+  // output samples per chunk, cleaned at the input resolution in DEINTERLEAVE_CLEAN_SCRATCH bytes
+  int chunk = DEINTERLEAVE_CLEAN_SCRATCH / nchannels / tdec;
+  chunk = chunk >= 16 ? chunk / 16 * 16 : chunk < 1 ? 1 : chunk;
+  const int length = ((ntout + nstrips - 1) / nstrips + chunk - 1) / chunk * chunk;
+  const int first = strip * length;
+  const int last = first + length < ntout ? first + length : ntout;
+  if (first >= last) {
+    return;
+  }
+
+  char cleaned[nchannels * chunk * tdec];
+  char scratch[reduced ? nout * chunk : 1];
+
+  uint64_t row_sum[nchannels], row_sum2[nchannels], row_clipped[nchannels];
+  memset(row_sum, 0, sizeof(row_sum));
+  memset(row_sum2, 0, sizeof(row_sum2));
+  memset(row_clipped, 0, sizeof(row_clipped));
+
+  int time;
+  for (time = first; time < last; time += chunk) {
+    const int ntime = time + chunk < last ? chunk : last - time;
+    const char *in = &page[(size_t) time * tdec];
+    clean(in, padded_size, cleaned, nchannels, ntime * tdec, stages->mask, stages->zerodm,
+        stats ? row_sum : NULL, row_sum2, row_clipped);
+
+    const char *tile = cleaned;
+    int stride = ntime * tdec;
+    if (reduced) {
+      reduce(cleaned, stride, scratch, chunk, nout, ntime, tdec, fdec);
+      tile = scratch;
+      stride = chunk;
+    }
+
+    int channel;
+    for (channel = 0; channel < nout; channel += DEINTERLEAVE_CHANNEL_BLOCK) {
+      const int nchan = channel + DEINTERLEAVE_CHANNEL_BLOCK < nout ? DEINTERLEAVE_CHANNEL_BLOCK : nout - channel;
+      kernel(&tile[(size_t) channel * stride], stride, &transposed[(size_t) time * nout + nout - channel - nchan], nout, nchan, ntime);
+    }
+  }
+
+  if (stats) {
+    int r;
+    for (r = 0; r < nchannels; r++) {
+      const int c = nchannels - r - 1;
+      __atomic_fetch_add(&stats->sum[c], row_sum[r], __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stats->sum2[c], row_sum2[r], __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stats->clipped[c], row_clipped[r], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * Transpose channels [channel, channel + block) of a TAB with nstokes Stokes parameters
+ *
+ * Input:   [nchannels, nstokes, padded_size]
+ * Output:  [ntimes, nstokes, -nchannels], the SIGPROC order for nifs = nstokes
+ *
+ * The kernel transposes every Stokes parameter with strides of nstokes rows and output blocks,
+ * so the tile reads the nstokes adjacent rows of each channel, and writes nstokes complete blocks per output row.
+ */
+static inline void deinterleave_stokes_block(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int channel, const int block, const int nchannels, const int nstokes, const int ntimes, const int padded_size) {
+  const int nchan = channel + block < nchannels ? block : nchannels - channel;
+
+  int stokes;
+  for (stokes = 0; stokes < nstokes; stokes++) {
+    kernel(&page[((size_t) channel * nstokes + stokes) * padded_size], nstokes * padded_size,
+        &transposed[stokes * nchannels + nchannels - channel - nchan], nstokes * nchannels, nchan, ntimes);
+  }
+}
+
+/**
+ * Transpose a tile, with the fused stages when needed
+ *
+ * With a mask or zero-DM, tile (TAB, channel block) becomes (TAB, strip) with as many strips as channel blocks.
+ *
+ * @param {deinterleave_stats_t *} stats Statistics of the TAB, or NULL
+ */
+static inline void deinterleave_tile(deinterleave_kernel_t kernel, const char *page, char *transposed,
+    const int channel, const int block, const int nchannels, const int nstokes, const int ntimes, const int padded_size,
+    const deinterleave_stages_t *stages, deinterleave_stats_t *stats) {
+  if (nstokes > 1) {
+    deinterleave_stokes_block(kernel, page, transposed, channel, block, nchannels, nstokes, ntimes, padded_size);
+  } else if (stages && (stages->mask || stages->zerodm)) {
+    const int nout = nchannels / stages->fdec;
+    deinterleave_clean_strip(kernel, page, transposed, channel / block, (nout + block - 1) / block,
+        nchannels, ntimes, padded_size, stages, stats);
+  } else if (! stages || (stages->tdec == 1 && stages->fdec == 1 && stages->nbit == 8)) {
+    if (stats) {
+      deinterleave_stats_block(kernel, page, transposed, channel, block, nchannels, ntimes, padded_size, stats);
+    } else {
+      deinterleave_block(kernel, page, transposed, channel, block, nchannels, ntimes, padded_size);
+    }
+  } else {
+    deinterleave_reduced_block(kernel, page, transposed, channel, block, nchannels, ntimes, padded_size, stages, stats);
+  }
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Transpose a page
+ *
+ * Input:   [ntabs, nchannels, nstokes, padded_size]
+ * Output:  ntabs times [ntimes / tdec, nstokes, -nchannels / fdec] samples of nbit bits    ; ntimes <= padded_size
+ *
+ * The page is processed in a single openMP parallel region, in blocks of channels per TAB.
+ * Use a block size that is a multiple of 64, so that each thread writes complete cache lines of the output rows.
+ * TABs without an output array are skipped.
+ * With stages->stats, the statistics of every processed TAB in the page are stored in stats[tab].
+ * With stages->mask or stages->zerodm, the channels are flagged and zero-DM filtered before downsampling;
+ * this cannot be combined with requantization.
+ * With stages->seconds and TAB threading, the time spent on every processed TAB is added to seconds[tab];
+ * the other modes share a TAB between threads, so they only have the time of the whole page.
+ * With more than one Stokes parameter (IQUV), the page is only transposed, the stages are not applied.
+ * A time slice of a page is transposed by passing the page from the first sample of the slice, and the slice length as ntimes.
+ *
+ * @param {deinterleave_threading_t} threading How to divide the TABs and channel blocks over the threads
+ * @param {int} block Number of (output) channels per block
+ * @param {char **} transposed Output array per TAB, or NULL to skip the TAB
+ * @param {int} nstokes Stokes parameters per channel, 1 for I or 4 for IQUV
+ * @param {deinterleave_stages_t *} stages Processing fused with the transpose, or NULL for a plain transpose
+ */
+void deinterleave_page(
+    deinterleave_kernel_t kernel,
+    const deinterleave_threading_t threading,
+    const int block,
+    const char *page,
+    char * const *transposed,
+    const int ntabs,
+    const int nchannels,
+    const int nstokes,
+    const int ntimes,
+    const int padded_size,
+    const deinterleave_stages_t *stages) {
+
+  double *seconds = stages ? stages->seconds : NULL;
+  if (nstokes > 1) {
+    stages = NULL;
+  }
+  const int nout = stages ? nchannels / stages->fdec : nchannels;
+  deinterleave_stats_t *stats = stages ? stages->stats : NULL;
+  const int nblocks = (nout + block - 1) / block;
+  const size_t tab_in = (size_t) nchannels * nstokes * padded_size;
+
+  // the TABs to process
+  int tabs[ntabs];
+  int nactive = 0;
+  int t;
+  for (t = 0; t < ntabs; t++) {
+    if (transposed[t]) {
+      tabs[nactive++] = t;
+    }
+  }
+  if (nactive == 0) {
+    return;
+  }
+
+  // the strips add to the statistics
+  if (stats && (stages->mask || stages->zerodm)) {
+    for (t = 0; t < nactive; t++) {
+      memset(stats[tabs[t]].sum, 0, nchannels * sizeof(uint64_t));
+      memset(stats[tabs[t]].sum2, 0, nchannels * sizeof(uint64_t));
+      memset(stats[tabs[t]].clipped, 0, nchannels * sizeof(uint64_t));
+    }
+  }
+
+  if (threading == DEINTERLEAVE_THREADING_TAB) {
+    // a thread per TAB
+    int a;
+#pragma omp parallel for schedule(static)
+    for (a = 0; a < nactive; a++) {
+      const int tab = tabs[a];
+      const double start = seconds ? now() : 0;
+      int b;
+      for (b = 0; b < nblocks; b++) {
+        deinterleave_tile(kernel, &page[tab * tab_in], transposed[tab], b * block, block, nchannels, nstokes, ntimes, padded_size, stages,
+            stats ? &stats[tab] : NULL);
+      }
+      if (seconds) {
+        seconds[tab] += now() - start;
+      }
+    }
+  } else if (threading == DEINTERLEAVE_THREADING_NESTED) {
+    // an outer team over the TABs, and an inner team per TAB over the channel blocks
+#ifdef _OPENMP
+    const int nthreads = omp_get_max_threads();
+#else
+    const int nthreads = 1;
+#endif
+    const int outer = nthreads < nactive ? nthreads : nactive;
+    const int inner = nthreads / outer > 1 ? nthreads / outer : 1;
+
+    int a;
+#pragma omp parallel for schedule(static) num_threads(outer)
+    for (a = 0; a < nactive; a++) {
+      const int tab = tabs[a];
+      int b;
+#pragma omp parallel for schedule(static) num_threads(inner)
+      for (b = 0; b < nblocks; b++) {
+        deinterleave_tile(kernel, &page[tab * tab_in], transposed[tab], b * block, block, nchannels, nstokes, ntimes, padded_size, stages,
+            stats ? &stats[tab] : NULL);
+      }
+    }
+  } else {
+    // all (TAB, channel block) tiles over all threads
+    int tile;
+#pragma omp parallel for schedule(static)
+    for (tile = 0; tile < nactive * nblocks; tile++) {
+      const int tab = tabs[tile / nblocks];
+      const int b = tile % nblocks;
+      deinterleave_tile(kernel, &page[tab * tab_in], transposed[tab], b * block, block, nchannels, nstokes, ntimes, padded_size, stages,
+          stats ? &stats[tab] : NULL);
+    }
+  }
+}
+
+/**
+ * Parse the name of a threading mode
+ *
+ * @returns {int} 0 on success, -1 for an unknown name
+ */
+int deinterleave_threading_parse(const char *name, deinterleave_threading_t *threading) {
+  if (strcmp(name, "tab") == 0) {
+    *threading = DEINTERLEAVE_THREADING_TAB;
+  } else if (strcmp(name, "tile") == 0) {
+    *threading = DEINTERLEAVE_THREADING_TILE;
+  } else if (strcmp(name, "nested") == 0) {
+    *threading = DEINTERLEAVE_THREADING_NESTED;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+const char *deinterleave_threading_name(const deinterleave_threading_t threading) {
+  switch (threading) {
+    case DEINTERLEAVE_THREADING_TAB: return "tab";
+    case DEINTERLEAVE_THREADING_NESTED: return "nested";
+    default: return "tile";
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef __HAVE_DEINTERLEAVE_H__
+#define __HAVE_DEINTERLEAVE_H__
+
+#include <stdint.h>
+
+/**
+ * Transpose a tile of [nchan, ntime] samples to [ntime, nchan], reversing the channel order:
+ *
+ *    out[time * out_stride + nchan - channel - 1] = in[channel * in_stride + time]
+ *
+ * in_stride is the length of an input channel row (padded_size),
+ * out_stride is the length of an output time row (nchannels).
+ */
+typedef void (*deinterleave_kernel_t)(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime);
+
+// Default number of channels per work unit, a multiple of the SIMD block size (16)
+#define DEINTERLEAVE_CHANNEL_BLOCK 64
+
+// Samples per tile of the kernels with non-temporal stores, a multiple of 64,
+// and how far ahead along the input rows they prefetch, in bytes
+#ifndef DEINTERLEAVE_NT_TIME
+#define DEINTERLEAVE_NT_TIME 64
+#endif
+#ifndef DEINTERLEAVE_PREFETCH
+#define DEINTERLEAVE_PREFETCH 256
+#endif
+
+// Size in bytes of the per thread buffer holding a downsampled chunk of a tile
+#define DEINTERLEAVE_SCRATCH (64 * 1024)
+
+// Size in bytes of the per thread buffer holding a flagged and zero-DM filtered chunk of all channels of a TAB
+#define DEINTERLEAVE_CLEAN_SCRATCH (256 * 1024)
+
+// Maximum number of samples averaged into one, tdec * fdec
+#define DEINTERLEAVE_MAX_AVERAGE 256
+
+// Level of the zero-DM filtered data, and of flagged channels after zero-DM: the middle of the 8 bit range
+#define DEINTERLEAVE_ZERODM_LEVEL 128
+
+/**
+ * Statistics of the input samples of a TAB in a page, per input channel in the output (filterbank) order
+ */
+typedef struct {
+  uint64_t *sum;     // [nchannels]
+  uint64_t *sum2;    // [nchannels], sum of squares
+  uint64_t *clipped; // [nchannels], samples at 0 or 255
+} deinterleave_stats_t;
+
+/**
+ * Processing fused with the transpose
+ */
+typedef struct {
+  int tdec; // average this many samples, should divide ntimes
+  int fdec; // average this many channels, should divide nchannels
+  int nbit; // bits per output sample: 8, or requantize to 4, 2 or 1 bits
+  deinterleave_stats_t *stats; // statistics per TAB in the page, or NULL
+  const unsigned char *mask;   // per (input) channel in the output order, non-zero for a flagged channel, or NULL
+  int zerodm;                  // subtract the mean over the channels from every sample
+  double *seconds;             // time spent per TAB in the page is added to seconds[tab], with TAB threading only, or NULL
+} deinterleave_stages_t;
+
+typedef enum {
+  DEINTERLEAVE_THREADING_TAB,   // every thread transposes complete TABs
+  DEINTERLEAVE_THREADING_TILE,  // (TAB, channel block) tiles are divided over all threads
+  DEINTERLEAVE_THREADING_NESTED // TABs over an outer team, channel blocks over an inner team per TAB
+} deinterleave_threading_t;
+
+extern void deinterleave_generic(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime);
+
+#if defined(__x86_64__) || defined(__i386__)
+extern void deinterleave_sse2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime);
+extern void deinterleave_avx2(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime);
+extern void deinterleave_avx512(const char *in, const int in_stride, char *out, const int out_stride, const int nchan, const int ntime);
+#endif
+
+typedef struct {
+  const char *name;
+  deinterleave_kernel_t kernel;
+  int (*supported)(); // returns non-zero when the CPU can run the kernel
+  int nchannels;      // specialized for this number of channels, or 0 for any
+} deinterleave_variant_t;
+
+extern const deinterleave_variant_t deinterleave_variants[];
+extern const int deinterleave_nvariants;
+
+extern const deinterleave_variant_t *deinterleave_find(const char *name);
+
+extern int deinterleave_threading_parse(const char *name, deinterleave_threading_t *threading);
+extern const char *deinterleave_threading_name(const deinterleave_threading_t threading);
+
+extern void deinterleave_page(
+    deinterleave_kernel_t kernel,
+    const deinterleave_threading_t threading,
+    const int block,
+    const char *page,
+    char * const *transposed,
+    const int ntabs,
+    const int nchannels,
+    const int nstokes,
+    const int ntimes,
+    const int padded_size,
+    const deinterleave_stages_t *stages);
+#endif
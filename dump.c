@@ -0,0 +1,272 @@
+/**
+ * Triggered dumps: a ring holding the last pages, already transposed, and a thread that writes
+ * the pages of a trigger to disk.
+ *
+ * The transposer writes every page into the ring (dump_slot), overwriting the oldest page.
+ * A dump is written when all of its pages have arrived, or when the observation ends;
+ * dumps that are complete are written first, so they do not wait for dumps that extend into the future.
+ * Pages that are no longer in the ring are skipped. While a dump is being written, its pages
+ * are not overwritten: dump_slot waits for the dump thread, oldest page first. The page being filled
+ * is recorded under the lock, so the dump thread does not start on the page it replaces.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+#include "memory.h"
+#include "metrics.h"
+#include "dump.h"
+
+typedef struct {
+  long first;
+  long last;
+  unsigned char *tabs; // per TAB, non-zero to write it
+} request_t;
+
+static char *ring;
+static int npages;
+static int ntabs;
+static size_t tab_size;
+static dump_open_t open_file;
+static dump_close_t close_file;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static long newest;        // last page in the ring
+static long filling;       // page being transposed into the ring, or -1
+static long pinned_first;  // pages being written by the dump thread, or -1
+static long pinned_last;
+static request_t queue[DUMP_QUEUE];
+static int queue_length;
+static int finishing;
+static int draining;
+static int ndumps;
+
+static char *slot(const long page, const int tab) {
+  return &ring[((page % npages) * ntabs + tab) * tab_size];
+}
+
+static void write_page(const int fd, const char *data, const int tab, const long page) {
+  size_t written = 0;
+  while (written < tab_size) {
+    ssize_t n = write(fd, &data[written], tab_size - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("ERROR writing page %li of TAB %i to dump %i: %s\n", page, tab, ndumps, strerror(errno));
+      return;
+    }
+    written += n;
+  }
+}
+
+// the first request with all pages available, or any request when finishing; call with the lock held
+static int next_request() {
+  int r;
+  for (r = 0; r < queue_length; r++) {
+    if (queue[r].last <= newest || finishing || draining) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+static void *dump_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (1) {
+    int r;
+    while ((r = next_request()) < 0 && !finishing) {
+      pthread_cond_wait(&cond, &lock);
+    }
+    if (r < 0) {
+      break;
+    }
+
+    request_t request = queue[r];
+    long oldest = newest - npages + 1;
+    if (filling >= 0 && filling - npages >= oldest) {
+      oldest = filling - npages + 1;
+    }
+    const long first = request.first > oldest ? request.first : oldest;
+    const long last = request.last < newest ? request.last : newest;
+
+    if (first > last) {
+      LOG("Warning: dump %i has no pages available, skipped\n", ndumps);
+    } else {
+      if (first > request.first) {
+        LOG("Warning: dump %i starts at page %li, pages from %li are no longer available\n", ndumps, first, request.first);
+      }
+      pinned_first = first;
+      pinned_last = last;
+      pthread_mutex_unlock(&lock);
+
+      int fds[ntabs];
+      int tab;
+      for (tab = 0; tab < ntabs; tab++) {
+        fds[tab] = request.tabs[tab] ? open_file(ndumps, tab, first) : -1;
+      }
+
+      long page;
+      for (page = first; page <= last; page++) {
+        for (tab = 0; tab < ntabs; tab++) {
+          if (fds[tab] >= 0) {
+            const double start = metrics_now();
+            write_page(fds[tab], slot(page, tab), tab, page);
+            metrics_write(tab, metrics_now() - start);
+          }
+        }
+
+        // release the page for the transposer
+        pthread_mutex_lock(&lock);
+        pinned_first = page + 1;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+      }
+
+      for (tab = 0; tab < ntabs; tab++) {
+        if (fds[tab] >= 0) {
+          close_file(fds[tab]);
+        }
+      }
+      LOG("Dump %i: wrote pages %li to %li\n", ndumps, first, last);
+
+      pthread_mutex_lock(&lock);
+      pinned_first = -1;
+      pinned_last = -1;
+    }
+
+    // requests can only have been added at the end of the queue
+    free(request.tabs);
+    memmove(&queue[r], &queue[r + 1], (queue_length - r - 1) * sizeof(request_t));
+    queue_length--;
+    ndumps++;
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+/**
+ * Allocate the ring and start the dump thread
+ *
+ * @param {int} npages Number of pages in the ring
+ * @param {size_t} tab_size Size in bytes of a transposed TAB
+ * @param {dump_open_t} open_file Function to create the file for a TAB of a dump
+ * @param {dump_close_t} close_file Function to close that file
+ */
+void dump_init(const int npages_, const int ntabs_, const size_t tab_size_, dump_open_t open_file_, dump_close_t close_file_) {
+  npages = npages_;
+  ntabs = ntabs_;
+  tab_size = tab_size_;
+  open_file = open_file_;
+  close_file = close_file_;
+
+  newest = -1;
+  filling = -1;
+  pinned_first = -1;
+  pinned_last = -1;
+  queue_length = 0;
+  finishing = 0;
+  draining = 0;
+  ndumps = 0;
+
+  const size_t size = (size_t) npages * ntabs * tab_size;
+  ring = memory_alloc(size, (size_t) ntabs * tab_size, "dump ring");
+
+  if (pthread_create(&thread, NULL, dump_thread, NULL) != 0) {
+    LOG("ERROR: cannot start dump thread\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Address to transpose a TAB of a page to
+ *
+ * Waits while the page it replaces is still being written, then marks the page as being filled
+ * until dump_page_done.
+ */
+char *dump_slot(const long page, const int tab) {
+  const long replaced = page - npages;
+
+  pthread_mutex_lock(&lock);
+  while (pinned_first >= 0 && replaced >= pinned_first && replaced <= pinned_last) {
+    pthread_cond_wait(&cond, &lock);
+  }
+  filling = page;
+  pthread_mutex_unlock(&lock);
+
+  return slot(page, tab);
+}
+
+/**
+ * Mark a page as complete in the ring
+ */
+void dump_page_done(const long page) {
+  pthread_mutex_lock(&lock);
+  newest = page;
+  filling = -1;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Queue a dump of pages [first, last]
+ *
+ * @param {unsigned char *} tabs Per TAB, non-zero to write it
+ * @returns {int} 0 on success, -1 when the queue is full
+ */
+int dump_request(const long first, const long last, const unsigned char *tabs) {
+  pthread_mutex_lock(&lock);
+  if (queue_length == DUMP_QUEUE) {
+    pthread_mutex_unlock(&lock);
+    return -1;
+  }
+
+  request_t *request = &queue[queue_length];
+  request->first = first;
+  request->last = last;
+  request->tabs = malloc(ntabs);
+  memcpy(request->tabs, tabs, ntabs);
+  queue_length++;
+
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+/**
+ * Write the pending dumps with the pages available, and empty the ring for the next observation
+ *
+ * The pages of the next observation are numbered from 0 again; the dump numbers keep counting.
+ */
+void dump_drain() {
+  pthread_mutex_lock(&lock);
+  draining = 1;
+  pthread_cond_broadcast(&cond);
+  while (queue_length > 0) {
+    pthread_cond_wait(&cond, &lock);
+  }
+  draining = 0;
+  newest = -1;
+  filling = -1;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Write the pending dumps with the pages available, then stop the dump thread and free the ring
+ */
+void dump_finish() {
+  pthread_mutex_lock(&lock);
+  finishing = 1;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+
+  pthread_join(thread, NULL);
+  memory_free(ring, (size_t) npages * ntabs * tab_size);
+}
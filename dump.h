@@ -0,0 +1,23 @@
+#ifndef __HAVE_DUMP_H__
+#define __HAVE_DUMP_H__
+
+#include <stddef.h>
+
+// Maximum number of triggered dumps waiting to be written
+#define DUMP_QUEUE 16
+
+/**
+ * Create the file for a TAB of a dump, starting at the given page
+ *
+ * @returns {int} File descriptor, positioned after the header, or -1 on failure
+ */
+typedef int (*dump_open_t)(const int dump, const int tab, const long page);
+typedef void (*dump_close_t)(const int fd);
+
+extern void dump_init(const int npages, const int ntabs, const size_t tab_size, dump_open_t open_file, dump_close_t close_file);
+extern char *dump_slot(const long page, const int tab);
+extern void dump_page_done(const long page);
+extern int dump_request(const long first, const long last, const unsigned char *tabs);
+extern void dump_drain();
+extern void dump_finish();
+#endif
@@ -1,38 +1,68 @@
+/**
+ * SIGPROC filterbank files
+ *
+ * The header is serialized into a memory buffer first, and written with a single call,
+ * so creating a file takes one write instead of one per field, and errors are caught.
+ */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include "filterbank.h"
 
-static void put_raw_string(int fd, char *string) {
+typedef struct {
+  char *data;
+  size_t size;
+  size_t length;
+  int overflow;
+} header_t;
+
+static void put_bytes(header_t *header, const void *data, const size_t size) {
+  if (header->length + size > header->size) {
+    header->overflow = 1;
+    return;
+  }
+  memcpy(&header->data[header->length], data, size);
+  header->length += size;
+}
+
+static void put_raw_string(header_t *header, char *string) {
   int len = strlen(string);
-  ssize_t size;
-  size = write(fd, &len, sizeof(int));
-  size = write(fd, string, sizeof(char) * len);
+  put_bytes(header, &len, sizeof(int));
+  put_bytes(header, string, sizeof(char) * len);
 }
 
-static void put_string(int fd, char *name, char *value) {
-  put_raw_string(fd, name);
-  put_raw_string(fd, value);
+static void put_string(header_t *header, char *name, char *value) {
+  put_raw_string(header, name);
+  put_raw_string(header, value);
 }
 
-static void put_double(int fd, char *name, double value) {
-  put_raw_string(fd, name);
-  ssize_t size = write(fd, &value, sizeof(double));
+static void put_double(header_t *header, char *name, double value) {
+  put_raw_string(header, name);
+  put_bytes(header, &value, sizeof(double));
 }
 
-static void put_int(int fd, char *name, int value) {
-  put_raw_string(fd, name);
-  ssize_t size = write(fd, &value, sizeof(int));
+static void put_int(header_t *header, char *name, int value) {
+  put_raw_string(header, name);
+  put_bytes(header, &value, sizeof(int));
 }
 
 void filterbank_close(int fd) {
   close(fd);
 }
 
-int filterbank_create(
-    char *file_name,
+/**
+ * Serialize a filterbank header
+ *
+ * @param {char *} buffer Buffer for the header, FILTERBANK_HEADER_SIZE bytes is enough for a source name of up to 255 characters
+ * @param {size_t} size Size of the buffer
+ * @returns {int} Length of the header in bytes, or -1 when it does not fit in the buffer
+ */
+int filterbank_header(
+    char *buffer,
+    const size_t size,
     int telescope_id,
     int machine_id,
     char *source_name,
@@ -49,36 +79,67 @@ int filterbank_create(
     int nbeams,
     int ibeam,
     int nifs) {
-  int fd = open(file_name, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  header_t header = {buffer, size, 0, 0};
 
   // Filterbank header from page 4 of http://sigproc.sourceforge.net/sigproc.pdf, retreived 2017-05-31
-  put_raw_string(fd, "HEADER_START");
-  put_int(fd, "telescope_id", telescope_id);
-  put_int(fd, "machine_id", machine_id);
-  put_int(fd, "data_type", 1); // 1: filterbank data, 2: time series dada, DM=0...
+  put_raw_string(&header, "HEADER_START");
+  put_int(&header, "telescope_id", telescope_id);
+  put_int(&header, "machine_id", machine_id);
+  put_int(&header, "data_type", 1); // 1: filterbank data, 2: time series dada, DM=0...
 
   // rawdatafile (char []): the name of the original data file
   // In our case, this can be longer than 80 characters, which several readers cannot handle.
   // A filterbank file is valid without this field
-  // put_string(fd, "rawdatafile", file_name);
+  // put_string(&header, "rawdatafile", file_name);
+
+  put_string(&header, "source_name", source_name); // the name of the source being observed by the telescope
+  put_int(&header, "barycentric", 0); // 0: no, 1: yes
+  put_int(&header, "pulsarcentric", 0); // 0: no, 1: yes
+  put_double(&header, "az_start", az_start); // telescope azimuth at start of scan (degrees)
+  put_double(&header, "za_start", za_start); // telescope zenith angle at start of scan (degrees)
+  put_double(&header, "src_raj", src_raj); // right ascension (J2000) of source (hhmmss.s)
+  put_double(&header, "src_dej", src_dej); // declination (J2000) of source (ddmmss.s)
+  put_double(&header, "tstart", tstart); // time stamp (MJD) of first sample
+  put_double(&header, "tsamp", tsamp); // time interval between samples (s)
+  put_int(&header, "nbits", nbits); // number of bits per time sample
+  put_double(&header, "fch1", fch1); // centre frequency (MHz) of first filterbank channel
+  put_double(&header, "foff", foff); // filterbank channel bandwidth (MHz)
+  put_int(&header, "nchans", nchans); // number of filterbank channels
+  put_int(&header, "nbeams", nbeams); // NOT DOCUMENTED BUT IN USE IN THE SIGPROC CODE
+  put_int(&header, "ibeam", ibeam); // NOT DOCUMENTED BUT IN USE IN THE SIGPROC CODE
+  put_int(&header, "nifs", nifs); // number of seperate IF channels
+  put_raw_string(&header, "HEADER_END");
+
+  return header.overflow ? -1 : (int) header.length;
+}
+
+/**
+ * Create (or truncate) a filterbank file, and write the header
+ *
+ * @param {char *} header Header from filterbank_header
+ * @returns {int} File descriptor positioned after the header, or -1 on failure with errno set
+ */
+int filterbank_create(const char *file_name, const char *header, const size_t header_size) {
+  // opened for reading as well, to allow memory mapping the file
+  int fd = open(file_name, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  if (fd < 0) {
+    return -1;
+  }
 
-  put_string(fd, "source_name", source_name); // the name of the source being observed by the telescope
-  put_int(fd, "barycentric", 0); // 0: no, 1: yes
-  put_int(fd, "pulsarcentric", 0); // 0: no, 1: yes
-  put_double(fd, "az_start", az_start); // telescope azimuth at start of scan (degrees)
-  put_double(fd, "za_start", za_start); // telescope zenith angle at start of scan (degrees)
-  put_double(fd, "src_raj", src_raj); // right ascension (J2000) of source (hhmmss.s)
-  put_double(fd, "src_dej", src_dej); // declination (J2000) of source (ddmmss.s)
-  put_double(fd, "tstart", tstart); // time stamp (MJD) of first sample
-  put_double(fd, "tsamp", tsamp); // time interval between samples (s)
-  put_int(fd, "nbits", nbits); // number of bits per time sample
-  put_double(fd, "fch1", fch1); // centre frequency (MHz) of first filterbank channel
-  put_double(fd, "foff", foff); // filterbank channel bandwidth (MHz)
-  put_int(fd, "nchans", nchans); // number of filterbank channels
-  put_int(fd, "nbeams", nbeams); // NOT DOCUMENTED BUT IN USE IN THE SIGPROC CODE
-  put_int(fd, "ibeam", ibeam); // NOT DOCUMENTED BUT IN USE IN THE SIGPROC CODE
-  put_int(fd, "nifs", nifs); // number of seperate IF channels
-  put_raw_string(fd, "HEADER_END");
+  size_t written = 0;
+  while (written < header_size) {
+    ssize_t n = write(fd, &header[written], header_size - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      const int error = n < 0 ? errno : ENOSPC;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+    written += n;
+  }
 
   return fd;
 }
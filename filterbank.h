@@ -3,10 +3,14 @@
 
 #include <stdio.h>
 
+// Size of a buffer that holds any header with a source name of up to 255 characters
+#define FILTERBANK_HEADER_SIZE 1024
+
 extern void filterbank_close(int fd);
 
-extern int filterbank_create(
-    char *file_name,
+extern int filterbank_header(
+    char *buffer,
+    const size_t size,
     int telescope_id,
     int machine_id,
     char *source_name,
@@ -23,4 +27,6 @@ extern int filterbank_create(
     int nbeams,
     int ibeam,
     int nifs);
+
+extern int filterbank_create(const char *file_name, const char *header, const size_t header_size);
 #endif
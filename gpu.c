@@ -0,0 +1,26 @@
+/**
+ * Fallback when dadafilterbank is built without the GPU transpose (DADAFILTERBANK_CUDA)
+ */
+#include <stdlib.h>
+#include "log.h"
+#include "gpu.h"
+
+int gpu_init(const int device, const int ntabs, const int *tabs, const int nchannels, const int ntimes, const int padded_size) {
+  LOG("ERROR: not built with GPU support, configure with -DDADAFILTERBANK_CUDA=ON\n");
+  return -1;
+}
+
+void gpu_register_ringbuffer(dada_hdu_t *hdu) {
+}
+
+void gpu_register_buffer(char *data, const size_t size) {
+}
+
+void gpu_transpose(const long page, const char *data, char * const *outputs) {
+}
+
+void gpu_wait(const long page) {
+}
+
+void gpu_finish() {
+}
@@ -0,0 +1,184 @@
+/**
+ * Transpose on the GPU, for nodes where the CPU is better spent on the rest of the pipeline.
+ *
+ * Every page goes through one of GPU_NSTREAMS streams: the selected TABs are copied to the device,
+ * transposed and flipped in shared memory tiles, and copied back into the transpose buffer of the page.
+ * gpu_transpose returns when the input is on the device, so the ringbuffer page can be released,
+ * and the transpose and copy back overlap with the copy of the next page.
+ *
+ * The ringbuffer is registered with CUDA (pinned) using psrdada, and so are the transpose buffers,
+ * so all copies are asynchronous DMA transfers.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <cuda_runtime.h>
+
+extern "C" {
+#include "dada_cuda.h"
+#include "log.h"
+#include "gpu.h"
+}
+
+#define CHECK(call) { \
+  const cudaError_t error = (call); \
+  if (error != cudaSuccess) { \
+    LOG("ERROR in %s: %s\n", #call, cudaGetErrorString(error)); \
+    exit(EXIT_FAILURE); \
+  } \
+}
+
+static int ntabs;
+static int *tabs;
+static int nchannels;
+static int ntimes;
+static int padded_size;
+static size_t tab_in;   // bytes per TAB in the page
+static size_t tab_out;  // bytes per transposed TAB
+
+static cudaStream_t streams[GPU_NSTREAMS];
+static cudaEvent_t copied[GPU_NSTREAMS];     // input on the device
+static cudaEvent_t done[GPU_NSTREAMS];       // output on the host
+static char *inputs[GPU_NSTREAMS];
+static char *outputs[GPU_NSTREAMS];
+
+/**
+ * Transpose [TAB, channel, time(padded_size)] to [TAB, time, channel], reversing the channel order
+ *
+ * A block reads a tile of GPU_TILE channels by GPU_TILE samples along the time axis,
+ * and writes it along the channel axis, so both the reads and the writes are coalesced.
+ */
+__global__ void transpose_flip(const char *in, char *out, const int nchannels, const int ntimes, const int padded_size) {
+  __shared__ char tile[GPU_TILE][GPU_TILE + 1];
+
+  const char *tab_in = &in[(size_t) blockIdx.z * nchannels * padded_size];
+  char *tab_out = &out[(size_t) blockIdx.z * nchannels * ntimes];
+  const int time0 = blockIdx.x * GPU_TILE;
+  const int channel0 = blockIdx.y * GPU_TILE;
+
+  int i;
+  for (i = threadIdx.y; i < GPU_TILE; i += GPU_ROWS) {
+    const int channel = channel0 + i;
+    const int time = time0 + threadIdx.x;
+    if (channel < nchannels && time < ntimes) {
+      tile[i][threadIdx.x] = tab_in[(size_t) channel * padded_size + time];
+    }
+  }
+  __syncthreads();
+
+  // consecutive threads take decreasing channels, which are consecutive in the flipped output
+  const int c = GPU_TILE - 1 - threadIdx.x;
+  for (i = threadIdx.y; i < GPU_TILE; i += GPU_ROWS) {
+    const int time = time0 + i;
+    const int channel = channel0 + c;
+    if (time < ntimes && channel < nchannels) {
+      tab_out[(size_t) time * nchannels + nchannels - channel - 1] = tile[c][i];
+    }
+  }
+}
+
+/**
+ * Select the device, and allocate the device buffers and streams
+ *
+ * @param {int} device CUDA device number
+ * @param {int *} tabs TAB in the page for every selected TAB
+ * @returns {int} 0 on success, -1 when the device cannot be used
+ */
+int gpu_init(const int device, const int ntabs_, const int *tabs_, const int nchannels_, const int ntimes_, const int padded_size_) {
+  int ndevices = 0;
+  if (cudaGetDeviceCount(&ndevices) != cudaSuccess || device >= ndevices) {
+    LOG("ERROR: no CUDA device %i\n", device);
+    return -1;
+  }
+  CHECK(cudaSetDevice(device));
+
+  ntabs = ntabs_;
+  tabs = (int *) malloc(ntabs * sizeof(int));
+  memcpy(tabs, tabs_, ntabs * sizeof(int));
+  nchannels = nchannels_;
+  ntimes = ntimes_;
+  padded_size = padded_size_;
+  tab_in = (size_t) nchannels * padded_size;
+  tab_out = (size_t) nchannels * ntimes;
+
+  int s;
+  for (s = 0; s < GPU_NSTREAMS; s++) {
+    CHECK(cudaStreamCreateWithFlags(&streams[s], cudaStreamNonBlocking));
+    CHECK(cudaEventCreateWithFlags(&copied[s], cudaEventDisableTiming));
+    CHECK(cudaEventCreateWithFlags(&done[s], cudaEventDisableTiming));
+    CHECK(cudaMalloc((void **) &inputs[s], ntabs * tab_in));
+    CHECK(cudaMalloc((void **) &outputs[s], ntabs * tab_out));
+  }
+
+  cudaDeviceProp properties;
+  CHECK(cudaGetDeviceProperties(&properties, device));
+  LOG("GPU transpose: device %i (%s), %i streams\n", device, properties.name, GPU_NSTREAMS);
+  return 0;
+}
+
+/**
+ * Pin the ringbuffer data block, so pages are copied to the device without staging
+ */
+void gpu_register_ringbuffer(dada_hdu_t *hdu) {
+  if (dada_cuda_dbregister(hdu) < 0) {
+    LOG("Warning: cannot register the ringbuffer with CUDA, copies are not asynchronous\n");
+  }
+}
+
+/**
+ * Pin a transpose buffer
+ */
+void gpu_register_buffer(char *data, const size_t size) {
+  if (cudaHostRegister(data, size, cudaHostRegisterDefault) != cudaSuccess) {
+    cudaGetLastError();
+    LOG("Warning: cannot register a transpose buffer with CUDA, copies are not asynchronous\n");
+  }
+}
+
+/**
+ * Start the transpose of a page, returns when the page is copied to the device
+ *
+ * @param {long} page Sequence number of the page, to wait for with gpu_wait
+ * @param {char **} outputs Host output per selected TAB, valid until gpu_wait returns
+ */
+void gpu_transpose(const long page, const char *data, char * const *host) {
+  const int s = page % GPU_NSTREAMS;
+
+  // the previous page in this stream is done, the caller waited for it
+  int t;
+  for (t = 0; t < ntabs; t++) {
+    CHECK(cudaMemcpyAsync(&inputs[s][t * tab_in], &data[tabs[t] * tab_in], tab_in, cudaMemcpyHostToDevice, streams[s]));
+  }
+  CHECK(cudaEventRecord(copied[s], streams[s]));
+
+  const dim3 grid((ntimes + GPU_TILE - 1) / GPU_TILE, (nchannels + GPU_TILE - 1) / GPU_TILE, ntabs);
+  const dim3 threads(GPU_TILE, GPU_ROWS);
+  transpose_flip<<<grid, threads, 0, streams[s]>>>(inputs[s], outputs[s], nchannels, ntimes, padded_size);
+  CHECK(cudaGetLastError());
+
+  for (t = 0; t < ntabs; t++) {
+    CHECK(cudaMemcpyAsync(host[t], &outputs[s][t * tab_out], tab_out, cudaMemcpyDeviceToHost, streams[s]));
+  }
+  CHECK(cudaEventRecord(done[s], streams[s]));
+
+  CHECK(cudaEventSynchronize(copied[s]));
+}
+
+/**
+ * Wait until a page is transposed, and in its host outputs
+ */
+void gpu_wait(const long page) {
+  CHECK(cudaEventSynchronize(done[page % GPU_NSTREAMS]));
+}
+
+void gpu_finish() {
+  int s;
+  for (s = 0; s < GPU_NSTREAMS; s++) {
+    cudaStreamSynchronize(streams[s]);
+    cudaFree(inputs[s]);
+    cudaFree(outputs[s]);
+    cudaEventDestroy(copied[s]);
+    cudaEventDestroy(done[s]);
+    cudaStreamDestroy(streams[s]);
+  }
+  free(tabs);
+}
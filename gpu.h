@@ -0,0 +1,20 @@
+#ifndef __HAVE_GPU_H__
+#define __HAVE_GPU_H__
+
+#include <stddef.h>
+#include "dada_hdu.h"
+
+// Number of pages in flight on the GPU, each in its own CUDA stream
+#define GPU_NSTREAMS 2
+
+// Size of the square tiles transposed in shared memory, and the number of rows per thread block
+#define GPU_TILE 32
+#define GPU_ROWS 8
+
+extern int gpu_init(const int device, const int ntabs, const int *tabs, const int nchannels, const int ntimes, const int padded_size);
+extern void gpu_register_ringbuffer(dada_hdu_t *hdu);
+extern void gpu_register_buffer(char *data, const size_t size);
+extern void gpu_transpose(const long page, const char *data, char * const *outputs);
+extern void gpu_wait(const long page);
+extern void gpu_finish();
+#endif
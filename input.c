@@ -0,0 +1,390 @@
+/**
+ * Input of the header and pages: a PSRdada ringbuffer, or PSRdada files replayed from disk.
+ *
+ * Both give the header block and the pages of an observation through the same functions,
+ * so a replay runs the same header parser and pipeline as the ringbuffer, without a feeder.
+ *
+ * Files are mapped read only, and the pages are returned from the mapping without copying.
+ * The next INPUT_READAHEAD pages are read ahead (MADV_WILLNEED), and pages that are done
+ * are released from the mapping, so a replay runs as fast as the disk and the transpose allow.
+ * The page size follows from the header, see input_set_page_size.
+ *
+ * Every file starts with its own header of HDR_SIZE bytes. Like the files written by dada_dbdisk,
+ * a file with a non-zero OBS_OFFSET continues the observation of the previous file; a page that
+ * is split over two files is copied into a separate buffer. A file with OBS_OFFSET 0 (or without it)
+ * starts the next observation. An incomplete last page of an observation is dropped.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ascii_header.h"
+#include "log.h"
+#include "input.h"
+
+// ringbuffer input
+static dada_hdu_t *hdu = NULL;
+
+// file input
+static char **files;
+static int nfiles;
+static int next_file;
+static int skipped_files;  // that could not be read
+static int fd = -1;
+static char *map = NULL;
+static size_t map_size;
+static size_t data_start;  // size of the header of the current file
+static size_t position;    // file offset of the next page
+static size_t released;    // file offset up to which the mapping is released
+static char *header = NULL;
+static int pending;        // the current file starts the next observation
+static int eod;
+static uint64_t obs_bytes; // bytes of the observation read so far
+static size_t page_size;
+static char *split_page = NULL;
+
+/**
+ * Open a connection to the ringbuffer
+ *
+ * @param {char *} key String containing the shared memory key as hexadecimal number
+ */
+void input_open_ringbuffer(char *key) {
+  multilog_t* multilog = NULL; // TODO: See if this is used in anyway by dada
+
+  // create hdu
+  hdu = dada_hdu_create (multilog);
+
+  // init key
+  key_t shmkey;
+  sscanf(key, "%x", &shmkey);
+  dada_hdu_set_key(hdu, shmkey);
+  LOG("dadafilterbank SHMKEY: %s\n", key);
+
+  // connect
+  if (dada_hdu_connect (hdu) < 0) {
+    LOG("ERROR in dada_hdu_connect\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Make data buffers readable
+  if (dada_hdu_lock_read(hdu) < 0) {
+    LOG("ERROR in dada_hdu_open_view\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Replay PSRdada files instead of reading the ringbuffer
+ *
+ * @param {char **} names File names, in the order of the observations
+ */
+void input_open_files(char **names, const int nfiles_) {
+  files = names;
+  nfiles = nfiles_;
+  next_file = 0;
+  skipped_files = 0;
+  pending = 0;
+  eod = 0;
+  LOG("Replaying %i files\n", nfiles);
+}
+
+/**
+ * Number of files to replay that could not be read
+ */
+int input_skipped_files() {
+  return skipped_files;
+}
+
+/**
+ * The ringbuffer, or NULL when replaying files
+ */
+dada_hdu_t *input_ringbuffer() {
+  return hdu;
+}
+
+static void close_file() {
+  if (map) {
+    munmap(map, map_size);
+    map = NULL;
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  free(header);
+  header = NULL;
+}
+
+/**
+ * Map the next file that can be opened, and read its header
+ *
+ * @returns {int} 0 on success, -1 when there are no more files
+ */
+static int open_next_file() {
+  close_file();
+
+  while (next_file < nfiles) {
+    const char *name = files[next_file++];
+    struct stat st;
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      LOG("ERROR: cannot open %s: %s, skipped\n", name, strerror(errno));
+      close_file();
+      skipped_files++;
+      continue;
+    }
+    map_size = st.st_size;
+    map = map_size ? mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+      LOG("ERROR: cannot map %s: %s, skipped\n", name, map_size ? strerror(errno) : "empty file");
+      map = NULL;
+      close_file();
+      skipped_files++;
+      continue;
+    }
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    // the header is text, padded to HDR_SIZE
+    const size_t size = map_size < INPUT_HEADER_SIZE ? map_size : INPUT_HEADER_SIZE;
+    header = calloc(size + 1, 1);
+    memcpy(header, map, size);
+    if (ascii_header_get(header, "HDR_SIZE", "%zu", &data_start) == -1) {
+      data_start = INPUT_HEADER_SIZE;
+    }
+    if (data_start > map_size) {
+      LOG("ERROR: %s is shorter than its header, skipped\n", name);
+      close_file();
+      skipped_files++;
+      continue;
+    }
+    if (data_start > size) {
+      free(header);
+      header = calloc(data_start + 1, 1);
+      memcpy(header, map, data_start);
+    }
+
+    position = data_start;
+    released = 0;
+    LOG("Reading %s\n", name);
+    return 0;
+  }
+
+  return -1;
+}
+
+static uint64_t obs_offset() {
+  uint64_t offset;
+  if (ascii_header_get(header, "OBS_OFFSET", "%lu", &offset) == -1) {
+    return 0;
+  }
+  return offset;
+}
+
+/**
+ * Continue the observation in the next file, or set the end of data
+ */
+static void next_part() {
+  if (open_next_file() < 0) {
+    eod = 1;
+    return;
+  }
+
+  const uint64_t offset = obs_offset();
+  if (offset == 0) {
+    pending = 1;
+    eod = 1;
+    return;
+  }
+  if (offset != obs_bytes) {
+    LOG("Warning: OBS_OFFSET is %lu, expected %lu, data is missing or repeated\n", offset, obs_bytes);
+  }
+}
+
+static void advance(const size_t size) {
+  position += size;
+  obs_bytes += size;
+
+  if (position < map_size) {
+    const long pagesize = sysconf(_SC_PAGESIZE);
+    const size_t start = position / pagesize * pagesize;
+    const size_t length = INPUT_READAHEAD * page_size;
+    madvise(&map[start], start + length < map_size ? length : map_size - start, MADV_WILLNEED);
+  }
+}
+
+/**
+ * Wait for the header block of the next observation
+ *
+ * @returns {char *} The header text, valid until input_header_done, or NULL when there are no more observations
+ */
+char *input_next_header() {
+  if (hdu) {
+    uint64_t bufsz = 0;
+    char *block = ipcbuf_get_next_read(hdu->header_block, &bufsz);
+    return block && bufsz ? block : NULL;
+  }
+
+  if (! pending && open_next_file() < 0) {
+    return NULL;
+  }
+  pending = 0;
+  eod = 0;
+  obs_bytes = obs_offset();
+  if (obs_bytes) {
+    LOG("Warning: OBS_OFFSET is %lu, the start of the observation is missing\n", obs_bytes);
+  }
+  return header;
+}
+
+/**
+ * Tell the ringbuffer the header has been read
+ */
+void input_header_done() {
+  if (hdu && ipcbuf_mark_cleared(hdu->header_block) < 0) {
+    LOG("ERROR. Cannot mark the header as cleared\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Set the size of a page of the current observation, for files; the ringbuffer has its own
+ */
+void input_set_page_size(const size_t size) {
+  if (hdu || size == page_size) {
+    return;
+  }
+  page_size = size;
+  free(split_page);
+  split_page = malloc(page_size);
+}
+
+/**
+ * Get the next page of the observation
+ *
+ * @param {uint64_t *} size Set to the size of the page
+ * @returns {char *} The page, valid until input_page_done, or NULL at the end of data
+ */
+char *input_next_page(uint64_t *size) {
+  if (hdu) {
+    return ipcbuf_get_next_read((ipcbuf_t *) hdu->data_block, size);
+  }
+
+  size_t n = 0; // bytes of a page split over files
+  while (! eod) {
+    const size_t available = map_size - position;
+    if (n == 0 && available >= page_size) {
+      char *page = &map[position];
+      advance(page_size);
+      *size = page_size;
+      return page;
+    }
+    if (n + available >= page_size) {
+      memcpy(&split_page[n], &map[position], page_size - n);
+      advance(page_size - n);
+      *size = page_size;
+      return split_page;
+    }
+    memcpy(&split_page[n], &map[position], available);
+    n += available;
+    advance(available);
+    next_part();
+  }
+
+  if (n > 0) {
+    LOG("Warning: dropping the incomplete last page, %zu of %zu bytes\n", n, page_size);
+  }
+  return NULL;
+}
+
+/**
+ * Release the page returned by input_next_page
+ */
+void input_page_done() {
+  if (hdu) {
+    ipcbuf_mark_cleared((ipcbuf_t *) hdu->data_block);
+    return;
+  }
+
+  const long pagesize = sysconf(_SC_PAGESIZE);
+  const size_t end = position / pagesize * pagesize;
+  if (map && end > released) {
+    madvise(&map[released], end - released, MADV_DONTNEED);
+    released = end;
+  }
+}
+
+int input_eod() {
+  if (hdu) {
+    return ipcbuf_eod((ipcbuf_t *) hdu->data_block);
+  }
+  return eod;
+}
+
+/**
+ * Release the pages of an observation that cannot be processed, until the end of data
+ */
+void input_skip_observation() {
+  if (hdu) {
+    ipcbuf_t *data_block = (ipcbuf_t *) hdu->data_block;
+    uint64_t bufsz;
+    while (! ipcbuf_eod(data_block)) {
+      if (! ipcbuf_get_next_read(data_block, &bufsz)) {
+        break;
+      }
+      ipcbuf_mark_cleared(data_block);
+    }
+    return;
+  }
+
+  while (! eod) {
+    next_part();
+  }
+}
+
+/**
+ * Ready the input for the next observation, after the end of data
+ *
+ * @returns {int} 0 on success, -1 on failure
+ */
+int input_next_observation() {
+  if (hdu) {
+    return ipcbuf_reset((ipcbuf_t *) hdu->data_block);
+  }
+  return 0;
+}
+
+/**
+ * Size of the ringbuffer buffers, a page should fit in one
+ *
+ * @returns {uint64_t} Bytes per buffer, or 0 when replaying files
+ */
+uint64_t input_buffer_size() {
+  return hdu ? ipcbuf_get_bufsz((ipcbuf_t *) hdu->data_block) : 0;
+}
+
+/**
+ * Number of full pages in the ringbuffer, and its size; 0 when replaying files
+ */
+void input_fill(uint64_t *nfull, uint64_t *nbufs) {
+  if (hdu) {
+    *nfull = ipcbuf_get_nfull((ipcbuf_t *) hdu->data_block);
+    *nbufs = ipcbuf_get_nbufs((ipcbuf_t *) hdu->data_block);
+  } else {
+    *nfull = 0;
+    *nbufs = 0;
+  }
+}
+
+void input_close() {
+  if (hdu) {
+    dada_hdu_unlock_read(hdu);
+    dada_hdu_disconnect(hdu);
+    return;
+  }
+  close_file();
+  free(split_page);
+}
@@ -0,0 +1,30 @@
+#ifndef __HAVE_INPUT_H__
+#define __HAVE_INPUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dada_hdu.h"
+
+// Header size of files without HDR_SIZE, the PSRdada default
+#define INPUT_HEADER_SIZE 4096
+
+// Number of pages read ahead of the transposer when replaying files
+#define INPUT_READAHEAD 2
+
+extern void input_open_ringbuffer(char *key);
+extern void input_open_files(char **names, const int nfiles);
+extern dada_hdu_t *input_ringbuffer();
+extern int input_skipped_files();
+
+extern char *input_next_header();
+extern void input_header_done();
+extern void input_set_page_size(const size_t size);
+extern char *input_next_page(uint64_t *size);
+extern void input_page_done();
+extern int input_eod();
+extern void input_skip_observation();
+extern int input_next_observation();
+extern uint64_t input_buffer_size();
+extern void input_fill(uint64_t *nfull, uint64_t *nbufs);
+extern void input_close();
+#endif
@@ -0,0 +1,10 @@
+#ifndef __HAVE_LOG_H__
+#define __HAVE_LOG_H__
+
+#include <stdio.h>
+
+// Log to stdout and to the logfile
+extern FILE *runlog;
+#define LOG(...) {fprintf(stdout, __VA_ARGS__); fprintf(runlog, __VA_ARGS__); fflush(stdout); fflush(runlog);}
+
+#endif
@@ -5,12 +5,15 @@
  * 
  *    A ringbuffer page is interpreted as an array of Stokes I:
  *    [NTABS, NCHANNELS, padded_size] = [12, 1536, > 25000]
+ *    or, in the IQUV modes, of the four Stokes parameters:
+ *    [NTABS, NCHANNELS, 4, padded_size]
  *
  *    Written for the AA-Alert project, ASTRON
  *
  * Author: Jisk Attema, Netherlands eScience Center
  * Licencse: Apache v2.0
  */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,23 +21,41 @@
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "dada_hdu.h"
 #include "ascii_header.h"
+#include "log.h"
 #include "filterbank.h"
+#include "dump.h"
+#include "trigger.h"
+#include "deinterleave.h"
+#include "autotune.h"
+#include "pipeline.h"
+#include "output.h"
+#include "memory.h"
+#include "metrics.h"
+#include "gpu.h"
+#include "input.h"
+#include "stats.h"
+#include "mask.h"
+#include "overload.h"
+#include "compress.h"
+#include "stripe.h"
+#include "stream.h"
+#include "coordinator.h"
 #include "config.h"
 
-#define MAXTABS 12
-int output[MAXTABS];
+int *output = NULL; // per selected TAB
 
 FILE *runlog = NULL;
-#define LOG(...) {fprintf(stdout, __VA_ARGS__); fprintf(runlog, __VA_ARGS__); fflush(stdout); fflush(runlog);}
-
-// Hardcoded parameters
-const unsigned int nchannels = 1536; // Must be divisible by 6 for the current transpose/inverse implementation
-const unsigned int nbit = 8;
 
 // Parameters read from ringbuffer header block (with default to lowest data rate)
+int nchannels = 1536;
+int nbit = 8;
 int science_case = 3;
 int science_mode = 2;
 int padded_size = 12500;
@@ -46,52 +67,123 @@ char source_name[256];
 double az_start;
 double za_start;
 double mjd_start;
+int header_ntabs = 0; // NTABS, or 0 for the default of the science case
+
+// Threading, set from the commandline
+deinterleave_threading_t threading = DEINTERLEAVE_THREADING_TILE;
+int channel_block = DEINTERLEAVE_CHANNEL_BLOCK;
+int *cpus = NULL;
+int ncpus = 0;
+
+// Pipeline, set from the commandline
+int nbuffers = 3;
+int nwriters = 2;
+output_backend_t output_backend = OUTPUT_WRITE;
+int direct_io = 0;
+memory_huge_t huge_pages = MEMORY_HUGE_THP;
+int lock_memory = 1;
+int gpu_device = -1;
+double expected_duration = 0;
+long extent_mb = 0;
+
+// Downsampling and requantization, set from the commandline
+deinterleave_stages_t stages = {.tdec = 1, .fdec = 1, .nbit = 8};
+
+// Bandpass statistics sidecar files, set from the commandline
+int bandpass = 0;
+
+// Channel mask file for flagging, or NULL, set from the commandline
+char *mask_file = NULL;
+
+// Degradation when the ringbuffer fills up, set from the commandline
+overload_policy_t overload_policy = OVERLOAD_OFF;
 
 // Derived parameters (with default to lowest data rate)
 double tsamp = 1.024 / 12500;
 int ntimes = 12500;
 int ntabs = 1;
+int nstokes = 1;
 
-/**
- * Open a connection to the ringbuffer
- *
- * @param {char *} key String containing the shared memory key as hexadecimal number
- * @returns {hdu *} A connected HDU
- */
-dada_hdu_t *init_ringbuffer(char *key) {
-  uint64_t nbufs;
-  int header_incomplete = 0;
+// TABs to transpose and write, from the commandline or the header (default all)
+int *selected = NULL;
+int nselected = 0;
+int allocated_tabs = 0; // size of the arrays per TAB
+char selection[256] = "";
+int selection_set = 0;
 
-  multilog_t* multilog = NULL; // TODO: See if this is used in anyway by dada
+// Triggered dumps, set from the commandline
+double ring_duration = 0;
+char *trigger_source = NULL;
+char *dump_prefix = NULL;
 
-  // create hdu
-  dada_hdu_t *hdu = dada_hdu_create (multilog);
+// Metrics, set from the commandline
+double metrics_interval = 60;
+int metrics_port = 0;
 
-  // init key
-  key_t shmkey;
-  sscanf(key, "%x", &shmkey);
-  dada_hdu_set_key(hdu, shmkey);
-  LOG("dadafilterbank SHMKEY: %s\n", key);
+// Daemon mode, set from the commandline
+int daemon_mode = 0;
 
-  // connect
-  if (dada_hdu_connect (hdu) < 0) {
-    LOG("ERROR in dada_hdu_connect\n");
-    exit(EXIT_FAILURE);
-  }
+// Replay PSRdada files instead of the ringbuffer, when given on the commandline
+int replay = 0;
 
-  // Make data buffers readable
-  if (dada_hdu_lock_read(hdu) < 0) {
-    LOG("ERROR in dada_hdu_open_view\n");
-    exit(EXIT_FAILURE);
-  }
+// Rollover and output directories, set from the commandline
+long segment_pages = 0;
+char *directories[MAXDIRS];
+int ndirectories = 0;
+stripe_policy_t stripe_policy = STRIPE_ROUND_ROBIN;
+int *segment_directories = NULL; // per selected TAB, the directory of its current file
+char *output_prefix = NULL;       // the expanded filename prefix of the observation
 
-  // get write address
-  char *header;
-  uint64_t bufsz;
-  header = ipcbuf_get_next_read (hdu->header_block, &bufsz);
-  if (! header || ! bufsz) {
-    LOG("ERROR. Get next header block error\n");
-    exit(EXIT_FAILURE);
+// Compressed output, set from the commandline
+compress_codec_t compression = COMPRESS_NONE;
+int compression_level = 0;
+int compression_threads = COMPRESS_THREADS;
+
+// Time slices of the pages, set from the commandline
+int slice_samples = 0; // samples per slice, 0 for whole pages
+int nslices = 1;       // slices per page
+
+// Streaming of the TABs, set from the commandline
+int stream_only = 0;      // stream instead of writing files
+char *obs_header = NULL;  // the header text of the observation, for the output ringbuffers
+
+// Coordination with the other instances, set from the commandline
+int coordinator_port = 0;          // coordinate on this port
+int coordinator_instances = 0;     // the number of instances, including the coordinator
+char *coordinator_address = NULL;  // or join the coordinator at <host>:<port>
+long local_segment_pages = 0;      // the rollover from the commandline, without an answer from the coordinator
+char coordinated_prefix[256] = ""; // the filename prefix from the coordinator, or empty for the one from the commandline
+
+// Processing set up by start_processing, kept over observations with the same page shape and rollover
+typedef struct {
+  int ntabs;
+  int nchannels;
+  int nstokes;
+  int ntimes;
+  int padded_size;
+  int nselected;
+  int *selected;
+  long segment_pages;
+} shape_t;
+
+shape_t shape;
+int processing = 0;
+deinterleave_kernel_t kernel = NULL;
+size_t tab_size;
+size_t slice_size; // per TAB, the unit of the pipeline
+int ringbuffer_registered = 0;
+
+/**
+ * Parse the header block of the next observation, from the ringbuffer or a file
+ *
+ * @returns {int} 0 on success, 1 when the header is incomplete, -1 when there is no header
+ */
+int read_header() {
+  int header_incomplete = 0;
+
+  char *header = input_next_header();
+  if (! header) {
+    return -1;
   }
 
   // parse header
@@ -140,37 +232,378 @@ dada_hdu_t *init_ringbuffer(char *key) {
     header_incomplete = 1;
   }
 
-  // tell the ringbuffer the header has been read
-  if (ipcbuf_mark_cleared(hdu->header_block) < 0) {
-    LOG("ERROR. Cannot mark the header as cleared\n");
-    exit(EXIT_FAILURE);
+  // optional, for backends other than the ARTS default of 1536 channels of 8 bits
+  if(ascii_header_get(header, "NCHAN", "%i", &nchannels) == -1) {
+    nchannels = 1536;
+  }
+  if(ascii_header_get(header, "NBIT", "%i", &nbit) == -1) {
+    nbit = 8;
+  }
+  if(ascii_header_get(header, "NTABS", "%i", &header_ntabs) == -1) {
+    header_ntabs = 0;
+  }
+  if(! selection_set && ascii_header_get(header, "FILTERBANK_TABS", "%255s", selection) == -1) {
+    selection[0] = '\0';
   }
 
   LOG("psrdada HEADER:\n%s\n", header);
-  if (header_incomplete) {
-    exit(EXIT_FAILURE);
-  }
+  free(obs_header);
+  obs_header = strdup(header);
 
-  return hdu;
+  // tell the ringbuffer the header has been read
+  input_header_done();
+  return header_incomplete;
 }
 
 /**
  * Print commandline options
  */
 void printOptions() {
-  printf("usage: dadafilterbank -k <hexadecimal key> -l <logfile> -n <filename prefix for dumps>\n");
+  printf("usage: dadafilterbank -k <hexadecimal key> | <dada files>... -l <logfile> -n <filename prefix for dumps> [-t <kernel cache file>]\n");
+  printf("                      [-m tab|tile|nested] [-b <channels per block>] [-c <cpu list>]\n");
+  printf("                      [-p <transpose buffers>] [-w <writer threads>] [-o write|uring|mmap] [-d]\n");
+  printf("                      [-H none|thp|2M|1G] [-u] [-G <CUDA device>]\n");
+  printf("                      [-e <expected duration (s)>] [-x <preallocation extent (MB)>]\n");
+  printf("                      [-T <time decimation>] [-F <channel averaging>] [-q 8|4|2|1] [-s <TAB list>] [-S]\n");
+  printf("                      [-M <channel mask file>] [-Z] [-O drop|tabs:<TAB list>] [-W <high>[,<low>]]\n");
+  printf("                      [-C lz4|zstd[:<level>]] [-j <compression threads>]\n");
+  printf("                      [-R <pages per file>] [-A <output directories>] [-a rr|latency] [-B <samples per slice>]\n");
+  printf("                      [-N tcp:<host>:<port>|dada:<keys>] [-X] [-K <port>:<instances>|-J <host>:<port>]\n");
+  printf("                      [-r <ring duration (s)> -g <trigger FIFO or port>]\n");
+  printf("                      [-L <metrics log interval (s)>] [-P <metrics port>] [-D]\n");
   printf("e.g. dadafits -k dada -l log.txt -n myobs\n");
+  printf("  or dadafilterbank -l log.txt -n myobs obs_0000000000000000.000000.dada\n");
   return;
 }
 
+/**
+ * Parse a list of numbers, like 0,2,4-7
+ *
+ * @param {int **} values Set to a new array with the entries, for the caller to free
+ * @returns {int} Number of entries in the list, or -1 on a parse error
+ */
+int parse_list(const char *list, int **values) {
+  char *copy = strdup(list);
+  int *entries = NULL;
+  int n = 0;
+  char *token = strtok(copy, ",");
+  while (token) {
+    int first, last;
+    if (sscanf(token, "%d-%d", &first, &last) != 2) {
+      if (sscanf(token, "%d", &first) != 1) {
+        n = -1;
+        break;
+      }
+      last = first;
+    }
+    if (first < 0 || last < first) {
+      n = -1;
+      break;
+    }
+    entries = realloc(entries, (n + last - first + 1) * sizeof(int));
+    for (; first <= last; first++) {
+      entries[n++] = first;
+    }
+    token = strtok(NULL, ",");
+  }
+  free(copy);
+  if (n < 0) {
+    free(entries);
+    entries = NULL;
+  }
+  *values = entries;
+  return n;
+}
+
 /**
  * Parse commandline
  */
-void parseOptions(int argc, char *argv[], char **key, char **prefix, char **logfile) {
+void parseOptions(int argc, char *argv[], char **key, char **prefix, char **logfile, char **tunefile) {
   int c;
   int setk=0, setl=0, setn=0;
-  while((c=getopt(argc,argv,"b:c:m:k:l:n:"))!=-1) {
+  int *overload_tabs = NULL;
+  int noverload_tabs = 0;
+  int high = OVERLOAD_HIGH, low = OVERLOAD_LOW;
+  while((c=getopt(argc,argv,"a:b:c:de:j:m:k:l:n:o:p:t:uw:x:A:B:C:DF:G:H:J:K:M:N:O:R:T:q:s:Sr:g:L:P:W:XZ"))!=-1) {
     switch(c) {
+      // -b <channels per block>
+      case('b'):
+        channel_block = atoi(optarg);
+        if (channel_block <= 0 || channel_block % 16) {
+          fprintf(stderr, "Error: channel block size must be a positive multiple of 16\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -c <cpu list>
+      case('c'):
+        ncpus = parse_list(optarg, &cpus);
+        if (ncpus <= 0) {
+          fprintf(stderr, "Error: cannot parse cpu list '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -d
+      case('d'):
+        direct_io = 1;
+        break;
+
+      // -D
+      case('D'):
+        daemon_mode = 1;
+        break;
+
+      // -G <CUDA device>
+      case('G'):
+        gpu_device = atoi(optarg);
+        if (gpu_device < 0) {
+          fprintf(stderr, "Error: illegal CUDA device '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -H <huge pages>
+      case('H'):
+        if (memory_huge_parse(optarg, &huge_pages) < 0) {
+          fprintf(stderr, "Error: unknown huge page setting '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -u
+      case('u'):
+        lock_memory = 0;
+        break;
+
+      // -e <expected duration>
+      case('e'):
+        expected_duration = atof(optarg);
+        if (expected_duration <= 0) {
+          fprintf(stderr, "Error: expected duration should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -x <preallocation extent>
+      case('x'):
+        extent_mb = atol(optarg);
+        if (extent_mb <= 0) {
+          fprintf(stderr, "Error: preallocation extent should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -T <time decimation>
+      case('T'):
+        stages.tdec = atoi(optarg);
+        if (stages.tdec < 1) {
+          fprintf(stderr, "Error: time decimation should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -F <channel averaging>
+      case('F'):
+        stages.fdec = atoi(optarg);
+        if (stages.fdec < 1) {
+          fprintf(stderr, "Error: channel averaging should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -q <bits per sample>
+      case('q'):
+        stages.nbit = atoi(optarg);
+        if (stages.nbit != 8 && stages.nbit != 4 && stages.nbit != 2 && stages.nbit != 1) {
+          fprintf(stderr, "Error: output bits per sample should be 8, 4, 2 or 1\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -r <ring duration>
+      case('r'):
+        ring_duration = atof(optarg);
+        if (ring_duration <= 0) {
+          fprintf(stderr, "Error: ring duration should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -g <trigger source>
+      case('g'):
+        trigger_source = strdup(optarg);
+        break;
+
+      // -L <metrics log interval>
+      case('L'):
+        metrics_interval = atof(optarg);
+        if (metrics_interval < 0) {
+          fprintf(stderr, "Error: metrics log interval should not be negative\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -P <metrics port>
+      case('P'):
+        metrics_port = atoi(optarg);
+        if (metrics_port <= 0 || metrics_port > 65535) {
+          fprintf(stderr, "Error: illegal metrics port '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -S
+      case('S'):
+        bandpass = 1;
+        break;
+
+      // -M <channel mask file>
+      case('M'):
+        mask_file = strdup(optarg);
+        break;
+
+      // -Z
+      case('Z'):
+        stages.zerodm = 1;
+        break;
+
+      // -O drop|tabs:<TAB list>
+      case('O'):
+        if (strcmp(optarg, "drop") == 0) {
+          overload_policy = OVERLOAD_DROP;
+        } else if (strncmp(optarg, "tabs:", 5) == 0) {
+          overload_policy = OVERLOAD_TABS;
+          noverload_tabs = parse_list(&optarg[5], &overload_tabs);
+          if (noverload_tabs < 1) {
+            fprintf(stderr, "Error: illegal TAB list '%s'\n", &optarg[5]);
+            exit(EXIT_FAILURE);
+          }
+        } else {
+          fprintf(stderr, "Error: unknown overload policy '%s', use drop or tabs:<TAB list>\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -W <high>[,<low>]
+      case('W'):
+        if (sscanf(optarg, "%i", &high) != 1) {
+          fprintf(stderr, "Error: illegal watermarks '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        // without a low watermark, scale the default
+        low = strchr(optarg, ',') ? atoi(strchr(optarg, ',') + 1) : high * OVERLOAD_LOW / OVERLOAD_HIGH;
+        break;
+
+      // -C <codec>[:<level>]
+      case('C'):
+        if (compress_codec_parse(optarg, &compression, &compression_level) < 0) {
+          fprintf(stderr, "Error: unknown codec '%s', use lz4 or zstd\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        if (! compress_codec_available(compression)) {
+          fprintf(stderr, "Error: not built with %s\n", compress_codec_name(compression));
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -j <compression threads>
+      case('j'):
+        compression_threads = atoi(optarg);
+        if (compression_threads < 1) {
+          fprintf(stderr, "Error: need at least one compression thread\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -R <pages per file>
+      case('R'):
+        segment_pages = atol(optarg);
+        if (segment_pages < 1) {
+          fprintf(stderr, "Error: pages per file should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -A <output directories>
+      case('A'):
+        {
+          char *token = strtok(optarg, ",");
+          while (token) {
+            if (ndirectories == MAXDIRS) {
+              fprintf(stderr, "Error: at most %i output directories\n", MAXDIRS);
+              exit(EXIT_FAILURE);
+            }
+            directories[ndirectories++] = strdup(token);
+            token = strtok(NULL, ",");
+          }
+        }
+        break;
+
+      // -a rr|latency
+      case('a'):
+        if (stripe_policy_parse(optarg, &stripe_policy) < 0) {
+          fprintf(stderr, "Error: unknown placement '%s', use rr or latency\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -B <samples per slice>
+      case('B'):
+        slice_samples = atoi(optarg);
+        if (slice_samples < 1) {
+          fprintf(stderr, "Error: samples per slice should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -N tcp:<host>:<port>|dada:<keys>
+      case('N'):
+        if (stream_parse(optarg) < 0) {
+          fprintf(stderr, "Error: illegal stream '%s', use tcp:<host>:<port> or dada:<key>[,<key>...]\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -X
+      case('X'):
+        stream_only = 1;
+        break;
+
+      // -K <coordinator port>:<instances>
+      case('K'):
+        if (sscanf(optarg, "%i:%i", &coordinator_port, &coordinator_instances) != 2 ||
+            coordinator_port <= 0 || coordinator_port > 65535 ||
+            coordinator_instances < 1 || coordinator_instances > COORDINATOR_MAXCLIENTS + 1) {
+          fprintf(stderr, "Error: illegal coordinator '%s', use <port>:<instances>, at most %i instances\n",
+              optarg, COORDINATOR_MAXCLIENTS + 1);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -J <host>:<port>
+      case('J'):
+        if (coordinator_join(optarg) < 0) {
+          fprintf(stderr, "Error: illegal coordinator '%s', use <host>:<port>\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        coordinator_address = strdup(optarg);
+        break;
+
+      // -s <TAB list>
+      case('s'):
+        strncpy(selection, optarg, sizeof(selection) - 1);
+        selection_set = 1;
+        break;
+
+      // -m <threading mode>
+      case('m'):
+        if (deinterleave_threading_parse(optarg, &threading) < 0) {
+          fprintf(stderr, "Error: unknown threading mode '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
       // -k <hexadecimal_key>
       case('k'):
         *key = strdup(optarg);
@@ -189,6 +622,37 @@ void parseOptions(int argc, char *argv[], char **key, char **prefix, char **logf
         *prefix = strdup(optarg);
         break;
 
+      // -o <output backend>
+      case('o'):
+        if (output_backend_parse(optarg, &output_backend) < 0) {
+          fprintf(stderr, "Error: unknown output backend '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -p <transpose buffers>
+      case('p'):
+        nbuffers = atoi(optarg);
+        if (nbuffers < 1) {
+          fprintf(stderr, "Error: need at least one transpose buffer\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -w <writer threads>
+      case('w'):
+        nwriters = atoi(optarg);
+        if (nwriters < 1) {
+          fprintf(stderr, "Error: need at least one writer thread\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -t <kernel cache file>
+      case('t'):
+        *tunefile = strdup(optarg);
+        break;
+
       // -h
       case('h'):
         printOptions();
@@ -202,6 +666,93 @@ void parseOptions(int argc, char *argv[], char **key, char **prefix, char **logf
     }
   }
 
+  if (stages.tdec * stages.fdec > DEINTERLEAVE_MAX_AVERAGE) {
+    fprintf(stderr, "Error: cannot average more than %i samples\n", DEINTERLEAVE_MAX_AVERAGE);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((mask_file || stages.zerodm) && stages.nbit != 8) {
+    fprintf(stderr, "Error: flagging and zero-DM cannot be combined with requantization\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (high < 1 || high > 100 || low < 0 || low >= high) {
+    fprintf(stderr, "Error: the watermarks should be 0 <= low < high <= 100 percent\n");
+    exit(EXIT_FAILURE);
+  }
+  if (overload_policy != OVERLOAD_OFF && (ring_duration > 0 || gpu_device >= 0)) {
+    fprintf(stderr, "Error: the overload policy cannot be combined with -r or -G\n");
+    exit(EXIT_FAILURE);
+  }
+  overload_init(overload_policy, overload_tabs, noverload_tabs, high, low);
+  free(overload_tabs);
+
+  if (compression != COMPRESS_NONE && (ring_duration > 0 || output_backend == OUTPUT_MMAP || direct_io)) {
+    fprintf(stderr, "Error: compression cannot be combined with -r, -o mmap, or -d\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((segment_pages || ndirectories) && ring_duration > 0) {
+    fprintf(stderr, "Error: rollover and output directories cannot be combined with -r\n");
+    exit(EXIT_FAILURE);
+  }
+  stripe_init(directories, ndirectories, stripe_policy);
+
+  if (slice_samples && (ring_duration > 0 || gpu_device >= 0 || output_backend == OUTPUT_MMAP || stages.nbit != 8 || bandpass)) {
+    fprintf(stderr, "Error: time slices cannot be combined with -r, -G, -o mmap, -q, or -S\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (stream_sink() != STREAM_NONE && (ring_duration > 0 || output_backend == OUTPUT_MMAP)) {
+    fprintf(stderr, "Error: streaming cannot be combined with -r or -o mmap\n");
+    exit(EXIT_FAILURE);
+  }
+  if (stream_only && stream_sink() == STREAM_NONE) {
+    fprintf(stderr, "Error: -X needs a stream, see -N\n");
+    exit(EXIT_FAILURE);
+  }
+  if (stream_only && (compression != COMPRESS_NONE || segment_pages || ndirectories || direct_io)) {
+    fprintf(stderr, "Error: without files, -C, -R, -A, and -d do not apply\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (coordinator_port && coordinator_address) {
+    fprintf(stderr, "Error: either coordinate (-K) or join a coordinator (-J)\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((coordinator_port || coordinator_address) && ring_duration > 0) {
+    fprintf(stderr, "Error: coordination cannot be combined with -r\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((ring_duration > 0) != (trigger_source != NULL)) {
+    fprintf(stderr, "Error: the dump mode needs both -r and -g\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (gpu_device >= 0) {
+    if (stages.tdec != 1 || stages.fdec != 1 || stages.nbit != 8 || bandpass || mask_file || stages.zerodm) {
+      fprintf(stderr, "Error: the GPU transpose does not downsample, requantize, flag, zero-DM, or compute bandpass statistics\n");
+      exit(EXIT_FAILURE);
+    }
+    if (ring_duration > 0 || output_backend == OUTPUT_MMAP) {
+      fprintf(stderr, "Error: the GPU transpose needs the transpose buffers, not -r or -o mmap\n");
+      exit(EXIT_FAILURE);
+    }
+    if (nbuffers < GPU_NSTREAMS) {
+      fprintf(stderr, "Error: the GPU transpose needs at least %i transpose buffers\n", GPU_NSTREAMS);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // files to replay, instead of the ringbuffer
+  replay = optind < argc;
+  if (setk && replay) {
+    fprintf(stderr, "Error: give either a DADA key or files to replay\n");
+    exit(EXIT_FAILURE);
+  }
+  setk |= replay;
+
   // All arguments are required
   if (!setk || !setl || !setn) {
     if (!setk) fprintf(stderr, "Error: DADA key not set\n");
@@ -211,20 +762,21 @@ void parseOptions(int argc, char *argv[], char **key, char **prefix, char **logf
   }
 }
 
-void open_files(char *prefix, int ntabs) {
-  int tab;
-  for (tab=0; tab<ntabs; tab++) {
-    char fname[256];
-    if (ntabs == 1) {
-      snprintf(fname, 256, "%s.fil", prefix);
-    }
-    else {
-      snprintf(fname, 256, "%s_%02i.fil", prefix, tab);
-    }
+/**
+ * Fill in the filterbank header of a TAB
+ *
+ * @param {double} tstart MJD of the first sample
+ * @param {char *} header Buffer of FILTERBANK_HEADER_SIZE bytes for the header
+ * @returns {int} Length of the header, or -1 when it does not fit
+ */
+int tab_header(const int tab, const double tstart, char *header) {
+  // averaged channels are centered on the mean frequency of their input channels
+  const double channel_width = bandwidth / nchannels;
+  const double fch1 = min_frequency + bandwidth - channel_width - 0.5 * (stages.fdec - 1) * channel_width;
 
-    // open filterbank file
-    output[tab] = filterbank_create(
-      fname,       // filename
+  return filterbank_header(
+      header,      // char *buffer
+      FILTERBANK_HEADER_SIZE, // size_t size
       10,          // int telescope_id,
       15,          // int machine_id,
       source_name, // char *source_name,
@@ -232,67 +784,513 @@ void open_files(char *prefix, int ntabs) {
       za_start,    // double za_start,
       ra,          // double src_raj,
       dec,         // double src_dej,
-      mjd_start,   // double tstart
-      tsamp,       // double tsamp,
-      nbit,        // int nbits,
-      min_frequency + bandwidth - (bandwidth / nchannels),  // double fch1,
-      -1 * bandwidth / nchannels, // double foff,
-      nchannels, // int nchans,
+      tstart,      // double tstart
+      tsamp * stages.tdec, // double tsamp,
+      stages.nbit, // int nbits,
+      fch1,        // double fch1,
+      -1 * channel_width * stages.fdec, // double foff,
+      nchannels / stages.fdec, // int nchans,
       ntabs,     // int nbeams,
       tab,   // int ibeam
-      1          // int nifs
+      nstokes    // int nifs
     );
-  }
 }
 
-void close_files() {
-  int tab;
+/**
+ * Create a filterbank file for a TAB
+ *
+ * @param {double} tstart MJD of the first sample in the file
+ * @param {char *} header Buffer of FILTERBANK_HEADER_SIZE bytes for the header
+ * @param {int *} header_size Length of the header
+ * @returns {int} File descriptor, or -1 on failure
+ */
+int create_file(const char *fname, const int tab, const double tstart, char *header, int *header_size) {
+  *header_size = tab_header(tab, tstart, header);
+  if (*header_size < 0) {
+    LOG("ERROR: filterbank header for %s too large\n", fname);
+    return -1;
+  }
 
-  for (tab=0; tab<ntabs; tab++) {
-    filterbank_close(output[tab]);
+  const int fd = filterbank_create(fname, header, *header_size);
+  if (fd < 0) {
+    LOG("ERROR: cannot create %s: %s\n", fname, strerror(errno));
   }
+  return fd;
 }
 
 /**
- * Catch SIGINT then sync and close files before exiting
+ * Expand the filename prefix template for the current observation
+ *
+ * %s is replaced by SOURCE, %m by MJD_START, and %% by %.
  */
-void sigint_handler (int sig) {
-  LOG("SIGINT received, aborting\n");
-  int i;
-  for (i=0; i<ntabs; i++) {
-    if (output[i]) {
-      fsync(output[i]);
-      filterbank_close(output[i]);
+void expand_prefix(const char *template, char *prefix, const size_t size) {
+  size_t n = 0;
+  const char *c;
+  for (c = template; *c && n + 1 < size; c++) {
+    if (c[0] == '%' && c[1] == 's') {
+      n += snprintf(&prefix[n], size - n, "%s", source_name);
+      c++;
+    } else if (c[0] == '%' && c[1] == 'm') {
+      n += snprintf(&prefix[n], size - n, "%.6f", mjd_start);
+      c++;
+    } else if (c[0] == '%' && c[1] == '%') {
+      prefix[n++] = '%';
+      c++;
+    } else {
+      prefix[n++] = *c;
     }
   }
-  exit(EXIT_FAILURE);
+  prefix[n < size ? n : size - 1] = '\0';
 }
 
+/**
+ * Name of the file of a selected TAB and segment, like prefix_NN_SSSS.fil, in an output directory when given
+ *
+ * @param {int} directory Index of the output directory, or -1 for none
+ * @param {char *} suffix Extension, like .fil
+ */
+void segment_file_name(char *fname, const size_t size, const int directory, const int slot, const long segment, const char *suffix) {
+  char tab_part[16] = "";
+  char segment_part[32] = "";
+  if (ntabs != 1) {
+    snprintf(tab_part, sizeof(tab_part), "_%02i", selected[slot]);
+  }
+  if (segment_pages) {
+    snprintf(segment_part, sizeof(segment_part), "_%04li", segment);
+  }
+  snprintf(fname, size, "%s%s%s%s%s%s", directory >= 0 ? stripe_directory(directory) : "", directory >= 0 ? "/" : "",
+      output_prefix, tab_part, segment_part, suffix);
+}
 
-int main (int argc, char *argv[]) {
-  char *key;
-  char *logfile;
-  char *file_prefix;
+/**
+ * Create the filterbank file of a selected TAB for a segment, see output_open_t
+ *
+ * The header has the start time of the segment. When the file cannot be created in the directory
+ * chosen for it, the other directories are tried.
+ *
+ * @returns {int} 0 on success, -1 when the file could not be created
+ */
+int open_segment(const int slot, const long segment) {
+  const double tstart = mjd_start + segment * segment_pages * ntimes * tsamp / 86400.0;
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".fil%s", compress_codec_suffix(compression));
 
-  // parse commandline
-  parseOptions(argc, argv, &key, &file_prefix, &logfile);
+  char fname[256];
+  char header[FILTERBANK_HEADER_SIZE];
+  int header_size;
+  int directory = ndirectories ? stripe_choose(slot, segment) : -1;
+  int attempt;
+  for (attempt = 0; attempt < (ndirectories ? ndirectories : 1); attempt++) {
+    segment_file_name(fname, sizeof(fname), directory, slot, segment, suffix);
+    output[slot] = create_file(fname, selected[slot], tstart, header, &header_size);
+    if (output[slot] >= 0) {
+      break;
+    }
+    output[slot] = 0;
+    if (ndirectories) {
+      stripe_release(directory, 0, 0);
+      directory = (directory + 1) % ndirectories;
+      stripe_open(directory);
+    }
+  }
+  if (! output[slot]) {
+    if (ndirectories) {
+      stripe_release(directory, 0, 0);
+    }
+    return -1;
+  }
+  if (segment > 0) {
+    LOG("Segment %li of TAB %i: %s\n", segment, selected[slot], fname);
+  }
+  segment_directories[slot] = directory;
+  output_set_file(slot, output[slot], fname, header, header_size);
 
-  // set up logging
-  if (logfile) {
-    runlog = fopen(logfile, "w");
-    if (! runlog) {
-      LOG("ERROR opening logfile: %s\n", logfile);
-      exit(EXIT_FAILURE);
+  // with the index to seek in the compressed file
+  if (compression != COMPRESS_NONE) {
+    segment_file_name(fname, sizeof(fname), directory, slot, segment, ".idx");
+    if (compress_open(slot, fname, header_size) < 0) {
+      return -1;
     }
-    LOG("Logging to logfile: %s\n", logfile);
-    free (logfile);
   }
+  return 0;
+}
 
-  // connect to ring buffer
-  dada_hdu_t *ringbuffer = init_ringbuffer(key);
-  ipcbuf_t *data_block = (ipcbuf_t *) ringbuffer->data_block;
-  ipcio_t *ipc = ringbuffer->data_block;
+/**
+ * Close the file of a selected TAB, see output_close_t
+ */
+void close_segment(const int slot, const int fd, const uint64_t bytes, const double seconds) {
+  filterbank_close(fd);
+  output[slot] = 0;
+  if (ndirectories) {
+    stripe_release(segment_directories[slot], bytes, seconds);
+  }
+}
 
+/**
+ * Create the filterbank files for the selected TABs
+ *
+ * @returns {int} 0 on success, -1 when a file could not be created
+ */
+int open_files(char *prefix) {
+  output_prefix = prefix;
+  int i;
+  for (i=0; i<nselected; i++) {
+    if (open_segment(i, 0) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Create the bandpass statistics sidecar files for the selected TABs, named like the filterbank files
+ *
+ * @returns {int} 0 on success, -1 when a file could not be created
+ */
+int open_stats(char *prefix) {
+  int i;
+  for (i=0; i<nselected; i++) {
+    char fname[256];
+    if (ntabs == 1) {
+      snprintf(fname, 256, "%s.stats", prefix);
+    }
+    else {
+      snprintf(fname, 256, "%s_%02i.stats", prefix, selected[i]);
+    }
+    if (stats_open(i, fname) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Create the sidecar file recording the degraded pages, see overload.c
+ *
+ * @returns {int} 0 on success, -1 when the file could not be created
+ */
+int open_gaps(char *prefix) {
+  char fname[256];
+  snprintf(fname, 256, "%s.gaps", prefix);
+  return overload_open(fname);
+}
+
+/**
+ * Start the streams of the selected TABs, see stream.c
+ *
+ * A TCP stream starts with the filterbank header of the TAB. An output ringbuffer gets the header of the
+ * observation, with the layout of the TAB.
+ *
+ * A stream that cannot be started stays stopped for the observation, the files are still written.
+ * Only when streaming instead of writing files (-X) and no stream started, the observation fails.
+ *
+ * @returns {int} 0 on success, -1 when no stream started and there are no files
+ */
+int open_streams() {
+  int nfailed = 0;
+  int i;
+  for (i = 0; i < nselected; i++) {
+    if (stream_sink() == STREAM_TCP) {
+      char header[FILTERBANK_HEADER_SIZE];
+      const int header_size = tab_header(selected[i], mjd_start, header);
+      if (header_size < 0 || stream_open(i, selected[i], header, header_size) < 0) {
+        nfailed++;
+      }
+      continue;
+    }
+
+    // room for the keys below
+    char *header = calloc(strlen(obs_header) + 1024, 1);
+    strcpy(header, obs_header);
+    const double channel_width = bandwidth / nchannels;
+    ascii_header_set(header, "ORDER", "%s", nstokes == 1 ? "TF" : "TSF");
+    ascii_header_set(header, "NCHAN", "%i", nchannels / stages.fdec);
+    ascii_header_set(header, "NBIT", "%i", stages.nbit);
+    ascii_header_set(header, "NPOL", "%i", nstokes);
+    ascii_header_set(header, "TSAMP", "%.6f", tsamp * stages.tdec * 1e6);
+    ascii_header_set(header, "MIN_FREQUENCY", "%.6f", min_frequency + 0.5 * (stages.fdec - 1) * channel_width);
+    ascii_header_set(header, "NBEAM", "%i", 1);
+    ascii_header_set(header, "BEAM", "%i", selected[i]);
+    ascii_header_set(header, "RESOLUTION", "%zu", tab_size);
+    ascii_header_set(header, "BYTES_PER_SECOND", "%.0f", tab_size / (ntimes * tsamp));
+    nfailed += stream_open(i, selected[i], header, strlen(header) + 1) < 0;
+    free(header);
+  }
+
+  if (nfailed) {
+    LOG("Warning: %i of %i streams not started\n", nfailed, nselected);
+  }
+  if (stream_only && nfailed == nselected) {
+    LOG("ERROR: no stream started, and no files are written\n");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Create the file for a selected TAB of a triggered dump, see dump_open_t
+ */
+int open_dump_file(const int dump, const int slot, const long page) {
+  char fname[256];
+  snprintf(fname, 256, "%s_dump%03i_%02i.fil", dump_prefix, dump, selected[slot]);
+  LOG("Dump %i: writing %s\n", dump, fname);
+  char header[FILTERBANK_HEADER_SIZE];
+  int header_size;
+  return create_file(fname, selected[slot], mjd_start + page * ntimes * tsamp / 86400.0, header, &header_size);
+}
+
+void close_dump_file(const int fd) {
+  filterbank_close(fd);
+}
+
+/**
+ * Queue a dump for a trigger
+ */
+void handle_trigger(const trigger_t *trigger) {
+  const double page_duration = ntimes * tsamp;
+  const long first = trigger->start > 0 ? (long) (trigger->start / page_duration) : 0;
+  long last = (long) (trigger->end / page_duration);
+  if (last * page_duration >= trigger->end) {
+    last--;
+  }
+
+  unsigned char tabs[nselected];
+  int i;
+  if (trigger->tabs[0]) {
+    int *list;
+    const int n = parse_list(trigger->tabs, &list);
+    if (n <= 0) {
+      LOG("Warning: cannot parse TAB list '%s' of trigger, ignored\n", trigger->tabs);
+      free(list);
+      return;
+    }
+    for (i = 0; i < nselected; i++) {
+      int j;
+      tabs[i] = 0;
+      for (j = 0; j < n; j++) {
+        if (list[j] == selected[i]) {
+          tabs[i] = 1;
+        }
+      }
+    }
+    free(list);
+  } else {
+    memset(tabs, 1, nselected);
+  }
+
+  LOG("Trigger: %.3f to %.3f s, pages %li to %li, TABs %s\n", trigger->start, trigger->end, first, last,
+      trigger->tabs[0] ? trigger->tabs : "all");
+  if (dump_request(first, last, tabs) < 0) {
+    LOG("Warning: too many dumps pending, trigger ignored\n");
+  }
+}
+
+/**
+ * Close the files and streams of the observation, the output backend closes the files with close_segment
+ */
+void close_files() {
+  output_close();
+  if (compression != COMPRESS_NONE) {
+    compress_close();
+  }
+  if (stream_sink() != STREAM_NONE) {
+    stream_close();
+  }
+}
+
+/**
+ * Stream a TAB and write it to its file, see pipeline_write_t
+ *
+ * The zero-copy send is queued first, so the file is written while the kernel sends the data.
+ */
+void write_tab(const int w, const int tab, char *data, const size_t size, const long page) {
+  stream_write(w, tab, data, size, page);
+  if (stream_only) {
+    return;
+  }
+  if (compression != COMPRESS_NONE) {
+    compress_write(w, tab, data, size, page);
+  } else {
+    output_write(w, tab, data, size, page);
+  }
+}
+
+/**
+ * Wait for the writes and sends of a writer, see pipeline_flush_t
+ */
+void flush_tab(const int w) {
+  if (! stream_only) {
+    output_flush(w);
+  }
+  stream_flush(w);
+}
+
+/**
+ * Set up the openMP threads, and pin them to the cpus given on the commandline
+ *
+ * One thread is started per cpu; the main thread is pinned to the first cpu.
+ * For the nested threading mode, the inner teams are pinned as well.
+ */
+void setup_threads() {
+#ifdef _OPENMP
+  if (threading == DEINTERLEAVE_THREADING_NESTED) {
+    omp_set_max_active_levels(2);
+  }
+  if (ncpus == 0) {
+    LOG("Threading: %s, %i threads, %i channels per block\n", deinterleave_threading_name(threading), omp_get_max_threads(), channel_block);
+    return;
+  }
+  omp_set_num_threads(ncpus);
+
+  int outer = ncpus;
+  int inner = 1;
+  if (threading == DEINTERLEAVE_THREADING_NESTED) {
+    outer = ncpus < nselected ? ncpus : nselected;
+    inner = ncpus / outer > 1 ? ncpus / outer : 1;
+  }
+
+  int failed = 0;
+#pragma omp parallel num_threads(outer) reduction(+:failed)
+  {
+    const int o = omp_get_thread_num();
+#pragma omp parallel num_threads(inner) reduction(+:failed)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[(o * inner + omp_get_thread_num()) % ncpus], &set);
+      if (sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0) {
+        failed++;
+      }
+    }
+  }
+  if (failed) {
+    LOG("Warning: could not pin %i threads\n", failed);
+  }
+  LOG("Threading: %s, %i threads pinned, %i channels per block\n", deinterleave_threading_name(threading), ncpus, channel_block);
+#else
+  LOG("Threading: not compiled with openMP, running single threaded\n");
+#endif
+}
+
+/**
+ * Size the arrays per TAB for the TABs of the observation, they only grow
+ */
+void allocate_tabs() {
+  if (ntabs <= allocated_tabs) {
+    return;
+  }
+  selected = realloc(selected, ntabs * sizeof(int));
+  output = realloc(output, ntabs * sizeof(int));
+  segment_directories = realloc(segment_directories, ntabs * sizeof(int));
+  if (! selected || ! output || ! segment_directories) {
+    LOG("ERROR: cannot allocate memory for %i TABs\n", ntabs);
+    exit(EXIT_FAILURE);
+  }
+  memset(output, 0, ntabs * sizeof(int));
+  allocated_tabs = ntabs;
+}
+
+/**
+ * Set the TABs to process
+ *
+ * @param {char *} list TAB list like 0,3-5, or empty for all TABs
+ * @returns {int} 0 on success, -1 for an illegal list
+ */
+int select_tabs(const char *list) {
+  if (! list[0]) {
+    for (nselected = 0; nselected < ntabs; nselected++) {
+      selected[nselected] = nselected;
+    }
+    return 0;
+  }
+
+  int *tabs;
+  const int n = parse_list(list, &tabs);
+  if (n <= 0) {
+    LOG("Error: cannot parse TAB list '%s'\n", list);
+    free(tabs);
+    return -1;
+  }
+
+  // keep the TABs in order, without duplicates
+  char used[ntabs];
+  memset(used, 0, ntabs);
+  int i;
+  for (i = 0; i < n; i++) {
+    if (tabs[i] >= ntabs) {
+      LOG("Error: TAB %i selected, but there are %i TABs\n", tabs[i], ntabs);
+      free(tabs);
+      return -1;
+    }
+    used[tabs[i]] = 1;
+  }
+  free(tabs);
+  nselected = 0;
+  for (i = 0; i < ntabs; i++) {
+    if (used[i]) {
+      selected[nselected++] = i;
+    }
+  }
+  LOG("Selected %i of %i TABs: %s\n", nselected, ntabs, list);
+  return 0;
+}
+
+/**
+ * Agree on the TABs, the rollover, and the filename prefix of the observation with the coordinator
+ *
+ * The TABs from the commandline or the header are asked for, or else a share of all TABs.
+ * Without an answer from the coordinator, the settings from the commandline are used.
+ *
+ * @returns {int} 0 on success, 1 when the instance has no TABs to write, -1 for an illegal list
+ */
+int coordinate_observation() {
+  char assigned[COORDINATOR_LINE];
+  char template[256];
+  long pages;
+  if (coordinator_register(mjd_start, ntabs, selection[0] ? selection : "auto", assigned, sizeof(assigned),
+        &pages, template, sizeof(template)) < 0) {
+    LOG("Using the settings from the commandline\n");
+    segment_pages = local_segment_pages;
+    coordinated_prefix[0] = '\0';
+    return select_tabs(selection);
+  }
+
+  if (! assigned[0]) {
+    LOG("The coordinator assigned no TABs to this instance\n");
+    return 1;
+  }
+  // the rollover only applies to files
+  if (! stream_only) {
+    segment_pages = pages;
+  }
+  snprintf(coordinated_prefix, sizeof(coordinated_prefix), "%s", template);
+  return select_tabs(assigned);
+}
+
+/**
+ * Catch SIGINT then sync and close files before exiting
+ */
+void sigint_handler (int sig) {
+  LOG("SIGINT received, aborting\n");
+  output_write_tails();
+  output_truncate();
+  int i;
+  for (i=0; i<nselected; i++) {
+    if (output[i]) {
+      fsync(output[i]);
+      filterbank_close(output[i]);
+    }
+  }
+  exit(EXIT_FAILURE);
+}
+
+
+/**
+ * Derive the data rate and layout from the header, and check the processing options against them
+ *
+ * @returns {int} 0 on success, 1 when the coordinator left no TABs for this instance, -1 when the observation cannot be processed
+ */
+int setup_observation() {
   if (science_case == 3) {
     // NTIMES (12500) per 1.024 seconds -> 0.00008192 [s]
     ntimes = 12500;
@@ -304,90 +1302,632 @@ int main (int argc, char *argv[]) {
     tsamp = 1.024 / 12500;
     ntabs = 12;
   } else {
-    LOG("Error: Illegal science case '%i'", science_mode);
-    exit(EXIT_FAILURE);
+    LOG("Error: Illegal science case '%i'\n", science_case);
+    return -1;
   }
 
-
-  LOG("dadafilterbank version: " VERSION "\n");
+  if (header_ntabs > 0) {
+    ntabs = header_ntabs;
+  }
   LOG("Science case = %i\n", science_case);
-  LOG("Filename prefix = %s\n", file_prefix);
 
   if (science_mode == 0) {
     // I + TAB
+    nstokes = 1;
     LOG("Science mode: 0 [I + TAB]\n");
   } else if (science_mode == 2) {
     // I + IAB
     // Overwrite NTABS to be one
     ntabs = 1;
+    nstokes = 1;
     LOG("Science mode: 2 [I + IAB]\n");
-  } else if (science_mode == 1 || science_mode == 3) {
-    LOG("Error: modes 1 [IQUV + TAB] / 3 [IQUV + IAB] not supported");
-    exit(EXIT_FAILURE);
+  } else if (science_mode == 1) {
+    // IQUV + TAB
+    nstokes = 4;
+    LOG("Science mode: 1 [IQUV + TAB]\n");
+  } else if (science_mode == 3) {
+    // IQUV + IAB
+    ntabs = 1;
+    nstokes = 4;
+    LOG("Science mode: 3 [IQUV + IAB]\n");
   } else {
-    LOG("Error: Illegal science mode '%i'", science_mode);
-    exit(EXIT_FAILURE);
+    LOG("Error: Illegal science mode '%i'\n", science_mode);
+    return -1;
   }
 
-  // create filterbank files, and close files on C-c
-  open_files(file_prefix, ntabs);
-  signal(SIGINT, sigint_handler);
+  LOG("Channels: %i, bits per sample: %i\n", nchannels, nbit);
+  // a page is read from a single ringbuffer buffer
+  const size_t page_size = (size_t) ntabs * nchannels * nstokes * padded_size;
+  if (input_buffer_size() && page_size > input_buffer_size()) {
+    LOG("Error: a page of %zu bytes does not fit in the ringbuffer buffers of %lu bytes\n", page_size, input_buffer_size());
+    return -1;
+  }
+  if (nbit != 8) {
+    LOG("Error: only 8 bit input is supported\n");
+    return -1;
+  }
+  if (nchannels < 1 || nchannels % stages.fdec != 0) {
+    LOG("Error: channel averaging %i does not divide the %i channels\n", stages.fdec, nchannels);
+    return -1;
+  }
+  if ((nchannels / stages.fdec) % 8 != 0 && stages.nbit != 8) {
+    LOG("Error: requantization needs a multiple of 8 output channels\n");
+    return -1;
+  }
+  if (ntimes % stages.tdec != 0) {
+    LOG("Error: time decimation %i does not divide the %i samples per page\n", stages.tdec, ntimes);
+    return -1;
+  }
+  if (stages.tdec > 1 || stages.fdec > 1) {
+    LOG("Downsampling: %i samples, %i channels\n", stages.tdec, stages.fdec);
+  }
+  if (stages.nbit != 8) {
+    LOG("Requantizing to %i bits\n", stages.nbit);
+  }
+  if (slice_samples && (ntimes % slice_samples != 0 || slice_samples % stages.tdec != 0)) {
+    LOG("Error: %i samples per slice does not divide the %i samples per page, or is not a multiple of the time decimation\n",
+        slice_samples, ntimes);
+    return -1;
+  }
+  nslices = slice_samples ? ntimes / slice_samples : 1;
+  if (nstokes > 1 && (stages.tdec > 1 || stages.fdec > 1 || stages.nbit != 8 || bandpass || mask_file || stages.zerodm)) {
+    LOG("Error: the IQUV modes do not downsample, requantize, flag, zero-DM, or compute bandpass statistics\n");
+    return -1;
+  }
+  if (nstokes > 1 && gpu_device >= 0) {
+    LOG("Error: the GPU transpose does not support the IQUV modes\n");
+    return -1;
+  }
 
-  // for interaction with ringbuffer
-  uint64_t bufsz = ipc->curbufsz;
-  char *page = NULL;
+  allocate_tabs();
+  if (coordinator_enabled()) {
+    return coordinate_observation();
+  }
+  return select_tabs(selection);
+}
+
+/**
+ * The page shape and rollover of the current observation, the processing depends on them
+ */
+shape_t current_shape() {
+  shape_t current;
+  memset(&current, 0, sizeof(shape_t));
+  current.ntabs = ntabs;
+  current.nchannels = nchannels;
+  current.nstokes = nstokes;
+  current.ntimes = ntimes;
+  current.padded_size = padded_size;
+  current.nselected = nselected;
+  current.selected = selected;
+  current.segment_pages = segment_pages;
+  return current;
+}
+
+/**
+ * Compare the page shape of the current observation with the one the processing is set up for
+ *
+ * @returns {int} Non-zero when they differ
+ */
+int shape_changed() {
+  const shape_t current = current_shape();
+  return current.ntabs != shape.ntabs || current.nchannels != shape.nchannels || current.nstokes != shape.nstokes ||
+      current.ntimes != shape.ntimes || current.padded_size != shape.padded_size || current.nselected != shape.nselected ||
+      current.segment_pages != shape.segment_pages || memcmp(current.selected, shape.selected, nselected * sizeof(int)) != 0;
+}
+
+/**
+ * Set up the threads, transpose kernel, buffers and output for the page shape of the current observation
+ */
+void start_processing(char *tunefile) {
+  // keep a copy of the selected TABs
+  int *previous = shape.selected;
+  shape = current_shape();
+  shape.selected = realloc(previous, nselected * sizeof(int));
+  memcpy(shape.selected, selected, nselected * sizeof(int));
+  setup_threads();
 
   // for processing a page
-  int tab, channel, time;
-  char *buffer = malloc(ntabs * ntimes * nchannels * sizeof(char));
+  // with direct I/O, leave room to align the data in every TAB
+  // with mmap output, transpose directly into the files, in windows of nbuffers pages
+  // in dump mode, transpose into the ring of recent pages
+  tab_size = (size_t) (ntimes / stages.tdec) * (nchannels / stages.fdec) * nstokes * stages.nbit / 8;
+  slice_size = tab_size / nslices;
+  if (trigger_source || output_backend != OUTPUT_MMAP) {
+    LOG("Buffer memory: %s%s%s\n", huge_pages == MEMORY_HUGE_NONE ? "normal" : memory_huge_name(huge_pages),
+        huge_pages == MEMORY_HUGE_NONE ? " pages" : " huge pages", lock_memory ? ", locked" : "");
+  }
+  if (trigger_source) {
+    int npages = (int) (ring_duration / (ntimes * tsamp));
+    if (npages * ntimes * tsamp < ring_duration) {
+      npages++;
+    }
+    dump_init(npages, nselected, tab_size, open_dump_file, close_dump_file);
+    LOG("Dump mode: ring of %i pages\n", npages);
+  } else if (output_backend == OUTPUT_MMAP) {
+    if (direct_io) {
+      LOG("Warning: direct I/O is not supported with mmap output\n");
+      direct_io = 0;
+    }
+    output_init(output_backend, nselected, 0, 0);
+    output_set_window(nbuffers);
+    LOG("Output backend: mmap, windows of %i pages\n", nbuffers);
+  } else {
+    // with a stream, the writers send the TABs as well
+    pipeline_write_t write_fn = compression != COMPRESS_NONE ? compress_write : output_write;
+    pipeline_flush_t flush_fn = compression != COMPRESS_NONE ? compress_flush : output_flush;
+    if (stream_sink() != STREAM_NONE) {
+      write_fn = write_tab;
+      flush_fn = flush_tab;
+    }
+    pipeline_init(nbuffers, nwriters, nselected, slice_size, direct_io ? slice_size + PIPELINE_ALIGNMENT : slice_size,
+        write_fn, flush_fn);
+    LOG("Pipeline: %i transpose buffers, %i writer threads\n", nbuffers, pipeline_nwriters());
+    if (nslices > 1) {
+      LOG("Time slices: %i per page, of %i samples\n", nslices, slice_samples);
+    }
+    output_backend = output_init(output_backend, nselected, pipeline_nwriters(), direct_io);
+    LOG("Output backend: %s%s\n", output_backend_name(output_backend), direct_io ? ", direct I/O" : "");
+    if (compression != COMPRESS_NONE) {
+      compress_init(compression, compression_level, compression_threads, nselected, pipeline_nwriters(),
+          slice_size, tab_size / (ntimes / stages.tdec));
+    }
+    if (stream_sink() != STREAM_NONE) {
+      stream_init(nselected, pipeline_nwriters(), slice_size);
+      if (stream_only) {
+        LOG("Streaming only, no filterbank files\n");
+      }
+    }
+
+    if (gpu_device >= 0) {
+      if (gpu_init(gpu_device, nselected, selected, nchannels, ntimes, padded_size) < 0) {
+        exit(EXIT_FAILURE);
+      }
+      if (! ringbuffer_registered && input_ringbuffer()) {
+        gpu_register_ringbuffer(input_ringbuffer());
+        ringbuffer_registered = 1;
+      }
+      int b;
+      for (b = 0; b < pipeline_nbuffers(); b++) {
+        gpu_register_buffer(pipeline_buffer_data(b), pipeline_buffer_size());
+      }
+    }
+  }
+
+  // preallocate the expected number of pages, or in extents
+  if (trigger_source) {
+    // no files until triggered
+  } else if (expected_duration > 0) {
+    const double page_duration = ntimes * tsamp;
+    long npages = (long) (expected_duration / page_duration);
+    if (npages * page_duration < expected_duration) {
+      npages++;
+    }
+    if (segment_pages && segment_pages < npages) {
+      npages = segment_pages;
+    }
+    output_set_preallocation(npages * tab_size, extent_mb << 20);
+    LOG("Preallocating %li pages per file\n", npages);
+  } else {
+    output_set_preallocation(0, extent_mb << 20);
+  }
+
+  // the backend rolls over to the next files, and closes them
+  if (! trigger_source) {
+    output_set_segments(segment_pages * nslices, slice_size, open_segment, close_segment);
+    if (segment_pages) {
+      LOG("Rollover: a new file every %li pages\n", segment_pages);
+    }
+    if (ndirectories) {
+      LOG("Output directories: %i, %s\n", ndirectories, stripe_policy_name(stripe_policy));
+    }
+  }
+
+  if (bandpass) {
+    stages.stats = stats_init(nselected, selected, ntabs, nchannels, ntimes);
+    LOG("Bandpass statistics: %i channels per TAB\n", nchannels);
+  }
+  if (mask_file) {
+    stages.mask = mask_init(mask_file, nchannels);
+  }
+  if (stages.zerodm) {
+    LOG("Zero-DM filtering\n");
+  }
+
+  // select the fastest transpose kernel for this page shape and processing, unless the GPU transposes
+  kernel = NULL;
+  if (gpu_device < 0) {
+    double timings[deinterleave_nvariants];
+    int cached;
+    const deinterleave_variant_t *variant = autotune(tunefile, threading, channel_block,
+        nselected, nchannels, nstokes, ntimes, padded_size, &stages, timings, &cached);
+    if (cached) {
+      LOG("Transpose kernel: %s (from %s)\n", variant->name, tunefile);
+    } else {
+      int v;
+      for (v = 0; v < deinterleave_nvariants; v++) {
+        if (timings[v] >= 0) {
+          LOG("Kernel %-11s %8.3f ms per page\n", deinterleave_variants[v].name, timings[v]);
+        }
+      }
+      LOG("Transpose kernel: %s\n", variant->name);
+    }
+    kernel = variant->kernel;
+  }
+
+  metrics_init(ntimes * tsamp, nselected, selected, metrics_port, metrics_interval);
+  // the other threading modes divide a TAB over the threads, they are timed per page only
+  if (threading == DEINTERLEAVE_THREADING_TAB && gpu_device < 0) {
+    stages.seconds = calloc(ntabs, sizeof(double));
+  }
+  processing = 1;
+}
+
+/**
+ * Stop the threads and free the buffers of start_processing, call after finish_observation
+ */
+void stop_processing() {
+  if (trigger_source) {
+    dump_finish();
+  } else {
+    if (gpu_device >= 0) {
+      gpu_finish();
+    }
+    if (output_backend != OUTPUT_MMAP) {
+      pipeline_finish();
+    }
+    output_finish();
+    if (compression != COMPRESS_NONE) {
+      compress_finish();
+    }
+    if (stream_sink() != STREAM_NONE) {
+      stream_finish();
+    }
+  }
+  if (bandpass) {
+    stats_finish();
+    stages.stats = NULL;
+  }
+  if (mask_file) {
+    mask_finish();
+    stages.mask = NULL;
+  }
+  metrics_finish();
+  free(stages.seconds);
+  stages.seconds = NULL;
+  processing = 0;
+}
+
+/**
+ * Transpose and write the pages of an observation, until the end of data
+ *
+ * @returns {int} Number of pages read
+ */
+int process_observation() {
+  // for interaction with ringbuffer
+  uint64_t bufsz;
+  char *page = NULL;
 
   int page_count = 0;
   int quit = 0;
-  while(!quit && !ipcbuf_eod(data_block)) {
+  long skipped = 0; // pages dropped since the last buffer given to the writers
+
+  // pages on the GPU, not yet handed to the writers
+  pipeline_buffer_t *gpu_pending[GPU_NSTREAMS];
+  while(!quit && !input_eod()) {
 
-    page = ipcbuf_get_next_read(data_block, &bufsz);
+    const double wait_start = metrics_now();
+    page = input_next_page(&bufsz);
+    const double start = metrics_now();
+    double transpose = 0;
     if (! page) {
       quit = 1;
     } else {
+      if (mask_file) {
+        stages.mask = mask_poll();
+      }
+      if (stages.seconds) {
+        memset(stages.seconds, 0, ntabs * sizeof(double));
+      }
+      if (page_count == 0) {
+        memory_log_locality(replay ? "Input" : "Ringbuffer", page, bufsz);
+      }
       // page [NTABS, nchannels, time(padded_size)]
       // file [time, nchannels]
-      for (tab = 0; tab < ntabs; tab++) {
-
-        int channel;
-#pragma omp parallel for
-        for (channel = 0; channel < nchannels; channel+=6) {
-          const char *channelA = &page[(tab*nchannels + channel + 0)*padded_size];
-          const char *channelB = &page[(tab*nchannels + channel + 1)*padded_size];
-          const char *channelC = &page[(tab*nchannels + channel + 2)*padded_size];
-          const char *channelD = &page[(tab*nchannels + channel + 3)*padded_size];
-          const char *channelE = &page[(tab*nchannels + channel + 4)*padded_size];
-          const char *channelF = &page[(tab*nchannels + channel + 5)*padded_size];
-
-          int time;
-          for (time = 0; time < ntimes; time++) {
-
-            // reverse freq order to comply with header
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+0)-1] = channelA[time];
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+1)-1] = channelB[time];
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+2)-1] = channelC[time];
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+3)-1] = channelD[time];
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+4)-1] = channelE[time];
-            buffer[tab*ntimes*nchannels + time*nchannels+nchannels-(channel+5)-1] = channelF[time];
+      // output per TAB in the page, NULL for TABs that are not selected
+      char *tabs[ntabs];
+      char *outputs[nselected];
+      memset(tabs, 0, sizeof(tabs));
+      int i;
+
+      // degrade when the output cannot keep up, the dropped data is left as a gap in the files
+      uint64_t nfull, nbufs;
+      input_fill(&nfull, &nbufs);
+      const overload_policy_t degrade = overload_check(page_count, page_count * ntimes * tsamp, nfull, nbufs);
+
+      if (degrade == OVERLOAD_DROP) {
+        input_page_done();
+        if (output_backend == OUTPUT_MMAP) {
+          output_page_done(page_count, tab_size);
+        } else {
+          skipped++;
+        }
+      } else if (trigger_source) {
+        for (i = 0; i < nselected; i++) {
+          tabs[selected[i]] = dump_slot(page_count, i);
+        }
+        const double transpose_start = metrics_now();
+        deinterleave_page(kernel, threading, channel_block, page, tabs, ntabs, nchannels, nstokes, ntimes, padded_size, &stages);
+        transpose = metrics_now() - transpose_start;
+
+        input_page_done();
+        dump_page_done(page_count);
+
+        trigger_t trigger;
+        while (trigger_poll(&trigger)) {
+          handle_trigger(&trigger);
+        }
+      } else if (output_backend == OUTPUT_MMAP) {
+        output_map_page(page_count, tab_size, outputs);
+        for (i = 0; i < nselected; i++) {
+          if (degrade != OVERLOAD_TABS || overload_keep(selected[i])) {
+            tabs[selected[i]] = outputs[i];
+          }
+        }
+        const double transpose_start = metrics_now();
+        deinterleave_page(kernel, threading, channel_block, page, tabs, ntabs, nchannels, nstokes, ntimes, padded_size, &stages);
+        transpose = metrics_now() - transpose_start;
+
+        input_page_done();
+        output_page_done(page_count, tab_size);
+      } else if (gpu_device >= 0) {
+        pipeline_buffer_t *buffer = pipeline_get_buffer(page_count);
+        pipeline_set_offset(buffer, output_page_offset(buffer->page, tab_size));
+        const double transpose_start = metrics_now();
+        gpu_transpose(page_count, page, buffer->tabs);
+        transpose = metrics_now() - transpose_start;
+
+        // the page is on the GPU, release it, and hand the oldest page on the GPU to the writers
+        input_page_done();
+        gpu_pending[page_count % GPU_NSTREAMS] = buffer;
+        const long done = page_count - (GPU_NSTREAMS - 1);
+        if (done >= 0) {
+          gpu_wait(done);
+          pipeline_submit(gpu_pending[done % GPU_NSTREAMS]);
+        }
+      } else {
+        // the writers start on a slice while the next one is transposed
+        int s;
+        for (s = 0; s < nslices; s++) {
+          pipeline_buffer_t *buffer = pipeline_get_buffer((long) page_count * nslices + s);
+          pipeline_set_offset(buffer, output_page_offset(buffer->page, slice_size));
+          buffer->skipped = skipped * nslices;
+          skipped = 0;
+          for (i = 0; i < nselected; i++) {
+            if (degrade == OVERLOAD_TABS && ! overload_keep(selected[i])) {
+              buffer->tabs[i] = NULL;
+            }
+            tabs[selected[i]] = buffer->tabs[i];
+          }
+          const double transpose_start = metrics_now();
+          deinterleave_page(kernel, threading, channel_block, &page[(size_t) s * slice_samples], tabs,
+              ntabs, nchannels, nstokes, ntimes / nslices, padded_size, &stages);
+          transpose += metrics_now() - transpose_start;
+
+          // release the page before writing its last slice
+          if (s == nslices - 1) {
+            input_page_done();
+          }
+          pipeline_submit(buffer);
+        }
+      }
+      if (bandpass) {
+        stats_page(page_count, tabs);
+      }
+      if (stages.seconds) {
+        for (i = 0; i < nselected; i++) {
+          if (tabs[selected[i]]) {
+            metrics_transpose(i, stages.seconds[selected[i]]);
           }
         }
-        ssize_t size = write(output[tab], &buffer[tab*ntimes*nchannels], sizeof(char) * ntimes * nchannels);
       }
-      ipcbuf_mark_cleared((ipcbuf_t *) ipc);
+      input_fill(&nfull, &nbufs);
+      metrics_page(start - wait_start, transpose, metrics_now() - start, nfull, nbufs);
       page_count++;
     }
   }
 
-  if (ipcbuf_eod(data_block)) {
+  // wait for the writers, and close the files; keep the threads and buffers for the next observation
+  if (trigger_source) {
+    // triggers sent during the last page
+    trigger_t trigger;
+    while (trigger_poll(&trigger)) {
+      handle_trigger(&trigger);
+    }
+    dump_drain();
+  } else {
+    if (gpu_device >= 0) {
+      long done;
+      for (done = page_count - (GPU_NSTREAMS - 1) > 0 ? page_count - (GPU_NSTREAMS - 1) : 0; done < page_count; done++) {
+        gpu_wait(done);
+        pipeline_submit(gpu_pending[done % GPU_NSTREAMS]);
+      }
+    }
+    if (skipped) {
+      // the pages dropped at the end, as a gap
+      pipeline_buffer_t *buffer = pipeline_get_buffer((long) page_count * nslices - 1);
+      buffer->skipped = skipped * nslices - 1;
+      int i;
+      for (i = 0; i < nselected; i++) {
+        buffer->tabs[i] = NULL;
+      }
+      pipeline_submit(buffer);
+    }
+    if (output_backend != OUTPUT_MMAP) {
+      pipeline_drain();
+    }
+    close_files();
+  }
+  if (bandpass) {
+    stats_close();
+  }
+  if (overload_policy != OVERLOAD_OFF) {
+    overload_close();
+  }
+
+  return page_count;
+}
+
+int main (int argc, char *argv[]) {
+  char *key;
+  char *logfile;
+  char *file_prefix;
+  char *tunefile = NULL;
+
+  // parse commandline
+  parseOptions(argc, argv, &key, &file_prefix, &logfile, &tunefile);
+
+  // set up logging
+  if (logfile) {
+    runlog = fopen(logfile, "w");
+    if (! runlog) {
+      LOG("ERROR opening logfile: %s\n", logfile);
+      exit(EXIT_FAILURE);
+    }
+    LOG("Logging to logfile: %s\n", logfile);
+    free (logfile);
+  }
+
+  // the coordinator decides on the rollover and filename prefix of all instances, which join it before the first observation
+  local_segment_pages = segment_pages;
+  if (coordinator_port && coordinator_serve(coordinator_port, coordinator_instances, segment_pages, file_prefix) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  if (coordinator_address) {
+    coordinator_connect();
+  }
+
+  // connect to ring buffer, or open the files to replay
+  if (replay) {
+    input_open_files(&argv[optind], argc - optind);
+  } else {
+    input_open_ringbuffer(key);
+  }
+
+  LOG("dadafilterbank version: " VERSION "\n");
+  LOG("Filename prefix = %s\n", file_prefix);
+  if (daemon_mode) {
+    LOG("Daemon mode: waiting for the next observation at the end of data\n");
+    if (! strstr(file_prefix, "%s") && ! strstr(file_prefix, "%m")) {
+      LOG("Warning: the filename prefix has no %%s or %%m, every observation overwrites the files\n");
+    }
+  }
+
+  memory_configure(huge_pages, lock_memory);
+  if (trigger_source && trigger_open(trigger_source) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGINT, sigint_handler);
+
+  char prefix[256];
+  dump_prefix = prefix;
+  int nobservations = 0;
+  int nfailed = 0; // observations that could not be processed
+  long total_pages = 0;
+  while (1) {
+    // the first observation needs a header, in daemon mode the ringbuffer can be shut down instead
+    const int header = read_header();
+    if (header < 0) {
+      if (nobservations == 0) {
+        LOG("ERROR. Get next header block error\n");
+        exit(EXIT_FAILURE);
+      }
+      if (! replay) {
+        LOG("No next header block, stopping\n");
+      }
+      break;
+    }
+
+    const int setup = header > 0 ? -1 : setup_observation();
+    if (setup != 0) {
+      if (setup < 0 && ! daemon_mode && ! replay) {
+        exit(EXIT_FAILURE);
+      }
+      nfailed += setup < 0;
+      LOG("Skipping observation\n");
+      input_skip_observation();
+    } else {
+      // keep the processing when the page shape and rollover did not change
+      if (processing && shape_changed()) {
+        LOG("Page shape or rollover changed, setting up the processing again\n");
+        stop_processing();
+      }
+      if (! processing) {
+        start_processing(tunefile);
+      }
+
+      // create filterbank files, the sidecars go to the first output directory
+      expand_prefix(coordinated_prefix[0] ? coordinated_prefix : file_prefix, prefix, sizeof(prefix));
+      char sidecar_prefix[512];
+      snprintf(sidecar_prefix, sizeof(sidecar_prefix), "%s%s%s", ndirectories ? directories[0] : "", ndirectories ? "/" : "", prefix);
+      if ((! trigger_source && ! stream_only && open_files(prefix) < 0) || (bandpass && open_stats(sidecar_prefix) < 0) ||
+          (overload_policy != OVERLOAD_OFF && open_gaps(sidecar_prefix) < 0) ||
+          (stream_sink() != STREAM_NONE && open_streams() < 0)) {
+        int i;
+        for (i = 0; i < nselected; i++) {
+          if (output[i]) {
+            filterbank_close(output[i]);
+          }
+        }
+        exit(EXIT_FAILURE);
+      }
+
+      // the page shape is known now, for files
+      const size_t page_size = (size_t) ntabs * nchannels * nstokes * padded_size;
+      input_set_page_size(page_size);
+
+      const double start = metrics_now();
+      const int page_count = process_observation();
+      const double elapsed = metrics_now() - start;
+      LOG("Read %i pages in %.3f s, %.2f GB/s\n", page_count, elapsed, elapsed > 0 ? page_count * page_size / elapsed * 1e-9 : 0);
+      total_pages += page_count;
+      coordinator_report(mjd_start, page_count, (uint64_t) page_count * tab_size * nselected, elapsed);
+    }
+    nobservations++;
+
+    if (! input_eod()) {
+      break;
+    }
     LOG("End of data received\n");
+    if (! daemon_mode && ! replay) {
+      break;
+    }
+
+    // ready the data block for the next observation, a replay continues with the next file
+    if (input_next_observation() < 0) {
+      LOG("ERROR. Cannot reset the data block\n");
+      break;
+    }
+    if (! replay) {
+      LOG("Waiting for the next observation\n");
+    }
+  }
+
+  if (processing) {
+    stop_processing();
+  }
+  if (trigger_source) {
+    trigger_close();
+  }
+  coordinator_close();
+
+  input_close();
+  if (daemon_mode || replay) {
+    LOG("Read %li pages in %i observations\n", total_pages, nobservations);
   }
 
-  dada_hdu_unlock_read(ringbuffer);
-  dada_hdu_disconnect(ringbuffer);
-  free(buffer);
-  LOG("Read %i pages\n", page_count);
+  // a replay is scripted, so it fails when an observation or file was skipped
+  if (replay && (nfailed || input_skipped_files())) {
+    LOG("ERROR: skipped %i observations and %i files\n", nfailed, input_skipped_files());
+    exit(EXIT_FAILURE);
+  }
 }
@@ -0,0 +1,131 @@
+/**
+ * Channel mask for flagging RFI during the transpose, see deinterleave_stages_t
+ *
+ * The mask file is text with the flagged channels, as numbers or ranges like 100-120, separated by
+ * whitespace or commas; a # starts a comment. Channels are numbered as in a filterbank file without averaging,
+ * channel 0 being the highest frequency.
+ *
+ * The file is checked for changes before every page, see mask_poll, so the mask can be updated during an observation.
+ * A file that cannot be read or parsed keeps the previous mask.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "mask.h"
+
+static char *path = NULL;
+static int nchannels;
+static unsigned char *mask = NULL;
+static struct timespec mtime;
+static off_t size;
+
+/**
+ * Read the mask file into a new mask
+ *
+ * @param {struct stat *} st Status of the file, at the time it is read
+ * @returns {unsigned char *} The mask, or NULL on an error
+ */
+static unsigned char *load(struct stat *st) {
+  FILE *file = fopen(path, "r");
+  if (! file || fstat(fileno(file), st) != 0) {
+    LOG("ERROR: cannot read channel mask %s: %s\n", path, strerror(errno));
+    if (file) {
+      fclose(file);
+    }
+    return NULL;
+  }
+
+  unsigned char *flags = calloc(nchannels, 1);
+  int nflagged = 0;
+  char line[4096];
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char *token = strtok(line, " \t\r\n,");
+    while (token) {
+      int first, last;
+      char end;
+      if (sscanf(token, "%d-%d%c", &first, &last, &end) != 2) {
+        if (sscanf(token, "%d%c", &first, &end) != 1) {
+          first = -1;
+        }
+        last = first;
+      }
+      if (first < 0 || last < first || last >= nchannels) {
+        LOG("ERROR: %s line %i: '%s' is not a channel or range of channels 0-%i\n", path, number, token, nchannels - 1);
+        fclose(file);
+        free(flags);
+        return NULL;
+      }
+      for (; first <= last; first++) {
+        nflagged += ! flags[first];
+        flags[first] = 1;
+      }
+      token = strtok(NULL, " \t\r\n,");
+    }
+  }
+  fclose(file);
+
+  LOG("Channel mask: %i of %i channels flagged (%s)\n", nflagged, nchannels, path);
+  return flags;
+}
+
+/**
+ * Load the channel mask
+ *
+ * @param {int} nchannels Number of (input) channels
+ * @returns {unsigned char *} Per channel, non-zero when flagged; valid until the next mask_poll
+ */
+const unsigned char *mask_init(const char *file_name, const int nchannels_) {
+  free(path);
+  free(mask);
+  path = strdup(file_name);
+  nchannels = nchannels_;
+
+  struct stat st;
+  mask = load(&st);
+  if (! mask) {
+    exit(EXIT_FAILURE);
+  }
+  mtime = st.st_mtim;
+  size = st.st_size;
+  return mask;
+}
+
+/**
+ * Reload the mask when the file has changed
+ *
+ * @returns {unsigned char *} The current mask, valid until the next mask_poll
+ */
+const unsigned char *mask_poll() {
+  struct stat st;
+  if (stat(path, &st) != 0 ||
+      (st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec && st.st_size == size)) {
+    return mask;
+  }
+
+  unsigned char *flags = load(&st);
+  mtime = st.st_mtim;
+  size = st.st_size;
+  if (flags) {
+    free(mask);
+    mask = flags;
+  } else {
+    LOG("Keeping the previous channel mask\n");
+  }
+  return mask;
+}
+
+void mask_finish() {
+  free(mask);
+  free(path);
+  mask = NULL;
+  path = NULL;
+}
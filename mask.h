@@ -0,0 +1,7 @@
+#ifndef __HAVE_MASK_H__
+#define __HAVE_MASK_H__
+
+extern const unsigned char *mask_init(const char *file_name, const int nchannels);
+extern const unsigned char *mask_poll();
+extern void mask_finish();
+#endif
@@ -0,0 +1,199 @@
+/**
+ * Allocation of the large buffers the transposer writes to: the transpose buffers and the dump ring.
+ *
+ * The buffers are mapped with huge pages, to save TLB misses on the strided writes of the transpose:
+ * transparent huge pages by default, or explicit 2 MB or 1 GB pages from hugetlbfs, falling back
+ * to transparent huge pages when none are available. Buffers are locked in memory when allowed.
+ *
+ * Every buffer is first touched by the openMP threads, thread n touching the n-th part of every period
+ * of the buffer (a transposed page), so on a NUMA machine the pages are spread over the nodes of the threads.
+ * This only matches the writes with TAB threading (-m tab), where a static schedule gives every thread
+ * a contiguous run of whole TABs, and only to TAB granularity. With tile or nested threading, the
+ * channel blocks of a TAB are divided over the threads, and every block is a strip down all rows of the TAB,
+ * so several threads write every (huge) page; the placement is then not per thread.
+ *
+ * Mappings are rounded up to the configured huge page size, also after a fallback,
+ * so memory_free only needs the requested size.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "log.h"
+#include "memory.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// flags for get_mempolicy, from linux/mempolicy.h
+#define MEMORY_MPOL_F_NODE (1 << 0)
+#define MEMORY_MPOL_F_ADDR (1 << 1)
+
+static memory_huge_t huge = MEMORY_HUGE_THP;
+static int lock = 1;
+static int lock_warned;
+static int huge_warned;
+
+int memory_huge_parse(const char *name, memory_huge_t *huge) {
+  if (strcmp(name, "none") == 0) {
+    *huge = MEMORY_HUGE_NONE;
+  } else if (strcmp(name, "thp") == 0) {
+    *huge = MEMORY_HUGE_THP;
+  } else if (strcmp(name, "2M") == 0) {
+    *huge = MEMORY_HUGE_2M;
+  } else if (strcmp(name, "1G") == 0) {
+    *huge = MEMORY_HUGE_1G;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+const char *memory_huge_name(const memory_huge_t huge) {
+  switch (huge) {
+    case MEMORY_HUGE_NONE: return "none";
+    case MEMORY_HUGE_2M: return "2M";
+    case MEMORY_HUGE_1G: return "1G";
+    default: return "thp";
+  }
+}
+
+/**
+ * Set the kind of pages for the following allocations, and whether to lock them
+ */
+void memory_configure(const memory_huge_t huge_, const int lock_) {
+  huge = huge_;
+  lock = lock_;
+}
+
+static size_t mapped_size(const size_t size) {
+  const size_t page = huge == MEMORY_HUGE_1G ? 1ul << 30 : huge == MEMORY_HUGE_NONE ? 4096 : 2ul << 20;
+  return (size + page - 1) / page * page;
+}
+
+/**
+ * Node of the memory at an address, or -1 when unknown
+ */
+static int memory_node(const void *address) {
+  int node = -1;
+#ifdef __NR_get_mempolicy
+  if (syscall(__NR_get_mempolicy, &node, NULL, 0, address, MEMORY_MPOL_F_NODE | MEMORY_MPOL_F_ADDR) != 0) {
+    return -1;
+  }
+#endif
+  return node;
+}
+
+/**
+ * Allocate a buffer, and touch it from the openMP threads
+ *
+ * @param {size_t} period Size in bytes of the part that is divided over the threads, like a transposed page
+ * @param {char *} what Name of the buffer, for the log
+ * @returns {char *} The buffer, aligned to at least 4 kB
+ */
+char *memory_alloc(const size_t size, const size_t period, const char *what) {
+  const size_t length = mapped_size(size);
+  char *data = MAP_FAILED;
+
+  if (huge == MEMORY_HUGE_2M || huge == MEMORY_HUGE_1G) {
+    data = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|
+        (huge == MEMORY_HUGE_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+    if (data == MAP_FAILED && ! huge_warned) {
+      huge_warned = 1;
+      LOG("Warning: no %s huge pages for the %s (%s), using transparent huge pages\n", memory_huge_name(huge), what, strerror(errno));
+    }
+  }
+  if (data == MAP_FAILED) {
+    data = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      LOG("ERROR: cannot allocate %zu bytes for the %s: %s\n", size, what, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if (huge != MEMORY_HUGE_NONE) {
+      madvise(data, length, MADV_HUGEPAGE);
+    }
+  }
+
+  // touch the memory now, instead of during the observation, in parts per thread like TAB threading writes it
+  size_t start;
+  for (start = 0; start < size; start += period) {
+    const size_t end = start + period < size ? start + period : size;
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+      const int nthreads = omp_get_num_threads();
+      const int thread = omp_get_thread_num();
+#else
+      const int nthreads = 1;
+      const int thread = 0;
+#endif
+      const size_t first = start + (end - start) * thread / nthreads;
+      const size_t last = start + (end - start) * (thread + 1) / nthreads;
+      memset(&data[first], 0, last - first);
+    }
+  }
+
+  if (lock && mlock(data, size) != 0 && ! lock_warned) {
+    LOG("Warning: cannot lock the %s in memory: %s\n", what, strerror(errno));
+    lock_warned = 1;
+  }
+
+  return data;
+}
+
+void memory_free(char *data, const size_t size) {
+  if (data) {
+    munmap(data, mapped_size(size));
+  }
+}
+
+/**
+ * Log the NUMA node of a buffer, and of the openMP threads
+ *
+ * The node is checked at the start, the middle, and the end of the buffer, which should be faulted in.
+ */
+void memory_log_locality(const char *what, const char *data, const size_t size) {
+  const int nodes[3] = {memory_node(data), memory_node(&data[size / 2]), memory_node(&data[size - 1])};
+  if (nodes[0] < 0) {
+    LOG("%s: NUMA node unknown\n", what);
+    return;
+  }
+
+  // bit mask of the nodes the threads run on
+  unsigned long threads = 0;
+#pragma omp parallel reduction(|:threads)
+  {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < 8 * sizeof(unsigned long)) {
+      threads |= 1ul << node;
+    }
+  }
+
+  char list[256] = "";
+  unsigned node;
+  for (node = 0; node < 8 * sizeof(unsigned long); node++) {
+    if (threads & (1ul << node)) {
+      snprintf(&list[strlen(list)], sizeof(list) - strlen(list), "%s%u", list[0] ? "," : "", node);
+    }
+  }
+
+  const int local = nodes[0] == nodes[1] && nodes[1] == nodes[2] && threads == 1ul << nodes[0];
+  if (nodes[0] == nodes[1] && nodes[1] == nodes[2]) {
+    LOG("%s on NUMA node %i, transpose threads on node %s%s\n", what, nodes[0], list, local ? "" : " (not local)");
+  } else {
+    LOG("%s on NUMA nodes %i,%i,%i, transpose threads on node %s (not local)\n", what, nodes[0], nodes[1], nodes[2], list);
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef __HAVE_MEMORY_H__
+#define __HAVE_MEMORY_H__
+
+#include <stddef.h>
+
+typedef enum {
+  MEMORY_HUGE_NONE, // normal pages
+  MEMORY_HUGE_THP,  // transparent huge pages, using madvise
+  MEMORY_HUGE_2M,   // 2 MB pages from hugetlbfs
+  MEMORY_HUGE_1G    // 1 GB pages from hugetlbfs
+} memory_huge_t;
+
+extern int memory_huge_parse(const char *name, memory_huge_t *huge);
+extern const char *memory_huge_name(const memory_huge_t huge);
+
+extern void memory_configure(const memory_huge_t huge, const int lock);
+extern char *memory_alloc(const size_t size, const size_t period, const char *what);
+extern void memory_free(char *data, const size_t size);
+extern void memory_log_locality(const char *what, const char *data, const size_t size);
+#endif
@@ -0,0 +1,365 @@
+/**
+ * Per page timing metrics, logged periodically and served in the Prometheus text format.
+ *
+ * Timers are recorded from the main thread and the writer threads with atomic operations,
+ * in latency histograms with power of two buckets. Every log_interval seconds a summary
+ * of the last interval is written to the logfile, and when a port is given, a small HTTP server
+ * thread answers every request with the current totals.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "metrics.h"
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;          // nanoseconds
+  uint64_t max;          // nanoseconds, since the last log line
+  uint64_t buckets[METRIC_NBUCKETS + 1];
+} histogram_t;
+
+static const char *timer_names[METRIC_NTIMERS] = {"read_wait", "transpose", "processing", "write"};
+
+static histogram_t timers[METRIC_NTIMERS];
+static int ntabs;
+static int *tabs;
+static uint64_t *write_sums;  // nanoseconds, per TAB
+static uint64_t *write_counts;
+static uint64_t *transpose_sums; // nanoseconds, per TAB, with TAB threading only
+static uint64_t *transpose_counts;
+static double *band_means;    // of the last page, per TAB
+static double *band_rms;
+static uint64_t *clipped;
+static int bandpass;          // statistics were recorded
+static int tab_transpose;     // transpose times per TAB were recorded
+
+static double page_duration;
+static uint64_t npages;
+static uint64_t nlate;
+static double margin;         // of the last page
+static uint64_t ringbuffer_full;
+static uint64_t ringbuffer_bufs;
+
+// periodic log
+static double log_interval;
+static double last_log;
+static histogram_t logged[METRIC_NTIMERS];
+static uint64_t logged_pages;
+static uint64_t logged_late;
+static double min_margin;
+
+// http server
+static int listen_fd = -1;
+static pthread_t server;
+
+double metrics_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Record a duration, can be called from any thread
+ */
+void metrics_record(const metric_timer_t timer, const double seconds) {
+  histogram_t *h = &timers[timer];
+  const uint64_t ns = seconds > 0 ? (uint64_t) (seconds * 1e9) : 0;
+
+  // smallest bucket with seconds <= 2^(METRIC_BUCKET_MIN + bucket), zero (a dropped page) goes in the first
+  int bucket = 0;
+  if (seconds > ldexp(1, METRIC_BUCKET_MIN)) {
+    int exponent;
+    const double mantissa = frexp(seconds, &exponent);
+    bucket = exponent - METRIC_BUCKET_MIN - (mantissa == 0.5);
+    bucket = bucket > METRIC_NBUCKETS ? METRIC_NBUCKETS : bucket;
+  }
+
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/**
+ * Record the latency of a write for a TAB (index in the selected TABs)
+ */
+void metrics_write(const int tab, const double seconds) {
+  metrics_record(METRIC_WRITE, seconds);
+  __atomic_fetch_add(&write_sums[tab], (uint64_t) (seconds * 1e9), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&write_counts[tab], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record the transpose time of a page for a TAB (index in the selected TABs), with TAB threading only
+ */
+void metrics_transpose(const int tab, const double seconds) {
+  __atomic_fetch_add(&transpose_sums[tab], (uint64_t) (seconds * 1e9), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&transpose_counts[tab], 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&tab_transpose, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record the bandpass statistics of the last page for a TAB (index in the selected TABs)
+ *
+ * @param {double} mean Mean of the samples
+ * @param {double} rms Standard deviation of the samples
+ * @param {uint64_t} nclipped Number of samples at 0 or 255
+ */
+void metrics_bandpass(const int tab, const double mean, const double rms, const uint64_t nclipped) {
+  __atomic_store(&band_means[tab], &mean, __ATOMIC_RELAXED);
+  __atomic_store(&band_rms[tab], &rms, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&clipped[tab], nclipped, __ATOMIC_RELAXED);
+  __atomic_store_n(&bandpass, 1, __ATOMIC_RELAXED);
+}
+
+static void log_metrics(const double now) {
+  double mean[METRIC_NTIMERS], max[METRIC_NTIMERS];
+  int t;
+  for (t = 0; t < METRIC_NTIMERS; t++) {
+    histogram_t current = timers[t];
+    const uint64_t count = current.count - logged[t].count;
+    mean[t] = count ? 1e-9 * (current.sum - logged[t].sum) / count : 0;
+    max[t] = 1e-9 * __atomic_exchange_n(&timers[t].max, 0, __ATOMIC_RELAXED);
+    logged[t] = current;
+  }
+
+  LOG("Metrics: %lu pages, %lu late, margin %.3f s, ringbuffer %lu/%lu full, "
+      "read wait %.3f/%.3f s, transpose %.3f/%.3f s, processing %.3f/%.3f s, write %.3f/%.3f s (mean/max)\n",
+      npages - logged_pages, nlate - logged_late, min_margin, ringbuffer_full, ringbuffer_bufs,
+      mean[METRIC_READ_WAIT], max[METRIC_READ_WAIT], mean[METRIC_TRANSPOSE], max[METRIC_TRANSPOSE],
+      mean[METRIC_PROCESSING], max[METRIC_PROCESSING], mean[METRIC_WRITE], max[METRIC_WRITE]);
+
+  logged_pages = npages;
+  logged_late = nlate;
+  min_margin = page_duration;
+  last_log = now;
+}
+
+/**
+ * Record the timings of a page, call from the main thread
+ *
+ * @param {uint64_t} nfull Full ringbuffer pages, after reading this one
+ * @param {uint64_t} nbufs Pages in the ringbuffer
+ */
+void metrics_page(const double read_wait, const double transpose, const double processing,
+    const uint64_t nfull, const uint64_t nbufs) {
+  metrics_record(METRIC_READ_WAIT, read_wait);
+  metrics_record(METRIC_TRANSPOSE, transpose);
+  metrics_record(METRIC_PROCESSING, processing);
+
+  const double m = page_duration - processing;
+  __atomic_store_n(&ringbuffer_full, nfull, __ATOMIC_RELAXED);
+  __atomic_store_n(&ringbuffer_bufs, nbufs, __ATOMIC_RELAXED);
+  __atomic_store(&margin, &m, __ATOMIC_RELAXED);
+  if (m < 0) {
+    __atomic_fetch_add(&nlate, 1, __ATOMIC_RELAXED);
+  }
+  if (m < min_margin) {
+    min_margin = m;
+  }
+  __atomic_fetch_add(&npages, 1, __ATOMIC_RELAXED);
+
+  if (log_interval > 0) {
+    const double now = metrics_now();
+    if (now - last_log >= log_interval) {
+      log_metrics(now);
+    }
+  }
+}
+
+static void print_metrics(FILE *out) {
+  int t;
+  for (t = 0; t < METRIC_NTIMERS; t++) {
+    const histogram_t *h = &timers[t];
+    fprintf(out, "# TYPE dadafilterbank_%s_seconds histogram\n", timer_names[t]);
+    uint64_t cumulative = 0;
+    int b;
+    for (b = 0; b < METRIC_NBUCKETS; b++) {
+      cumulative += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+      fprintf(out, "dadafilterbank_%s_seconds_bucket{le=\"%g\"} %lu\n", timer_names[t], ldexp(1.0, METRIC_BUCKET_MIN + b), cumulative);
+    }
+    cumulative += __atomic_load_n(&h->buckets[METRIC_NBUCKETS], __ATOMIC_RELAXED);
+    fprintf(out, "dadafilterbank_%s_seconds_bucket{le=\"+Inf\"} %lu\n", timer_names[t], cumulative);
+    fprintf(out, "dadafilterbank_%s_seconds_sum %.9f\n", timer_names[t], 1e-9 * __atomic_load_n(&h->sum, __ATOMIC_RELAXED));
+    fprintf(out, "dadafilterbank_%s_seconds_count %lu\n", timer_names[t], __atomic_load_n(&h->count, __ATOMIC_RELAXED));
+  }
+
+  fprintf(out, "# TYPE dadafilterbank_tab_write_seconds_total counter\n");
+  for (t = 0; t < ntabs; t++) {
+    fprintf(out, "dadafilterbank_tab_write_seconds_total{tab=\"%i\"} %.9f\n", tabs[t], 1e-9 * __atomic_load_n(&write_sums[t], __ATOMIC_RELAXED));
+  }
+  fprintf(out, "# TYPE dadafilterbank_tab_writes_total counter\n");
+  for (t = 0; t < ntabs; t++) {
+    fprintf(out, "dadafilterbank_tab_writes_total{tab=\"%i\"} %lu\n", tabs[t], __atomic_load_n(&write_counts[t], __ATOMIC_RELAXED));
+  }
+
+  if (__atomic_load_n(&tab_transpose, __ATOMIC_RELAXED)) {
+    fprintf(out, "# TYPE dadafilterbank_tab_transpose_seconds_total counter\n");
+    for (t = 0; t < ntabs; t++) {
+      fprintf(out, "dadafilterbank_tab_transpose_seconds_total{tab=\"%i\"} %.9f\n", tabs[t],
+          1e-9 * __atomic_load_n(&transpose_sums[t], __ATOMIC_RELAXED));
+    }
+    fprintf(out, "# TYPE dadafilterbank_tab_transposes_total counter\n");
+    for (t = 0; t < ntabs; t++) {
+      fprintf(out, "dadafilterbank_tab_transposes_total{tab=\"%i\"} %lu\n", tabs[t], __atomic_load_n(&transpose_counts[t], __ATOMIC_RELAXED));
+    }
+  }
+
+  double m;
+  if (__atomic_load_n(&bandpass, __ATOMIC_RELAXED)) {
+    fprintf(out, "# TYPE dadafilterbank_tab_mean gauge\n");
+    for (t = 0; t < ntabs; t++) {
+      __atomic_load(&band_means[t], &m, __ATOMIC_RELAXED);
+      fprintf(out, "dadafilterbank_tab_mean{tab=\"%i\"} %.4f\n", tabs[t], m);
+    }
+    fprintf(out, "# TYPE dadafilterbank_tab_rms gauge\n");
+    for (t = 0; t < ntabs; t++) {
+      __atomic_load(&band_rms[t], &m, __ATOMIC_RELAXED);
+      fprintf(out, "dadafilterbank_tab_rms{tab=\"%i\"} %.4f\n", tabs[t], m);
+    }
+    fprintf(out, "# TYPE dadafilterbank_tab_clipped_samples_total counter\n");
+    for (t = 0; t < ntabs; t++) {
+      fprintf(out, "dadafilterbank_tab_clipped_samples_total{tab=\"%i\"} %lu\n", tabs[t], __atomic_load_n(&clipped[t], __ATOMIC_RELAXED));
+    }
+  }
+
+  __atomic_load(&margin, &m, __ATOMIC_RELAXED);
+  fprintf(out, "# TYPE dadafilterbank_pages_total counter\ndadafilterbank_pages_total %lu\n", __atomic_load_n(&npages, __ATOMIC_RELAXED));
+  fprintf(out, "# TYPE dadafilterbank_pages_late_total counter\ndadafilterbank_pages_late_total %lu\n", __atomic_load_n(&nlate, __ATOMIC_RELAXED));
+  fprintf(out, "# TYPE dadafilterbank_margin_seconds gauge\ndadafilterbank_margin_seconds %.6f\n", m);
+  fprintf(out, "# TYPE dadafilterbank_ringbuffer_full_pages gauge\ndadafilterbank_ringbuffer_full_pages %lu\n", __atomic_load_n(&ringbuffer_full, __ATOMIC_RELAXED));
+  fprintf(out, "# TYPE dadafilterbank_ringbuffer_pages gauge\ndadafilterbank_ringbuffer_pages %lu\n", __atomic_load_n(&ringbuffer_bufs, __ATOMIC_RELAXED));
+}
+
+static void *server_thread(void *arg) {
+  while (1) {
+    const int client = accept(listen_fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    // the request itself is not interpreted, every path returns the metrics
+    char request[1024];
+    if (read(client, request, sizeof(request)) < 0) {
+      close(client);
+      continue;
+    }
+
+    char *body = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&body, &size);
+    print_metrics(out);
+    fclose(out);
+
+    char header[256];
+    const int n = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", size);
+    if (write(client, header, n) == n) {
+      size_t written = 0;
+      while (written < size) {
+        const ssize_t w = write(client, &body[written], size - written);
+        if (w <= 0) {
+          break;
+        }
+        written += w;
+      }
+    }
+    free(body);
+    close(client);
+  }
+  return NULL;
+}
+
+/**
+ * Set up the metrics
+ *
+ * @param {double} page_duration Time between ringbuffer pages, in seconds
+ * @param {int *} tabs Number of every selected TAB, for the labels
+ * @param {int} port Port for the HTTP server, or 0 for none
+ * @param {double} log_interval Seconds between log lines, or 0 for none
+ */
+void metrics_init(const double page_duration_, const int ntabs_, const int *tabs_, const int port, const double log_interval_) {
+  page_duration = page_duration_;
+  log_interval = log_interval_;
+  ntabs = ntabs_;
+  tabs = malloc(ntabs * sizeof(int));
+  memcpy(tabs, tabs_, ntabs * sizeof(int));
+  write_sums = calloc(ntabs, sizeof(uint64_t));
+  write_counts = calloc(ntabs, sizeof(uint64_t));
+  transpose_sums = calloc(ntabs, sizeof(uint64_t));
+  transpose_counts = calloc(ntabs, sizeof(uint64_t));
+  band_means = calloc(ntabs, sizeof(double));
+  band_rms = calloc(ntabs, sizeof(double));
+  clipped = calloc(ntabs, sizeof(uint64_t));
+  bandpass = 0;
+  tab_transpose = 0;
+  last_log = metrics_now();
+  min_margin = page_duration;
+
+  if (port <= 0) {
+    return;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  const int on = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, 4) < 0) {
+    LOG("Warning: cannot serve metrics on port %i: %s\n", port, strerror(errno));
+    if (listen_fd >= 0) {
+      close(listen_fd);
+    }
+    listen_fd = -1;
+    return;
+  }
+  if (pthread_create(&server, NULL, server_thread, NULL) != 0) {
+    LOG("Warning: cannot start metrics server\n");
+    close(listen_fd);
+    listen_fd = -1;
+    return;
+  }
+  LOG("Serving metrics on port %i\n", port);
+}
+
+/**
+ * Log the last interval, and stop the HTTP server
+ */
+void metrics_finish() {
+  if (log_interval > 0 && npages > logged_pages) {
+    log_metrics(metrics_now());
+  }
+  if (listen_fd >= 0) {
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+  }
+  free(tabs);
+  free(write_sums);
+  free(write_counts);
+  free(transpose_sums);
+  free(transpose_counts);
+  free(band_means);
+  free(band_rms);
+  free(clipped);
+}
@@ -0,0 +1,27 @@
+#ifndef __HAVE_METRICS_H__
+#define __HAVE_METRICS_H__
+
+#include <stdint.h>
+
+typedef enum {
+  METRIC_READ_WAIT,  // time blocked waiting for a ringbuffer page
+  METRIC_TRANSPOSE,  // time to transpose a page
+  METRIC_PROCESSING, // time from receiving a page to handing it to the writers
+  METRIC_WRITE,      // latency of a single write of a TAB
+  METRIC_NTIMERS
+} metric_timer_t;
+
+// Latency histograms have buckets from 2^METRIC_BUCKET_MIN seconds, doubling, and one for larger values
+#define METRIC_BUCKET_MIN -14
+#define METRIC_NBUCKETS 18
+
+extern void metrics_init(const double page_duration, const int ntabs, const int *tabs, const int port, const double log_interval);
+extern double metrics_now();
+extern void metrics_record(const metric_timer_t timer, const double seconds);
+extern void metrics_write(const int tab, const double seconds);
+extern void metrics_transpose(const int tab, const double seconds);
+extern void metrics_bandpass(const int tab, const double mean, const double rms, const uint64_t clipped);
+extern void metrics_page(const double read_wait, const double transpose, const double processing,
+    const uint64_t nfull, const uint64_t nbufs);
+extern void metrics_finish();
+#endif
@@ -0,0 +1,778 @@
+/**
+ * Output backends for writing the transposed TABs to the filterbank files.
+ *
+ * The 'write' backend uses blocking write() calls.
+ * The 'uring' backend splits every TAB in chunks of OUTPUT_URING_CHUNK bytes, and keeps up to
+ * OUTPUT_URING_DEPTH writes in flight per writer thread. Every writer thread has its own ring,
+ * and the transpose buffers are registered with it when the kernel allows, so the writes do not
+ * need to map the buffers again. Short writes are resubmitted for the remaining bytes.
+ * When io_uring is not available, the 'write' backend is used instead.
+ *
+ * In direct mode, the data is written through a second file descriptor opened with O_DIRECT,
+ * bypassing the page cache. The header is written normally, through the first descriptor.
+ * O_DIRECT needs aligned file offsets, sizes, and memory. The transposer places the data at
+ * the same offset from an aligned address in the buffer as it has from an aligned offset in the file
+ * (see output_page_offset), so everything but the unaligned tail of the previous write can be written
+ * directly. That tail, less than OUTPUT_ALIGNMENT bytes, is copied in front of the data for the next write.
+ * The last tail is written through the normal descriptor when the file is closed.
+ *
+ * To prevent fragmentation, the files can be preallocated using fallocate, either for the expected
+ * size of the observation, or in large extents ahead of the write position.
+ * Files are truncated to the size of the data when closed.
+ *
+ * The 'mmap' backend does not use the transpose buffers. Every file is extended and mapped in windows
+ * of a number of pages, and the page is transposed directly into the mapping (see output_map_page).
+ * Writeback of every page is started when it is done, and the page cache of a window is dropped
+ * when the window after it is retired.
+ *
+ * The files can be rolled over every number of pages (see output_set_segments). The first write of a page
+ * in the next segment finishes the file of the TAB like output_close, after its outstanding writes, and has
+ * the caller close it and create the next one. This happens in the writer thread of the TAB, or in the
+ * thread calling output_map_page for the mmap backend, so the other TABs keep being written.
+ * The time spent writing every file is measured, for the caller to place the next files (see stripe.c).
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "metrics.h"
+#include "output.h"
+
+typedef struct {
+  int tab;
+  int fd;
+  char *data;
+  size_t size;
+  off_t offset;
+  long page;
+  int buf_index;
+  struct iovec iov;
+  double submitted;
+} request_t;
+
+typedef struct {
+  uring_t ring;
+  request_t requests[OUTPUT_URING_DEPTH];
+  int free_list[OUTPUT_URING_DEPTH];
+  int nfree;
+  long nshort;
+  long nerrors;
+} writer_t;
+
+static output_backend_t backend;
+static int ntabs;
+static int nwriters;
+static int *fds;
+static off_t *offsets;
+static writer_t *writers;
+static int registered;
+
+// direct mode
+static int direct;
+static int *direct_fds;
+static char **tails;
+static size_t *tail_sizes;
+static off_t data_start;
+
+// preallocation
+static off_t preallocate_size;
+static off_t extent_size;
+static off_t *allocated;
+static char *unallocatable;    // per TAB, fallocate failed for its current file
+static int preallocate_warned; // the failure is logged once
+
+// segments
+static long segment_pages;
+static size_t segment_size;
+static output_open_t open_segment;
+static output_close_t close_segment;
+static long *segments;
+static uint64_t *file_bytes;
+static double *file_seconds;
+
+// mmap backend
+static int window_pages;
+static off_t *bases;       // file offset of the first page
+static long *windows;      // window currently mapped, or -1
+static char **maps;
+static off_t *map_offsets; // file offset of the mapping
+static size_t *map_sizes;
+
+int output_backend_parse(const char *name, output_backend_t *backend) {
+  if (strcmp(name, "write") == 0) {
+    *backend = OUTPUT_WRITE;
+  } else if (strcmp(name, "uring") == 0) {
+    *backend = OUTPUT_URING;
+  } else if (strcmp(name, "mmap") == 0) {
+    *backend = OUTPUT_MMAP;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+const char *output_backend_name(const output_backend_t backend) {
+  switch (backend) {
+    case OUTPUT_URING: return "uring";
+    case OUTPUT_MMAP: return "mmap";
+    default: return "write";
+  }
+}
+
+/**
+ * Set up the output backend, call after pipeline_init (except for the mmap backend)
+ *
+ * @param {int} nwriters Number of writer threads, unused for the mmap backend
+ * @param {int} direct Write the data using O_DIRECT, not supported by the mmap backend
+ * @returns {output_backend_t} The backend in use, OUTPUT_WRITE when io_uring is not available
+ */
+output_backend_t output_init(const output_backend_t backend_, const int ntabs_, const int nwriters_, const int direct_) {
+  backend = backend_;
+  ntabs = ntabs_;
+  nwriters = nwriters_;
+  direct = direct_;
+
+  fds = calloc(ntabs, sizeof(int));
+  offsets = calloc(ntabs, sizeof(off_t));
+  allocated = calloc(ntabs, sizeof(off_t));
+  unallocatable = calloc(ntabs, 1);
+  segments = calloc(ntabs, sizeof(long));
+  file_bytes = calloc(ntabs, sizeof(uint64_t));
+  file_seconds = calloc(ntabs, sizeof(double));
+
+  if (direct) {
+    direct_fds = calloc(ntabs, sizeof(int));
+    tails = calloc(ntabs, sizeof(char *));
+    tail_sizes = calloc(ntabs, sizeof(size_t));
+
+    int tab;
+    for (tab = 0; tab < ntabs; tab++) {
+      direct_fds[tab] = -1;
+      if (posix_memalign((void **) &tails[tab], OUTPUT_ALIGNMENT, OUTPUT_ALIGNMENT) != 0) {
+        LOG("ERROR: cannot allocate memory for direct I/O\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  if (backend == OUTPUT_MMAP) {
+    bases = calloc(ntabs, sizeof(off_t));
+    windows = calloc(ntabs, sizeof(long));
+    maps = calloc(ntabs, sizeof(char *));
+    map_offsets = calloc(ntabs, sizeof(off_t));
+    map_sizes = calloc(ntabs, sizeof(size_t));
+    window_pages = 1;
+  }
+
+  if (backend != OUTPUT_URING) {
+    return backend;
+  }
+
+  writers = calloc(nwriters, sizeof(writer_t));
+
+  // register the pool of transpose buffers
+  const int nbuffers = pipeline_nbuffers();
+  struct iovec iov[nbuffers];
+  int b;
+  for (b = 0; b < nbuffers; b++) {
+    iov[b].iov_base = pipeline_buffer_data(b);
+    iov[b].iov_len = pipeline_buffer_size();
+  }
+  registered = 1;
+
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    writer_t *writer = &writers[w];
+    if (uring_init(&writer->ring, OUTPUT_URING_DEPTH) < 0) {
+      LOG("Warning: io_uring not available (%s), using write()\n", strerror(errno));
+      for (w--; w >= 0; w--) {
+        uring_exit(&writers[w].ring);
+      }
+      free(writers);
+      writers = NULL;
+      backend = OUTPUT_WRITE;
+      return backend;
+    }
+
+    if (registered && uring_register_buffers(&writer->ring, iov, nbuffers) < 0) {
+      LOG("Warning: cannot register transpose buffers with io_uring (%s)\n", strerror(errno));
+      registered = 0;
+    }
+
+    int r;
+    for (r = 0; r < OUTPUT_URING_DEPTH; r++) {
+      writer->free_list[r] = r;
+    }
+    writer->nfree = OUTPUT_URING_DEPTH;
+  }
+  LOG("io_uring: %i writes in flight per writer, %s buffers\n", OUTPUT_URING_DEPTH, registered ? "registered" : "unregistered");
+
+  return backend;
+}
+
+/**
+ * Preallocate the files, call before output_set_file
+ *
+ * @param {off_t} size Expected number of data bytes per file, or 0
+ * @param {off_t} extent Preallocate ahead of the write position in extents of this size, or 0
+ */
+void output_set_preallocation(const off_t size, const off_t extent) {
+  preallocate_size = size;
+  extent_size = extent;
+}
+
+/**
+ * Allocate disk space for a TAB up to the given offset
+ *
+ * When fallocate fails, preallocation is off for the current file of the TAB only, for instance
+ * when a single output directory is on a file system without it.
+ */
+static void preallocate(const int tab, const off_t end) {
+  if (end <= allocated[tab] || unallocatable[tab]) {
+    return;
+  }
+  int err = fallocate(fds[tab], 0, allocated[tab], end - allocated[tab]);
+  if (err != 0) {
+    if (! __atomic_exchange_n(&preallocate_warned, 1, __ATOMIC_RELAXED)) {
+      LOG("Warning: cannot preallocate TAB %i (%s), disabling preallocation for its file\n", tab, strerror(errno));
+    }
+    unallocatable[tab] = 1;
+    return;
+  }
+  allocated[tab] = end;
+}
+
+/**
+ * Roll the files over to a new file every npages pages, and let the caller create and close the files
+ *
+ * Without segments (npages 0), the functions are still used to close the files of an observation.
+ *
+ * @param {long} npages Pages per file, or 0 for a single file per observation
+ * @param {size_t} size Bytes written per TAB per page
+ * @param {output_open_t} open Function to create the file of the next segment
+ * @param {output_close_t} close Function to close a file, can be NULL to leave the files to the caller
+ */
+void output_set_segments(const long npages, const size_t size, output_open_t open, output_close_t close) {
+  segment_pages = npages;
+  segment_size = size;
+  open_segment = open;
+  close_segment = close;
+}
+
+/**
+ * Set the file for a TAB
+ *
+ * @param {int} fd File descriptor, positioned at the start of the data (after the header)
+ * @param {char *} file_name Name of the file, used to open it again for direct I/O
+ * @param {char *} header The header written to the file
+ * @param {int} header_size Length of the header, where the data starts
+ */
+void output_set_file(const int tab, const int fd, const char *file_name, const char *header, const int header_size) {
+  fds[tab] = fd;
+  offsets[tab] = header_size;
+  file_bytes[tab] = 0;
+  file_seconds[tab] = 0;
+  if (tab == 0) {
+    data_start = offsets[tab];
+  }
+
+  allocated[tab] = offsets[tab];
+  unallocatable[tab] = 0;
+  if (preallocate_size) {
+    preallocate(tab, offsets[tab] + preallocate_size);
+  } else if (extent_size) {
+    preallocate(tab, offsets[tab] + extent_size);
+  }
+
+  if (backend == OUTPUT_MMAP) {
+    bases[tab] = offsets[tab];
+    windows[tab] = -1;
+  }
+
+  if (direct) {
+    direct_fds[tab] = open(file_name, O_RDWR|O_DIRECT);
+    if (direct_fds[tab] < 0) {
+      LOG("Warning: cannot open %s for direct I/O (%s), using the page cache\n", file_name, strerror(errno));
+      return;
+    }
+
+    // start with the part of the header in the first aligned block
+    const off_t block = offsets[tab] / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+    tail_sizes[tab] = offsets[tab] - block;
+    memcpy(tails[tab], &header[block], tail_sizes[tab]);
+  }
+}
+
+/**
+ * Offset of the transposed data from an aligned address, for a given page
+ *
+ * In direct mode, this equals the offset of the page in the file from the previous aligned block.
+ *
+ * @param {size_t} size Bytes written per TAB per page
+ */
+size_t output_page_offset(const long page, const size_t size) {
+  if (! direct) {
+    return 0;
+  }
+  return (data_start + (segment_pages ? page % segment_pages : page) * size) % OUTPUT_ALIGNMENT;
+}
+
+/**
+ * Set the number of pages per mapping for the mmap backend
+ */
+void output_set_window(const int npages) {
+  window_pages = npages;
+}
+
+/**
+ * Map the next window of a TAB, and retire the current one
+ */
+static void map_window(const int tab, const long window, const size_t size) {
+  const size_t window_size = window_pages * size;
+
+  if (maps[tab]) {
+    munmap(maps[tab], map_sizes[tab]);
+    maps[tab] = NULL;
+  }
+
+  // drop the window before the retired one from the page cache, its writeback should be done by now
+  if (window >= 2) {
+    posix_fadvise(fds[tab], bases[tab] + (window - 2) * window_size, window_size, POSIX_FADV_DONTNEED);
+  }
+
+  // mappings start at a page boundary
+  const off_t start = bases[tab] + window * window_size;
+  const off_t end = start + window_size;
+  map_offsets[tab] = start / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+  map_sizes[tab] = end - map_offsets[tab];
+
+  // the file should cover the mapping, preallocate or extend it
+  if (extent_size) {
+    preallocate(tab, end + extent_size);
+  }
+  if (end > allocated[tab]) {
+    if (ftruncate(fds[tab], end) != 0) {
+      LOG("ERROR extending file for TAB %i: %s\n", tab, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    allocated[tab] = end;
+  }
+
+  maps[tab] = mmap(NULL, map_sizes[tab], PROT_READ|PROT_WRITE, MAP_SHARED, fds[tab], map_offsets[tab]);
+  if (maps[tab] == MAP_FAILED) {
+    LOG("ERROR mapping file for TAB %i: %s\n", tab, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  madvise(maps[tab], map_sizes[tab], MADV_SEQUENTIAL);
+  windows[tab] = window;
+}
+
+/**
+ * Get the addresses in the mapped files to transpose a page to, for the mmap backend
+ *
+ * @param {size_t} size Bytes written per TAB per page
+ * @param {char **} tabs Set to the start of the page in the file of every TAB
+ */
+void output_map_page(const long page, const size_t size, char **tabs) {
+  const long position = segment_pages ? page % segment_pages : page; // page in the file
+  const long window = position / window_pages;
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    output_segment(-1, tab, page);
+    if (windows[tab] != window) {
+      map_window(tab, window, size);
+    }
+    tabs[tab] = &maps[tab][bases[tab] + position * size - map_offsets[tab]];
+  }
+}
+
+/**
+ * Mark a page as transposed, for the mmap backend, and start its writeback
+ */
+void output_page_done(const long page, const size_t size) {
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    output_segment(-1, tab, page);
+    sync_file_range(fds[tab], offsets[tab], size, SYNC_FILE_RANGE_WRITE);
+    offsets[tab] += size;
+  }
+}
+
+static void write_blocking(const int tab, const int fd, char *data, const size_t size, off_t offset, const long page) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t n = pwrite(fd, &data[written], size - written, offset + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("ERROR writing page %li of TAB %i: %s\n", page, tab, strerror(errno));
+      return;
+    }
+    written += n;
+  }
+}
+
+static int buffer_index(char *data) {
+  if (! registered) {
+    return -1;
+  }
+  const int nbuffers = pipeline_nbuffers();
+  int b;
+  for (b = 0; b < nbuffers; b++) {
+    char *start = pipeline_buffer_data(b);
+    if (data >= start && data < start + pipeline_buffer_size()) {
+      return b;
+    }
+  }
+  return -1;
+}
+
+static void queue(writer_t *writer, const int r) {
+  request_t *request = &writer->requests[r];
+  request->iov.iov_base = request->data;
+  request->iov.iov_len = request->size;
+
+  while (uring_queue_write(&writer->ring, request->fd, request->data, request->size, request->offset,
+      request->buf_index, &request->iov, r) < 0) {
+    // submission queue full
+    uring_submit(&writer->ring, 0);
+  }
+}
+
+/**
+ * Wait for at least one completion, and handle all available completions
+ */
+static void reap(writer_t *writer) {
+  if (uring_submit(&writer->ring, 1) < 0) {
+    LOG("ERROR in io_uring_enter: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t r;
+  int res;
+  while (uring_next_completion(&writer->ring, &r, &res)) {
+    request_t *request = &writer->requests[r];
+
+    if (res == -EINTR || res == -EAGAIN) {
+      queue(writer, r);
+    } else if (res < 0) {
+      LOG("ERROR writing page %li of TAB %i: %s\n", request->page, request->tab, strerror(-res));
+      writer->nerrors++;
+      writer->free_list[writer->nfree++] = r;
+    } else if ((size_t) res < request->size) {
+      // short write, resubmit the remainder
+      writer->nshort++;
+      request->data += res;
+      request->size -= res;
+      request->offset += res;
+      queue(writer, r);
+    } else {
+      const double latency = metrics_now() - request->submitted;
+      metrics_write(request->tab, latency);
+      file_bytes[request->tab] += request->size;
+      file_seconds[request->tab] += latency;
+      writer->free_list[writer->nfree++] = r;
+    }
+  }
+}
+
+static void write_async(writer_t *writer, const int tab, const int fd, char *data, const size_t size, const off_t file_offset, const long page) {
+  const int buf_index = buffer_index(data);
+
+  size_t offset = 0;
+  while (offset < size) {
+    if (writer->nfree == 0) {
+      reap(writer);
+      continue;
+    }
+
+    const int r = writer->free_list[--writer->nfree];
+    request_t *request = &writer->requests[r];
+    request->tab = tab;
+    request->fd = fd;
+    request->data = &data[offset];
+    request->size = size - offset < OUTPUT_URING_CHUNK ? size - offset : OUTPUT_URING_CHUNK;
+    request->offset = file_offset + offset;
+    request->page = page;
+    request->buf_index = buf_index;
+    request->submitted = metrics_now();
+    queue(writer, r);
+
+    offset += request->size;
+  }
+
+  // start the writes, but do not wait for them
+  uring_submit(&writer->ring, 0);
+}
+
+/**
+ * Leave a gap of size bytes in the file of a TAB, for dropped data, which reads as zeros
+ *
+ * In direct mode, the gap continues the unaligned tail with zeros.
+ */
+static void skip(const int tab, const size_t size) {
+  if (direct && direct_fds[tab] >= 0) {
+    if (tail_sizes[tab] + size < OUTPUT_ALIGNMENT) {
+      memset(&tails[tab][tail_sizes[tab]], 0, size);
+      tail_sizes[tab] += size;
+    } else {
+      write_blocking(tab, fds[tab], tails[tab], tail_sizes[tab], offsets[tab] - tail_sizes[tab], -1);
+      tail_sizes[tab] = (offsets[tab] + size) % OUTPUT_ALIGNMENT;
+      memset(tails[tab], 0, tail_sizes[tab]);
+    }
+  }
+  offsets[tab] += size;
+}
+
+/**
+ * Write the unaligned tail of a TAB in direct mode, and stop using direct I/O for its file
+ */
+static void write_tail(const int tab) {
+  if (direct && direct_fds[tab] >= 0) {
+    write_blocking(tab, fds[tab], tails[tab], tail_sizes[tab], offsets[tab] - tail_sizes[tab], -1);
+    close(direct_fds[tab]);
+    direct_fds[tab] = -1;
+  }
+}
+
+/**
+ * Remove preallocated space after the end of the data of a TAB, or extend the file over a gap at the end
+ */
+static void truncate_file(const int tab) {
+  if (fds[tab] > 0 && allocated[tab] != offsets[tab]) {
+    if (ftruncate(fds[tab], offsets[tab]) != 0) {
+      LOG("ERROR truncating file for TAB %i: %s\n", tab, strerror(errno));
+    }
+    allocated[tab] = offsets[tab];
+  }
+}
+
+/**
+ * Finish the file of a TAB, after all writes to it are done, and close it with the close function
+ */
+static void finish_file(const int tab) {
+  write_tail(tab);
+  if (backend == OUTPUT_MMAP && maps[tab]) {
+    munmap(maps[tab], map_sizes[tab]);
+    maps[tab] = NULL;
+  }
+  truncate_file(tab);
+  close_segment(tab, fds[tab], file_bytes[tab], file_seconds[tab]);
+  fds[tab] = 0;
+  segments[tab] = 0;
+}
+
+/**
+ * Roll over to the file of the segment of a page, when the TAB is not in that segment yet
+ *
+ * @param {int} writer Writer thread of the TAB, to wait for its writes to the current file, or -1 for the mmap backend
+ */
+void output_segment(const int w, const int tab, const long page) {
+  if (! segment_pages || page / segment_pages == segments[tab]) {
+    return;
+  }
+  if (w >= 0) {
+    output_flush(w);
+  }
+  finish_file(tab);
+
+  segments[tab] = page / segment_pages;
+  if (open_segment(tab, segments[tab]) < 0) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Write a transposed TAB to its filterbank file, called from the writer threads
+ *
+ * @param {char *} data The TAB, or NULL for a gap
+ */
+void output_write(const int w, const int tab, char *data, const size_t size, const long page) {
+  output_segment(w, tab, page);
+  if (! data) {
+    // a gap of several pages can cross segments
+    long next = page + 1;
+    size_t left = size;
+    while (segment_pages && left > segment_size) {
+      skip(tab, segment_size);
+      left -= segment_size;
+      output_segment(w, tab, next++);
+    }
+    skip(tab, left);
+    return;
+  }
+
+  int fd = fds[tab];
+  off_t offset = offsets[tab];
+  size_t length = size;
+
+  if (direct && direct_fds[tab] >= 0) {
+    const size_t head = offset % OUTPUT_ALIGNMENT;
+    char *aligned = data - head;
+
+    if (((uintptr_t) aligned) % OUTPUT_ALIGNMENT == 0 && head == tail_sizes[tab]) {
+      // prepend the tail of the previous write, and keep the new unaligned tail for the next write
+      memcpy(aligned, tails[tab], head);
+      length = (head + size) / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT;
+      tail_sizes[tab] = head + size - length;
+      memcpy(tails[tab], &aligned[length], tail_sizes[tab]);
+
+      fd = direct_fds[tab];
+      data = aligned;
+      offset -= head;
+    } else {
+      // not aligned, write the pending tail and continue through the page cache
+      LOG("Warning: unaligned data for TAB %i, disabling direct I/O\n", tab);
+      write_blocking(tab, fds[tab], tails[tab], tail_sizes[tab], offset - tail_sizes[tab], page);
+      close(direct_fds[tab]);
+      direct_fds[tab] = -1;
+    }
+  }
+  offsets[tab] += size;
+
+  // allocate the next extent when we are in the last half of the current one
+  if (extent_size && offsets[tab] + extent_size / 2 > allocated[tab]) {
+    preallocate(tab, allocated[tab] + extent_size);
+  }
+
+  if (length == 0) {
+    return;
+  }
+  if (backend == OUTPUT_URING) {
+    write_async(&writers[w], tab, fd, data, length, offset, page);
+  } else {
+    const double start = metrics_now();
+    write_blocking(tab, fd, data, length, offset, page);
+    const double latency = metrics_now() - start;
+    metrics_write(tab, latency);
+    file_bytes[tab] += length;
+    file_seconds[tab] += latency;
+  }
+}
+
+/**
+ * Wait for all writes of a writer thread to complete
+ */
+void output_flush(const int w) {
+  if (backend != OUTPUT_URING) {
+    return;
+  }
+
+  writer_t *writer = &writers[w];
+  while (writer->nfree < OUTPUT_URING_DEPTH) {
+    reap(writer);
+  }
+}
+
+/**
+ * Write the unaligned tails in direct mode, and stop using direct I/O
+ */
+void output_write_tails() {
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    write_tail(tab);
+  }
+}
+
+/**
+ * Remove preallocated space after the end of the data, or extend the file over a gap at the end
+ */
+void output_truncate() {
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    truncate_file(tab);
+  }
+}
+
+/**
+ * Finish the files of an observation, call when all writes are done (after pipeline_drain or pipeline_finish)
+ *
+ * The files are closed with the close function of output_set_segments, or without it the file descriptors
+ * are left at the end of the data, for the caller to close.
+ * The backend can be given the files of the next observation with output_set_file.
+ */
+void output_close() {
+  int tab;
+  if (close_segment) {
+    for (tab = 0; tab < ntabs; tab++) {
+      if (fds[tab] > 0) {
+        finish_file(tab);
+      }
+    }
+    return;
+  }
+
+  output_write_tails();
+
+  if (backend == OUTPUT_MMAP) {
+    for (tab = 0; tab < ntabs; tab++) {
+      if (maps[tab]) {
+        munmap(maps[tab], map_sizes[tab]);
+        maps[tab] = NULL;
+      }
+    }
+  }
+  output_truncate();
+
+  // leave the file positions at the end of the data
+  for (tab = 0; tab < ntabs; tab++) {
+    if (fds[tab] > 0) {
+      lseek(fds[tab], offsets[tab], SEEK_SET);
+    }
+    fds[tab] = 0;
+  }
+}
+
+/**
+ * Stop the output backend, call after pipeline_finish
+ */
+void output_finish() {
+  output_close();
+
+  if (backend == OUTPUT_MMAP) {
+    free(bases);
+    free(windows);
+    free(maps);
+    free(map_offsets);
+    free(map_sizes);
+  }
+  free(segments);
+  free(file_bytes);
+  free(file_seconds);
+
+  if (writers) {
+    long nshort = 0, nerrors = 0;
+    int w;
+    for (w = 0; w < nwriters; w++) {
+      nshort += writers[w].nshort;
+      nerrors += writers[w].nerrors;
+      uring_exit(&writers[w].ring);
+    }
+    LOG("io_uring: %li short writes, %li failed writes\n", nshort, nerrors);
+    free(writers);
+    writers = NULL;
+  }
+
+  if (direct) {
+    int tab;
+    for (tab = 0; tab < ntabs; tab++) {
+      free(tails[tab]);
+    }
+    free(tails);
+    free(tail_sizes);
+    free(direct_fds);
+  }
+  free(fds);
+  free(offsets);
+  free(allocated);
+  free(unallocatable);
+}
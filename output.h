@@ -0,0 +1,51 @@
+#ifndef __HAVE_OUTPUT_H__
+#define __HAVE_OUTPUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+  OUTPUT_WRITE, // blocking write() calls
+  OUTPUT_URING, // asynchronous writes using io_uring
+  OUTPUT_MMAP   // transpose directly into memory mapped files
+} output_backend_t;
+
+// Alignment of file offsets, sizes, and memory for direct I/O
+#define OUTPUT_ALIGNMENT 4096
+
+// Size of the individual io_uring write requests, and the number in flight per writer thread
+#define OUTPUT_URING_CHUNK (4 * 1024 * 1024)
+#define OUTPUT_URING_DEPTH 64
+
+/**
+ * Create the file of a segment of a TAB, and set it with output_set_file
+ *
+ * @returns {int} 0 on success, -1 when no file could be created
+ */
+typedef int (*output_open_t)(const int tab, const long segment);
+
+/**
+ * Close the file of a TAB, with the bytes written to it and the time spent writing them
+ */
+typedef void (*output_close_t)(const int tab, const int fd, const uint64_t bytes, const double seconds);
+
+extern int output_backend_parse(const char *name, output_backend_t *backend);
+extern const char *output_backend_name(const output_backend_t backend);
+
+extern output_backend_t output_init(const output_backend_t backend, const int ntabs, const int nwriters, const int direct);
+extern void output_set_preallocation(const off_t size, const off_t extent);
+extern void output_set_segments(const long npages, const size_t size, output_open_t open, output_close_t close);
+extern void output_set_file(const int tab, const int fd, const char *file_name, const char *header, const int header_size);
+extern size_t output_page_offset(const long page, const size_t size);
+extern void output_set_window(const int npages);
+extern void output_map_page(const long page, const size_t size, char **tabs);
+extern void output_page_done(const long page, const size_t size);
+extern void output_segment(const int writer, const int tab, const long page);
+extern void output_write(const int writer, const int tab, char *data, const size_t size, const long page);
+extern void output_flush(const int writer);
+extern void output_write_tails();
+extern void output_truncate();
+extern void output_close();
+extern void output_finish();
+#endif
@@ -0,0 +1,136 @@
+/**
+ * Degradation policy for when the output cannot keep up with the ringbuffer.
+ *
+ * When the ringbuffer fill passes the high watermark, pages are dropped, or only some of the TABs are written,
+ * until the fill is back below the low watermark. Dropped data leaves a gap of zeros in the filterbank files,
+ * so the samples after it stay at the right time.
+ *
+ * Every degraded page is recorded in a sidecar text file per observation, one line per page:
+ *
+ *   <page> <time since the start in seconds> <full pages>/<pages in the ringbuffer> dropped
+ *   <page> <time since the start in seconds> <full pages>/<pages in the ringbuffer> tabs <TABs written>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "log.h"
+#include "overload.h"
+
+static overload_policy_t policy = OVERLOAD_OFF;
+static int *keep = NULL;  // TABs written under OVERLOAD_TABS
+static int nkeep;
+static char kept[256];    // the same, as text
+static int high, low;     // watermarks in percent
+static int overloaded;
+static long ndegraded;    // degraded pages in the observation
+static FILE *record = NULL;
+
+/**
+ * Set the policy
+ *
+ * @param {int *} tabs TABs to keep writing with OVERLOAD_TABS
+ * @param {int} high Start degrading when this percentage of the ringbuffer is full
+ * @param {int} low Stop degrading when at most this percentage is full
+ */
+void overload_init(const overload_policy_t policy_, const int *tabs, const int ntabs, const int high_, const int low_) {
+  policy = policy_;
+  high = high_;
+  low = low_;
+
+  free(keep);
+  keep = malloc((ntabs > 0 ? ntabs : 1) * sizeof(int));
+  memcpy(keep, tabs, ntabs * sizeof(int));
+  nkeep = ntabs;
+
+  kept[0] = '\0';
+  int i;
+  for (i = 0; i < nkeep; i++) {
+    const size_t n = strlen(kept);
+    snprintf(&kept[n], sizeof(kept) - n, i ? ",%i" : "%i", keep[i]);
+  }
+}
+
+/**
+ * Create the sidecar file recording the degraded pages of an observation
+ *
+ * @returns {int} 0 on success, -1 on failure
+ */
+int overload_open(const char *file_name) {
+  overloaded = 0;
+  ndegraded = 0;
+  record = fopen(file_name, "w");
+  if (! record) {
+    LOG("ERROR: cannot create %s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+  fprintf(record, "# page, time (s), ringbuffer full/size, data written\n");
+  fflush(record);
+  return 0;
+}
+
+/**
+ * Decide how to process a page, from the ringbuffer fill
+ *
+ * @param {long} page Page number in the observation
+ * @param {double} time Start of the page in seconds since the start of the observation
+ * @returns {overload_policy_t} OVERLOAD_OFF to process the page normally, or the degradation to apply
+ */
+overload_policy_t overload_check(const long page, const double time, const uint64_t nfull, const uint64_t nbufs) {
+  if (policy == OVERLOAD_OFF || nbufs == 0) {
+    return OVERLOAD_OFF;
+  }
+
+  const int percent = (int) (100 * nfull / nbufs);
+  if (! overloaded && percent >= high) {
+    overloaded = 1;
+    if (policy == OVERLOAD_DROP) {
+      LOG("Ringbuffer %lu/%lu full at page %li, dropping pages\n", nfull, nbufs, page);
+    } else {
+      LOG("Ringbuffer %lu/%lu full at page %li, writing only TABs %s\n", nfull, nbufs, page, kept);
+    }
+  } else if (overloaded && percent <= low) {
+    overloaded = 0;
+    LOG("Ringbuffer %lu/%lu full at page %li, writing all data again\n", nfull, nbufs, page);
+  }
+  if (! overloaded) {
+    return OVERLOAD_OFF;
+  }
+
+  ndegraded++;
+  if (record) {
+    if (policy == OVERLOAD_DROP) {
+      fprintf(record, "%li %.6f %lu/%lu dropped\n", page, time, nfull, nbufs);
+    } else {
+      fprintf(record, "%li %.6f %lu/%lu tabs %s\n", page, time, nfull, nbufs, kept);
+    }
+    fflush(record);
+  }
+  return policy;
+}
+
+/**
+ * Is a TAB written while degrading with OVERLOAD_TABS
+ */
+int overload_keep(const int tab) {
+  int i;
+  for (i = 0; i < nkeep; i++) {
+    if (keep[i] == tab) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Close the sidecar file of the observation
+ */
+void overload_close() {
+  if (! record) {
+    return;
+  }
+  fclose(record);
+  record = NULL;
+  if (ndegraded) {
+    LOG("Warning: %li pages %s\n", ndegraded, policy == OVERLOAD_DROP ? "dropped" : "written with fewer TABs");
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef __HAVE_OVERLOAD_H__
+#define __HAVE_OVERLOAD_H__
+
+#include <stdint.h>
+
+typedef enum {
+  OVERLOAD_OFF,  // write everything
+  OVERLOAD_DROP, // drop whole pages, leaving a gap in the files
+  OVERLOAD_TABS  // write only some of the TABs, leaving a gap in the files of the others
+} overload_policy_t;
+
+// Default watermarks, in percent of the ringbuffer
+#define OVERLOAD_HIGH 80
+#define OVERLOAD_LOW 50
+
+extern void overload_init(const overload_policy_t policy, const int *tabs, const int ntabs, const int high, const int low);
+extern int overload_open(const char *file_name);
+extern overload_policy_t overload_check(const long page, const double time, const uint64_t nfull, const uint64_t nbufs);
+extern int overload_keep(const int tab);
+extern void overload_close();
+#endif
@@ -0,0 +1,253 @@
+/**
+ * Three stage pipeline: reader / transposer / writers.
+ *
+ * The main thread reads a page from the ringbuffer, transposes it into a buffer from a small pool,
+ * releases the ringbuffer page, and submits the buffer to the writer threads.
+ * Disk I/O is done by dedicated writer threads, so slow disks no longer keep ringbuffer pages locked.
+ *
+ * Writer w handles the TABs tab % nwriters == w, and processes buffers in submission order.
+ * A buffer is returned to the pool when all writers are done with it.
+ * The buffers are allocated with memory_alloc, so they are touched by the openMP threads that transpose into them.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "memory.h"
+#include "pipeline.h"
+
+static pipeline_buffer_t *buffers;
+static int nbuffers;
+static int nwriters;
+static int ntabs;
+static size_t tab_size;
+static size_t tab_stride;
+static pipeline_write_t write_tab;
+static pipeline_flush_t flush;
+
+static pthread_t *writers;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t submitted_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static long nacquired;  // buffers given to the transposer
+static long nsubmitted; // buffers given to the writers
+static long *ndone;     // buffers finished, per writer
+static int finishing;
+
+// call with the lock held
+static long min_done() {
+  long done = ndone[0];
+  int w;
+  for (w = 1; w < nwriters; w++) {
+    if (ndone[w] < done) {
+      done = ndone[w];
+    }
+  }
+  return done;
+}
+
+static void *writer_thread(void *arg) {
+  const int w = (int) (long) arg;
+
+  while (1) {
+    // read the position under the lock, pipeline_drain can restart the numbering
+    pthread_mutex_lock(&lock);
+    while (ndone[w] >= nsubmitted && !finishing) {
+      pthread_cond_wait(&submitted_cond, &lock);
+    }
+    if (ndone[w] >= nsubmitted) {
+      // finishing, and all buffers are written
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+    long next = ndone[w];
+    pthread_mutex_unlock(&lock);
+
+    pipeline_buffer_t *buffer = &buffers[next % nbuffers];
+    int tab;
+    for (tab = w; tab < ntabs; tab += nwriters) {
+      if (buffer->skipped) {
+        write_tab(w, tab, NULL, buffer->skipped * tab_size, buffer->page - buffer->skipped);
+      }
+      write_tab(w, tab, buffer->tabs[tab], tab_size, buffer->page);
+    }
+    if (flush) {
+      flush(w);
+    }
+    next++;
+
+    pthread_mutex_lock(&lock);
+    ndone[w] = next;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Allocate the buffer pool and start the writer threads
+ *
+ * @param {int} nbuffers Number of buffers in the pool
+ * @param {int} nwriters Number of writer threads, at most ntabs are used
+ * @param {size_t} tab_size Size in bytes of a transposed TAB
+ * @param {size_t} tab_stride Size in bytes of the region per TAB, at least tab_size
+ * @param {pipeline_write_t} write_tab Function to write a single TAB
+ * @param {pipeline_flush_t} flush Function to wait for outstanding writes, can be NULL
+ */
+void pipeline_init(
+    const int nbuffers_,
+    const int nwriters_,
+    const int ntabs_,
+    const size_t tab_size_,
+    const size_t tab_stride_,
+    pipeline_write_t write_tab_,
+    pipeline_flush_t flush_) {
+
+  nbuffers = nbuffers_;
+  nwriters = nwriters_ < ntabs_ ? nwriters_ : ntabs_;
+  ntabs = ntabs_;
+  tab_size = tab_size_;
+  tab_stride = (tab_stride_ + PIPELINE_ALIGNMENT - 1) / PIPELINE_ALIGNMENT * PIPELINE_ALIGNMENT;
+  write_tab = write_tab_;
+  flush = flush_;
+
+  nacquired = 0;
+  nsubmitted = 0;
+  finishing = 0;
+
+  buffers = calloc(nbuffers, sizeof(pipeline_buffer_t));
+  int b;
+  for (b = 0; b < nbuffers; b++) {
+    buffers[b].data = memory_alloc(ntabs * tab_stride, ntabs * tab_stride, "transpose buffers");
+    buffers[b].tabs = calloc(ntabs, sizeof(char *));
+  }
+
+  ndone = calloc(nwriters, sizeof(long));
+  writers = calloc(nwriters, sizeof(pthread_t));
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    if (pthread_create(&writers[w], NULL, writer_thread, (void *) (long) w) != 0) {
+      fprintf(stderr, "Error: cannot start writer thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * Get an empty buffer to transpose a page into, blocks while all buffers are being written
+ *
+ * @param {long} page Page number in the observation
+ */
+pipeline_buffer_t *pipeline_get_buffer(const long page) {
+  pthread_mutex_lock(&lock);
+  while (nacquired - min_done() >= nbuffers) {
+    pthread_cond_wait(&done_cond, &lock);
+  }
+  pipeline_buffer_t *buffer = &buffers[nacquired % nbuffers];
+  buffer->page = page;
+  buffer->skipped = 0;
+  nacquired++;
+  pthread_mutex_unlock(&lock);
+
+  pipeline_set_offset(buffer, 0);
+  return buffer;
+}
+
+/**
+ * Place the transposed TABs at an offset from the start of their regions
+ *
+ * @param {size_t} offset Offset in bytes, tab_size + offset should not exceed tab_stride
+ */
+void pipeline_set_offset(pipeline_buffer_t *buffer, const size_t offset) {
+  int tab;
+  for (tab = 0; tab < ntabs; tab++) {
+    buffer->tabs[tab] = &buffer->data[tab * tab_stride + offset];
+  }
+}
+
+/**
+ * Hand a filled buffer to the writers
+ *
+ * The writers take the buffers in the order they were acquired, so they must be submitted in that order.
+ */
+void pipeline_submit(pipeline_buffer_t *buffer) {
+  pthread_mutex_lock(&lock);
+  if (nsubmitted == nacquired || buffer != &buffers[nsubmitted % nbuffers]) {
+    fprintf(stderr, "Error: buffer for page %li submitted out of order\n", buffer->page);
+    exit(EXIT_FAILURE);
+  }
+  nsubmitted++;
+  pthread_cond_broadcast(&submitted_cond);
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Number of buffers not in use by the transposer or writers
+ */
+int pipeline_nfree() {
+  pthread_mutex_lock(&lock);
+  int nfree = nbuffers - (int) (nacquired - min_done());
+  pthread_mutex_unlock(&lock);
+
+  return nfree;
+}
+
+int pipeline_nwriters() {
+  return nwriters;
+}
+
+int pipeline_nbuffers() {
+  return nbuffers;
+}
+
+char *pipeline_buffer_data(const int index) {
+  return buffers[index].data;
+}
+
+size_t pipeline_buffer_size() {
+  return ntabs * tab_stride;
+}
+
+/**
+ * Wait until all submitted buffers are written, keeping the writers and the pool
+ *
+ * The pages of the next buffers are numbered from 0 again, for the next observation.
+ */
+void pipeline_drain() {
+  pthread_mutex_lock(&lock);
+  while (min_done() < nsubmitted) {
+    pthread_cond_wait(&done_cond, &lock);
+  }
+  nacquired = 0;
+  nsubmitted = 0;
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    ndone[w] = 0;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Wait until all submitted buffers are written, then stop the writers and free the pool
+ */
+void pipeline_finish() {
+  pthread_mutex_lock(&lock);
+  finishing = 1;
+  pthread_cond_broadcast(&submitted_cond);
+  pthread_mutex_unlock(&lock);
+
+  int w;
+  for (w = 0; w < nwriters; w++) {
+    pthread_join(writers[w], NULL);
+  }
+
+  int b;
+  for (b = 0; b < nbuffers; b++) {
+    memory_free(buffers[b].data, ntabs * tab_stride);
+    free(buffers[b].tabs);
+  }
+  free(buffers);
+  free(ndone);
+  free(writers);
+}
@@ -0,0 +1,57 @@
+#ifndef __HAVE_PIPELINE_H__
+#define __HAVE_PIPELINE_H__
+
+#include <stddef.h>
+
+// Alignment of the buffers and of the per TAB regions within them, suitable for O_DIRECT
+#define PIPELINE_ALIGNMENT 4096
+
+/**
+ * A transposed page, owned by either the transposer or the writers
+ *
+ * Every TAB has its own aligned region of tab_stride bytes in data, and the transposed TAB [ntimes, nchannels]
+ * starts at tabs[tab], at a (page dependent) offset from the start of its region.
+ * A TAB set to NULL, and the pages skipped before this one, are written as a gap (see pipeline_write_t).
+ */
+typedef struct {
+  char *data;
+  char **tabs;
+  long page;    // page number in the observation
+  long skipped; // pages dropped before this one
+} pipeline_buffer_t;
+
+/**
+ * Write the data of a single TAB, called from writer thread 'writer'
+ *
+ * Calls for the same TAB are always made from the same thread, in page order.
+ * The data stays valid until the flush function has been called by the same writer.
+ * Data is NULL for a gap of size bytes, for dropped data.
+ */
+typedef void (*pipeline_write_t)(const int writer, const int tab, char *data, const size_t size, const long page);
+
+/**
+ * Called by a writer thread when it has written all its TABs of a buffer, can be NULL
+ */
+typedef void (*pipeline_flush_t)(const int writer);
+
+extern void pipeline_init(
+    const int nbuffers,
+    const int nwriters,
+    const int ntabs,
+    const size_t tab_size,
+    const size_t tab_stride,
+    pipeline_write_t write_tab,
+    pipeline_flush_t flush);
+
+extern pipeline_buffer_t *pipeline_get_buffer(const long page);
+extern void pipeline_set_offset(pipeline_buffer_t *buffer, const size_t offset);
+extern void pipeline_submit(pipeline_buffer_t *buffer);
+extern void pipeline_drain();
+extern void pipeline_finish();
+
+extern int pipeline_nfree();
+extern int pipeline_nwriters();
+extern int pipeline_nbuffers();
+extern char *pipeline_buffer_data(const int index);
+extern size_t pipeline_buffer_size();
+#endif
@@ -0,0 +1,167 @@
+/**
+ * Bandpass statistics of the input, computed during the transpose (see deinterleave_stats_t),
+ * written per page to a sidecar file per TAB, and summarized per TAB in the metrics.
+ *
+ * A sidecar file starts with two 32 bit integers: the number of channels, and the samples per page.
+ * Then follows a record per page: the page number (64 bit integer), and per channel the mean and the standard
+ * deviation (32 bit floats) and the number of samples at 0 or 255 (32 bit integers), in the channel order
+ * of the filterbank file. Everything is in the native (little endian) byte order.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "metrics.h"
+#include "stats.h"
+
+static int nselected;
+static int *selected;
+static int nchannels;
+static int ntimes;
+static deinterleave_stats_t *stats; // per TAB in the page
+static int *fds;                    // per selected TAB
+static char *record;
+static size_t record_size;
+
+/**
+ * Allocate the statistics for the selected TABs
+ *
+ * @param {int *} selected The TABs in the page to compute statistics for
+ * @param {int} ntabs Number of TABs in the page
+ * @returns {deinterleave_stats_t *} Statistics per TAB in the page, for deinterleave_stages_t
+ */
+deinterleave_stats_t *stats_init(const int nselected_, const int *selected_, const int ntabs, const int nchannels_, const int ntimes_) {
+  nselected = nselected_;
+  nchannels = nchannels_;
+  ntimes = ntimes_;
+  selected = malloc(nselected * sizeof(int));
+  memcpy(selected, selected_, nselected * sizeof(int));
+
+  stats = calloc(ntabs, sizeof(deinterleave_stats_t));
+  int i;
+  for (i = 0; i < nselected; i++) {
+    deinterleave_stats_t *s = &stats[selected[i]];
+    s->sum = calloc(nchannels, sizeof(uint64_t));
+    s->sum2 = calloc(nchannels, sizeof(uint64_t));
+    s->clipped = calloc(nchannels, sizeof(uint64_t));
+  }
+
+  fds = malloc(nselected * sizeof(int));
+  for (i = 0; i < nselected; i++) {
+    fds[i] = -1;
+  }
+  record_size = sizeof(int64_t) + nchannels * (2 * sizeof(float) + sizeof(uint32_t));
+  record = malloc(record_size);
+
+  return stats;
+}
+
+static int write_all(const int fd, const char *data, const size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t n = write(fd, &data[written], size - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    written += n;
+  }
+  return 0;
+}
+
+/**
+ * Create the sidecar file of a selected TAB
+ *
+ * @param {int} tab Index in the selected TABs
+ * @returns {int} 0 on success, -1 on failure
+ */
+int stats_open(const int tab, const char *file_name) {
+  fds[tab] = open(file_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  const int32_t shape[2] = {nchannels, ntimes};
+  if (fds[tab] < 0 || write_all(fds[tab], (const char *) shape, sizeof(shape)) < 0) {
+    LOG("ERROR: cannot create %s: %s\n", file_name, strerror(errno));
+    if (fds[tab] >= 0) {
+      close(fds[tab]);
+      fds[tab] = -1;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Write the statistics of a transposed page, and update the metrics
+ *
+ * @param {char **} tabs The output per TAB in the page given to deinterleave_page, TABs set to NULL are skipped
+ */
+void stats_page(const long page, char * const *tabs) {
+  const double n = ntimes;
+  int i;
+  for (i = 0; i < nselected; i++) {
+    if (! tabs[selected[i]]) {
+      continue;
+    }
+    const deinterleave_stats_t *s = &stats[selected[i]];
+    int64_t *number = (int64_t *) record;
+    float *means = (float *) &record[sizeof(int64_t)];
+    float *sigmas = &means[nchannels];
+    uint32_t *clipped = (uint32_t *) &sigmas[nchannels];
+
+    uint64_t sum = 0, sum2 = 0, nclipped = 0;
+    int c;
+    for (c = 0; c < nchannels; c++) {
+      const double mean = s->sum[c] / n;
+      const double variance = s->sum2[c] / n - mean * mean;
+      means[c] = mean;
+      sigmas[c] = variance > 0 ? sqrt(variance) : 0;
+      clipped[c] = s->clipped[c];
+      sum += s->sum[c];
+      sum2 += s->sum2[c];
+      nclipped += s->clipped[c];
+    }
+    *number = page;
+
+    const double mean = sum / (n * nchannels);
+    const double variance = sum2 / (n * nchannels) - mean * mean;
+    metrics_bandpass(i, mean, variance > 0 ? sqrt(variance) : 0, nclipped);
+
+    if (fds[i] >= 0 && write_all(fds[i], record, record_size) < 0) {
+      LOG("ERROR writing statistics of page %li of TAB %i: %s\n", page, selected[i], strerror(errno));
+    }
+  }
+}
+
+/**
+ * Close the sidecar files of the observation
+ */
+void stats_close() {
+  int i;
+  for (i = 0; i < nselected; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
+
+void stats_finish() {
+  stats_close();
+  int i;
+  for (i = 0; i < nselected; i++) {
+    deinterleave_stats_t *s = &stats[selected[i]];
+    free(s->sum);
+    free(s->sum2);
+    free(s->clipped);
+  }
+  free(stats);
+  free(selected);
+  free(fds);
+  free(record);
+}
@@ -0,0 +1,11 @@
+#ifndef __HAVE_STATS_H__
+#define __HAVE_STATS_H__
+
+#include "deinterleave.h"
+
+extern deinterleave_stats_t *stats_init(const int nselected, const int *selected, const int ntabs, const int nchannels, const int ntimes);
+extern int stats_open(const int tab, const char *file_name);
+extern void stats_page(const long page, char * const *tabs);
+extern void stats_close();
+extern void stats_finish();
+#endif
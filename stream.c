@@ -0,0 +1,459 @@
+/**
+ * Streaming of the transposed TABs, next to or instead of the filterbank files.
+ *
+ * TCP: every selected TAB has its own connection, to the given port plus the TAB number. The stream of a TAB
+ * is a filterbank file: the SIGPROC header followed by the [time, channel] data, with zeros for dropped data.
+ * The connections are made at the start of every observation, and closed at its end.
+ * The data is sent with MSG_ZEROCOPY, straight from the transpose buffers: the writer thread waits for the
+ * kernel to release the pages of a buffer in stream_flush, before the buffer is reused (see pipeline.h).
+ * When the socket does not support it, the data is copied by a normal send.
+ *
+ * PSRdada: every selected TAB is written to its own ringbuffer, given by a list of keys. Every observation
+ * gets a header block (the input header, describing the TAB) and the data in [time, channel] order,
+ * and is ended with an end of data. Writing into the ringbuffer copies the data.
+ *
+ * Both block the writer thread when the receiver does not keep up, so the ringbuffer of the input fills up
+ * and the overload policy applies (see overload.c). A stream that breaks is stopped, the files are still written.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include "dada_hdu.h"
+#include "log.h"
+#include "metrics.h"
+#include "stream.h"
+
+// Seconds to wait for the kernel to release the pages of a zero-copy send
+#define STREAM_TIMEOUT 10
+
+typedef struct {
+  int tab;
+  int fd;             // socket, -1 when not connected
+  int zerocopy;       // the socket accepted SO_ZEROCOPY
+  uint32_t sent;      // zero-copy sends, the kernel numbers them from 0
+  uint32_t completed; // zero-copy sends of which the kernel released the pages
+  uint64_t copied;    // completions for which the kernel copied the data after all
+  uint64_t bytes;
+  dada_hdu_t *hdu;
+  int locked;         // the ringbuffer is locked for writing
+} stream_t;
+
+static stream_sink_t sink = STREAM_NONE;
+static char host[256];
+static int port;
+static key_t *keys = NULL;
+static int nkeys = 0;
+
+static int ntabs;
+static int nwriters;
+static size_t tab_size;
+static char *zeros = NULL;
+static stream_t *streams = NULL;
+
+/**
+ * Parse the sink, tcp:<host>:<port> or dada:<key>[,<key>...] with hexadecimal keys
+ *
+ * @returns {int} 0 on success, -1 for an illegal sink
+ */
+int stream_parse(const char *spec) {
+  if (strncmp(spec, "tcp:", 4) == 0) {
+    const char *name = &spec[4];
+    const char *colon = strrchr(name, ':');
+    if (! colon || colon == name || colon - name >= (long) sizeof(host)) {
+      return -1;
+    }
+    memcpy(host, name, colon - name);
+    host[colon - name] = '\0';
+    port = atoi(colon + 1);
+    if (port < 1 || port > 65535) {
+      return -1;
+    }
+    sink = STREAM_TCP;
+    return 0;
+  }
+
+  if (strncmp(spec, "dada:", 5) == 0) {
+    const char *c;
+    nkeys = 1;
+    for (c = &spec[5]; *c; c++) {
+      nkeys += *c == ',';
+    }
+    keys = calloc(nkeys, sizeof(key_t));
+    c = &spec[5];
+    int k;
+    for (k = 0; k < nkeys; k++) {
+      unsigned int key;
+      int length;
+      if (sscanf(c, "%x%n", &key, &length) != 1 || (c[length] != ',' && c[length] != '\0')) {
+        return -1;
+      }
+      keys[k] = (key_t) key;
+      c += length + 1;
+    }
+    sink = STREAM_DADA;
+    return 0;
+  }
+
+  return -1;
+}
+
+stream_sink_t stream_sink() {
+  return sink;
+}
+
+const char *stream_sink_name(const stream_sink_t sink) {
+  return sink == STREAM_TCP ? "TCP" : sink == STREAM_DADA ? "PSRdada" : "none";
+}
+
+/**
+ * Set up the streams of the selected TABs, and connect to the output ringbuffers
+ *
+ * @param {int} ntabs Number of selected TABs
+ * @param {int} nwriters Number of writer threads, every writer handles the TABs tab % nwriters == w
+ * @param {size_t} tab_size Size in bytes of a transposed TAB
+ */
+void stream_init(const int ntabs_, const int nwriters_, const size_t tab_size_) {
+  ntabs = ntabs_;
+  nwriters = nwriters_;
+  tab_size = tab_size_;
+
+  zeros = calloc(1, tab_size);
+  streams = calloc(ntabs, sizeof(stream_t));
+  if (! zeros || ! streams) {
+    LOG("ERROR: cannot allocate memory for streaming\n");
+    exit(EXIT_FAILURE);
+  }
+  int slot;
+  for (slot = 0; slot < ntabs; slot++) {
+    streams[slot].fd = -1;
+  }
+
+  if (sink == STREAM_DADA) {
+    if (nkeys < ntabs) {
+      LOG("ERROR: %i ringbuffer keys for %i TABs\n", nkeys, ntabs);
+      exit(EXIT_FAILURE);
+    }
+    for (slot = 0; slot < ntabs; slot++) {
+      streams[slot].hdu = dada_hdu_create(NULL);
+      dada_hdu_set_key(streams[slot].hdu, keys[slot]);
+      if (dada_hdu_connect(streams[slot].hdu) < 0) {
+        LOG("ERROR: cannot connect to the output ringbuffer %x\n", keys[slot]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    LOG("Stream: %i PSRdada ringbuffers\n", ntabs);
+  } else {
+    LOG("Stream: TCP to %s, ports %i + TAB\n", host, port);
+  }
+}
+
+/**
+ * Connect to the receiver of a TAB, and turn on zero-copy sends when the socket supports them
+ *
+ * @returns {int} The socket, or -1 on failure
+ */
+static int connect_tab(const int tab, int *zerocopy) {
+  char service[16];
+  snprintf(service, sizeof(service), "%i", port + tab);
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  const int error = getaddrinfo(host, service, &hints, &addresses);
+  if (error != 0) {
+    LOG("Warning: cannot resolve %s: %s\n", host, gai_strerror(error));
+    return -1;
+  }
+
+  int fd = -1;
+  struct addrinfo *address;
+  for (address = addresses; address; address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    LOG("Warning: cannot connect to %s port %s: %s, stream of TAB %i stopped\n", host, service, strerror(errno), tab);
+    return -1;
+  }
+
+  *zerocopy = 0;
+#ifdef SO_ZEROCOPY
+  const int one = 1;
+  *zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+  return fd;
+}
+
+/**
+ * Stop a broken stream, the files are still written
+ */
+static void stop(stream_t *stream, const char *reason) {
+  LOG("Warning: stream of TAB %i %s, stopped\n", stream->tab, reason);
+  close(stream->fd);
+  stream->fd = -1;
+}
+
+/**
+ * Read the zero-copy completions from the error queue of the socket
+ */
+static void read_completions(stream_t *stream) {
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+  while (1) {
+    char control[128];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(stream->fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      return;
+    }
+
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+      const struct sock_extended_err *error = (struct sock_extended_err *) CMSG_DATA(cmsg);
+      if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // a range of sends, from ee_info to ee_data
+      const uint32_t n = error->ee_data - error->ee_info + 1;
+      stream->completed += n;
+      if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        stream->copied += n;
+      }
+    }
+  }
+#endif
+}
+
+/**
+ * Wait until the kernel released the pages of the zero-copy sends of a stream
+ *
+ * @param {int} all Wait for all sends, or for at least one
+ * @returns {int} 0 on success, -1 when the kernel did not release them in time
+ */
+static int wait_completions(stream_t *stream, const int all) {
+  const uint32_t outstanding = stream->sent - stream->completed;
+  const double start = metrics_now();
+  while (stream->completed != stream->sent) {
+    read_completions(stream);
+    if (stream->completed == stream->sent || (! all && stream->sent - stream->completed < outstanding)) {
+      break;
+    }
+    if (metrics_now() - start > STREAM_TIMEOUT) {
+      return -1;
+    }
+    struct pollfd pfd = {.fd = stream->fd, .events = 0};
+    poll(&pfd, 1, 100);
+  }
+  return 0;
+}
+
+/**
+ * Send all data to a stream
+ *
+ * @param {int} zerocopy Send without copying, the data has to stay valid until stream_flush
+ * @returns {int} 0 on success, -1 on failure
+ */
+static int send_all(stream_t *stream, const char *data, size_t size, int zerocopy) {
+  while (size > 0) {
+    int flags = MSG_NOSIGNAL;
+#ifdef MSG_ZEROCOPY
+    flags |= zerocopy ? MSG_ZEROCOPY : 0;
+#endif
+    const ssize_t n = send(stream->fd, data, size, flags);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS && zerocopy) {
+        // too many pages pinned, wait for the kernel to release some, or copy
+        if (stream->sent == stream->completed || wait_completions(stream, 0) < 0) {
+          zerocopy = 0;
+        }
+        continue;
+      }
+      return -1;
+    }
+    stream->sent += zerocopy;
+    stream->bytes += n;
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+/**
+ * Start the stream of a selected TAB for an observation: connect and send the filterbank header,
+ * or write the header block to its ringbuffer. A stream that cannot be started stays stopped.
+ *
+ * @param {int} slot Index of the TAB in the selected TABs
+ * @param {int} tab TAB number, for the port
+ * @param {char *} header Filterbank header for TCP, or the PSRdada header text
+ * @returns {int} 0 on success, -1 when the stream is stopped
+ */
+int stream_open(const int slot, const int tab, const char *header, const size_t header_size) {
+  stream_t *stream = &streams[slot];
+  stream->tab = tab;
+  stream->sent = 0;
+  stream->completed = 0;
+  stream->copied = 0;
+  stream->bytes = 0;
+
+  if (sink == STREAM_DADA) {
+    if (dada_hdu_lock_write(stream->hdu) < 0) {
+      LOG("Warning: cannot lock the output ringbuffer %x for writing, stream of TAB %i stopped\n", keys[slot], tab);
+      return -1;
+    }
+    stream->locked = 1;
+
+    const uint64_t bufsz = ipcbuf_get_bufsz(stream->hdu->header_block);
+    char *block = ipcbuf_get_next_write(stream->hdu->header_block);
+    if (! block || header_size > bufsz) {
+      LOG("Warning: cannot write a header of %zu bytes to the output ringbuffer %x, stream of TAB %i stopped\n",
+          header_size, keys[slot], tab);
+      dada_hdu_unlock_write(stream->hdu);
+      stream->locked = 0;
+      return -1;
+    }
+    memset(block, 0, bufsz);
+    memcpy(block, header, header_size);
+    if (ipcbuf_mark_filled(stream->hdu->header_block, bufsz) < 0) {
+      LOG("Warning: cannot write the header block to the output ringbuffer %x, stream of TAB %i stopped\n", keys[slot], tab);
+      dada_hdu_unlock_write(stream->hdu);
+      stream->locked = 0;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (port + tab > 65535) {
+    LOG("Warning: no port for TAB %i, stream stopped\n", tab);
+    return -1;
+  }
+  stream->fd = connect_tab(tab, &stream->zerocopy);
+  if (stream->fd < 0) {
+    return -1;
+  }
+  if (send_all(stream, header, header_size, 0) < 0) {
+    stop(stream, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Stream a transposed TAB, called from the writer threads like output_write
+ *
+ * @param {char *} data The TAB, or NULL for a gap that is sent as zeros
+ */
+void stream_write(const int w, const int slot, char *data, const size_t size, const long page) {
+  stream_t *stream = &streams[slot];
+  size_t left = size;
+
+  if (sink == STREAM_DADA) {
+    while (stream->locked && left > 0) {
+      const size_t n = data ? left : (left < tab_size ? left : tab_size);
+      if (ipcio_write(stream->hdu->data_block, data ? data : zeros, n) < 0) {
+        LOG("Warning: cannot write page %li of TAB %i to the output ringbuffer, stopped\n", page, stream->tab);
+        dada_hdu_unlock_write(stream->hdu);
+        stream->locked = 0;
+        return;
+      }
+      stream->bytes += n;
+      left -= n;
+    }
+    return;
+  }
+
+  if (stream->fd < 0) {
+    return;
+  }
+  if (data) {
+    if (send_all(stream, data, size, stream->zerocopy) < 0) {
+      stop(stream, strerror(errno));
+    }
+    return;
+  }
+  while (left > 0) {
+    const size_t n = left < tab_size ? left : tab_size;
+    if (send_all(stream, zeros, n, 0) < 0) {
+      stop(stream, strerror(errno));
+      return;
+    }
+    left -= n;
+  }
+}
+
+/**
+ * Wait for the zero-copy sends of a writer, so its buffer can be reused
+ */
+void stream_flush(const int w) {
+  int slot;
+  for (slot = w; slot < ntabs; slot += nwriters) {
+    stream_t *stream = &streams[slot];
+    if (stream->fd >= 0 && stream->sent != stream->completed && wait_completions(stream, 1) < 0) {
+      stop(stream, "is not released by the kernel");
+    }
+  }
+}
+
+/**
+ * End the streams of the observation, after the writers are done
+ */
+void stream_close() {
+  uint64_t bytes = 0, sent = 0, copied = 0;
+  int slot;
+  for (slot = 0; slot < ntabs; slot++) {
+    stream_t *stream = &streams[slot];
+    if (stream->fd >= 0) {
+      close(stream->fd);
+      stream->fd = -1;
+    }
+    if (stream->locked) {
+      dada_hdu_unlock_write(stream->hdu);
+      stream->locked = 0;
+    }
+    bytes += stream->bytes;
+    sent += stream->sent;
+    copied += stream->copied;
+    stream->bytes = 0;
+  }
+  if (bytes > 0) {
+    LOG("Stream: %lu bytes, %lu zero-copy sends, %lu copied by the kernel\n", bytes, sent, copied);
+  }
+}
+
+void stream_finish() {
+  stream_close();
+  int slot;
+  for (slot = 0; slot < ntabs; slot++) {
+    if (streams[slot].hdu) {
+      dada_hdu_disconnect(streams[slot].hdu);
+      dada_hdu_destroy(streams[slot].hdu);
+    }
+  }
+  free(streams);
+  free(zeros);
+  streams = NULL;
+  zeros = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef __HAVE_STREAM_H__
+#define __HAVE_STREAM_H__
+
+#include <stddef.h>
+
+typedef enum {
+  STREAM_NONE,
+  STREAM_TCP, // a TCP connection per TAB, a filterbank file on the wire
+  STREAM_DADA // a PSRdada ringbuffer per TAB, in [time, channel] order
+} stream_sink_t;
+
+extern int stream_parse(const char *spec);
+extern stream_sink_t stream_sink();
+extern const char *stream_sink_name(const stream_sink_t sink);
+
+extern void stream_init(const int ntabs, const int nwriters, const size_t tab_size);
+extern int stream_open(const int slot, const int tab, const char *header, const size_t header_size);
+extern void stream_write(const int writer, const int tab, char *data, const size_t size, const long page);
+extern void stream_flush(const int writer);
+extern void stream_close();
+extern void stream_finish();
+#endif
@@ -0,0 +1,129 @@
+/**
+ * Placement of the filterbank files over a list of output directories, for instance one per disk.
+ *
+ * Round robin puts the file of selected TAB slot for segment s in directory (slot + s) % ndirectories,
+ * so the TABs are spread over the directories, and every directory gets the next TAB in the next segment.
+ *
+ * The latency policy measures the time spent writing every file, and keeps the mean write time per byte
+ * of every directory (an exponential moving average over the files closed in it). A new file goes to the
+ * directory with the lowest write time per byte times the number of files open in it (plus one),
+ * so a slow or busy disk gets fewer files. Directories without measurements count as the mean of the others,
+ * and ties are broken in round robin order.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stripe.h"
+
+static char **directories;
+static int ndirectories;
+static stripe_policy_t policy;
+static int nopen[MAXDIRS];
+static double cost[MAXDIRS]; // seconds per byte, 0 when not measured
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+int stripe_policy_parse(const char *name, stripe_policy_t *policy) {
+  if (strcmp(name, "rr") == 0) {
+    *policy = STRIPE_ROUND_ROBIN;
+  } else if (strcmp(name, "latency") == 0) {
+    *policy = STRIPE_LATENCY;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+const char *stripe_policy_name(const stripe_policy_t policy) {
+  return policy == STRIPE_LATENCY ? "latency" : "round robin";
+}
+
+/**
+ * Set the output directories
+ *
+ * @param {char **} directories Directories to spread the files over, at most MAXDIRS
+ */
+void stripe_init(char **directories_, const int ndirectories_, const stripe_policy_t policy_) {
+  directories = directories_;
+  ndirectories = ndirectories_;
+  policy = policy_;
+  memset(nopen, 0, sizeof(nopen));
+  memset(cost, 0, sizeof(cost));
+}
+
+/**
+ * Choose the directory for the file of a selected TAB and segment, and count it as open there
+ *
+ * @param {int} slot Index of the TAB in the selected TABs
+ * @returns {int} Index of the directory
+ */
+int stripe_choose(const int slot, const long segment) {
+  const int first = (int) ((slot + segment) % ndirectories);
+  if (policy == STRIPE_ROUND_ROBIN) {
+    pthread_mutex_lock(&lock);
+    nopen[first]++;
+    pthread_mutex_unlock(&lock);
+    return first;
+  }
+
+  pthread_mutex_lock(&lock);
+  double mean = 0;
+  int nmeasured = 0;
+  int d;
+  for (d = 0; d < ndirectories; d++) {
+    if (cost[d] > 0) {
+      mean += cost[d];
+      nmeasured++;
+    }
+  }
+  mean = nmeasured ? mean / nmeasured : 1;
+
+  int best = first;
+  double best_load = -1;
+  int i;
+  for (i = 0; i < ndirectories; i++) {
+    d = (first + i) % ndirectories;
+    const double load = (cost[d] > 0 ? cost[d] : mean) * (nopen[d] + 1);
+    if (best_load < 0 || load < best_load) {
+      best = d;
+      best_load = load;
+    }
+  }
+  nopen[best]++;
+  pthread_mutex_unlock(&lock);
+
+  return best;
+}
+
+/**
+ * Count a file as open in the directory, when it is used instead of the one from stripe_choose
+ */
+void stripe_open(const int directory) {
+  pthread_mutex_lock(&lock);
+  nopen[directory]++;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * A file in the directory was closed, or could not be created
+ *
+ * @param {uint64_t} bytes Data written to the file
+ * @param {double} seconds Time spent writing it
+ */
+void stripe_release(const int directory, const uint64_t bytes, const double seconds) {
+  pthread_mutex_lock(&lock);
+  nopen[directory]--;
+  if (bytes > 0 && seconds > 0) {
+    const double sample = seconds / bytes;
+    cost[directory] = cost[directory] > 0 ? 0.5 * cost[directory] + 0.5 * sample : sample;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+const char *stripe_directory(const int directory) {
+  return directories[directory];
+}
+
+int stripe_ndirectories() {
+  return ndirectories;
+}
@@ -0,0 +1,22 @@
+#ifndef __HAVE_STRIPE_H__
+#define __HAVE_STRIPE_H__
+
+#include <stdint.h>
+
+typedef enum {
+  STRIPE_ROUND_ROBIN, // rotate the TABs over the directories, shifting by one every segment
+  STRIPE_LATENCY      // the directory with the least write time per byte per open file
+} stripe_policy_t;
+
+#define MAXDIRS 32
+
+extern int stripe_policy_parse(const char *name, stripe_policy_t *policy);
+extern const char *stripe_policy_name(const stripe_policy_t policy);
+
+extern void stripe_init(char **directories, const int ndirectories, const stripe_policy_t policy);
+extern int stripe_choose(const int slot, const long segment);
+extern void stripe_open(const int directory);
+extern void stripe_release(const int directory, const uint64_t bytes, const double seconds);
+extern const char *stripe_directory(const int directory);
+extern int stripe_ndirectories();
+#endif
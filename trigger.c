@@ -0,0 +1,157 @@
+/**
+ * Triggers for the dump mode, read from a FIFO or a TCP socket.
+ *
+ * A trigger is a line of text:
+ *
+ *    <start> <end> [<TAB list>]
+ *
+ * with start and end in seconds since the start of the observation, and an optional TAB list like 0,3-5.
+ * Lines starting with '#' are ignored. The source is polled without blocking, once per page.
+ *
+ * When the source is a number, it is the TCP port to listen on; clients can connect, send any number
+ * of triggers, and disconnect. Otherwise, it is the path of a FIFO, created when it does not exist.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "trigger.h"
+
+static int listen_fd = -1;  // TCP server socket
+static int fd = -1;         // FIFO, or the connected client
+static char line[TRIGGER_LINE];
+static int nline = 0;
+
+/**
+ * Open the trigger source
+ *
+ * @param {char *} source TCP port number, or path of a FIFO
+ * @returns {int} 0 on success, -1 on failure
+ */
+int trigger_open(const char *source) {
+  char *end;
+  const long port = strtol(source, &end, 10);
+
+  if (*end == '\0') {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+      LOG("ERROR creating trigger socket: %s\n", strerror(errno));
+      return -1;
+    }
+    const int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, 4) < 0) {
+      LOG("ERROR listening for triggers on port %li: %s\n", port, strerror(errno));
+      close(listen_fd);
+      listen_fd = -1;
+      return -1;
+    }
+    LOG("Listening for triggers on port %li\n", port);
+    return 0;
+  }
+
+  if (mkfifo(source, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) < 0 && errno != EEXIST) {
+    LOG("ERROR creating trigger FIFO %s: %s\n", source, strerror(errno));
+    return -1;
+  }
+
+  struct stat st;
+  if (stat(source, &st) < 0 || ! S_ISFIFO(st.st_mode)) {
+    LOG("ERROR: trigger source %s is not a FIFO\n", source);
+    return -1;
+  }
+
+  // opened read-write, so there is no end-of-file when a writer closes the FIFO
+  fd = open(source, O_RDWR | O_NONBLOCK);
+  if (fd < 0) {
+    LOG("ERROR opening trigger FIFO %s: %s\n", source, strerror(errno));
+    return -1;
+  }
+  LOG("Reading triggers from %s\n", source);
+  return 0;
+}
+
+static int parse(trigger_t *trigger) {
+  line[nline] = '\0';
+  nline = 0;
+
+  if (line[0] == '#') {
+    return 0;
+  }
+
+  trigger->tabs[0] = '\0';
+  const int n = sscanf(line, "%lf %lf %255s", &trigger->start, &trigger->end, trigger->tabs);
+  if (n < 2 || trigger->end <= trigger->start) {
+    if (n > 0) {
+      LOG("Warning: ignoring trigger '%s'\n", line);
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Read the next trigger, without blocking
+ *
+ * @returns {int} 1 when a trigger was read, 0 otherwise
+ */
+int trigger_poll(trigger_t *trigger) {
+  if (fd < 0 && listen_fd >= 0) {
+    fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      return 0;
+    }
+    nline = 0;
+  }
+  if (fd < 0) {
+    return 0;
+  }
+
+  char c;
+  while (1) {
+    const ssize_t n = read(fd, &c, 1);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      // client disconnected
+      if (listen_fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+      return nline > 0 ? parse(trigger) : 0;
+    }
+    if (n < 0) {
+      return 0;
+    }
+
+    if (c == '\n') {
+      if (parse(trigger)) {
+        return 1;
+      }
+    } else if (nline < TRIGGER_LINE - 1) {
+      line[nline++] = c;
+    }
+  }
+}
+
+void trigger_close() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    listen_fd = -1;
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef __HAVE_TRIGGER_H__
+#define __HAVE_TRIGGER_H__
+
+// Maximum length of a trigger line, and of its TAB list
+#define TRIGGER_LINE 256
+
+/**
+ * A request to write the data between start and end, in seconds since the start of the observation
+ */
+typedef struct {
+  double start;
+  double end;
+  char tabs[TRIGGER_LINE]; // TAB list like 0,3-5, or empty for all TABs
+} trigger_t;
+
+extern int trigger_open(const char *source);
+extern int trigger_poll(trigger_t *trigger);
+extern void trigger_close();
+#endif
@@ -0,0 +1,455 @@
+/**
+ * Benchmark of the transpose kernels, using the same kernels and page loop as dadafilterbank.
+ *
+ * For every page shape, all supported kernels are first checked against the reference transpose,
+ * then timed for every thread count. A shape is given as ntabs x nchannels x ntimes x padded_size,
+ * the default shapes are science case 3 and 4, with and without padding.
+ * The throughput counts every sample read once and written once.
+ *
+ * With -e, hardware counters are read through perf_event, when the kernel allows it
+ * (see /proc/sys/kernel/perf_event_paranoid). The counters are opened before the first parallel region,
+ * and are inherited by the openMP threads.
+ *
+ * Progress goes to stderr, the results are written as JSON to stdout (or the -o file).
+ *
+ * usage: dadafilterbank_bench [-s <shapes>] [-k <kernels>] [-c <thread counts>] [-m tab|tile|nested]
+ *                             [-b <channels per block>] [-i <iterations>] [-e] [-o <output file>]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "deinterleave.h"
+
+#define MAXSHAPES 16
+#define MAXTHREADS 64
+#define NCOUNTERS 4
+
+typedef struct {
+  int ntabs;
+  int nchannels;
+  int ntimes;
+  int padded_size;
+} shape_t;
+
+static const shape_t default_shapes[] = {
+  {9, 1536, 12500, 12500},
+  {9, 1536, 12500, 12544},
+  {12, 1536, 12500, 12500},
+  {12, 1536, 12500, 12544},
+};
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} counters[NCOUNTERS] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"dtlb_misses", PERF_TYPE_HW_CACHE,
+    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+static int counter_fds[NCOUNTERS] = {-1, -1, -1, -1};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  const double x = *(const double *) a;
+  const double y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Open the hardware counters for this process and the threads it starts
+ *
+ * @returns {int} Number of counters opened
+ */
+static int open_counters() {
+  int n = 0;
+  int c;
+  for (c = 0; c < NCOUNTERS; c++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counters[c].type;
+    attr.config = counters[c].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    counter_fds[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counter_fds[c] < 0) {
+      perror(counters[c].name);
+    } else {
+      n++;
+    }
+  }
+  return n;
+}
+
+static void start_counters() {
+  int c;
+  for (c = 0; c < NCOUNTERS; c++) {
+    if (counter_fds[c] >= 0) {
+      ioctl(counter_fds[c], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+static void stop_counters(int64_t *values) {
+  int c;
+  for (c = 0; c < NCOUNTERS; c++) {
+    values[c] = -1;
+    if (counter_fds[c] >= 0) {
+      ioctl(counter_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t value;
+      if (read(counter_fds[c], &value, sizeof(value)) == sizeof(value)) {
+        values[c] = value;
+      }
+    }
+  }
+}
+
+/**
+ * Compare a transposed page with the reference transpose, including the frequency flip
+ *
+ * @returns {long} Number of wrong samples
+ */
+static long check(const char *page, char * const *tabs, const shape_t *shape) {
+  const int nchannels = shape->nchannels;
+  long nerrors = 0;
+  long row;
+#pragma omp parallel for schedule(static) reduction(+:nerrors)
+  for (row = 0; row < (long) shape->ntabs * shape->ntimes; row++) {
+    const int tab = row / shape->ntimes;
+    const int time = row % shape->ntimes;
+    const char *in = &page[(size_t) tab * nchannels * shape->padded_size];
+    const char *out = &tabs[tab][(size_t) time * nchannels];
+    int channel;
+    for (channel = 0; channel < nchannels; channel++) {
+      nerrors += out[nchannels - channel - 1] != in[(size_t) channel * shape->padded_size + time];
+    }
+  }
+  return nerrors;
+}
+
+/**
+ * Parse a list of numbers, like 1,2,4-8
+ *
+ * @returns {int} Number of entries in the list, or -1 on a parse error
+ */
+static int parse_list(char *list, int *values, const int max) {
+  int n = 0;
+  char *token = strtok(list, ",");
+  while (token) {
+    int first, last;
+    if (sscanf(token, "%d-%d", &first, &last) != 2) {
+      if (sscanf(token, "%d", &first) != 1) {
+        return -1;
+      }
+      last = first;
+    }
+    if (first < 1 || last < first || n + last - first + 1 > max) {
+      return -1;
+    }
+    for (; first <= last; first++) {
+      values[n++] = first;
+    }
+    token = strtok(NULL, ",");
+  }
+  return n;
+}
+
+static void printOptions() {
+  printf("usage: dadafilterbank_bench [-s <shapes>] [-k <kernels>] [-c <thread counts>] [-m tab|tile|nested]\n");
+  printf("                            [-b <channels per block>] [-i <iterations>] [-e] [-o <output file>]\n");
+  printf("e.g. dadafilterbank_bench -s 12x1536x12500x12544 -k avx2,avx2_1536 -c 1,2,4 -e\n");
+}
+
+int main(int argc, char **argv) {
+  shape_t shapes[MAXSHAPES];
+  int nshapes = 0;
+  char *kernels = NULL;
+  int threads[MAXTHREADS];
+  int nthreads = 0;
+  deinterleave_threading_t threading = DEINTERLEAVE_THREADING_TILE;
+  int block = DEINTERLEAVE_CHANNEL_BLOCK;
+  int niterations = 20;
+  int use_counters = 0;
+  FILE *json = stdout;
+
+  int c;
+  while ((c = getopt(argc, argv, "b:c:ehi:k:m:o:s:")) != -1) {
+    switch (c) {
+      // -b <channels per block>
+      case('b'):
+        block = atoi(optarg);
+        if (block <= 0 || block % 16) {
+          fprintf(stderr, "Error: channel block size must be a positive multiple of 16\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -c <thread counts>
+      case('c'):
+        nthreads = parse_list(optarg, threads, MAXTHREADS);
+        if (nthreads <= 0) {
+          fprintf(stderr, "Error: cannot parse thread counts '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -e
+      case('e'):
+        use_counters = 1;
+        break;
+
+      // -i <iterations>
+      case('i'):
+        niterations = atoi(optarg);
+        if (niterations < 1) {
+          fprintf(stderr, "Error: need at least one iteration\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -k <kernel list>
+      case('k'):
+        kernels = strdup(optarg);
+        break;
+
+      // -m <threading mode>
+      case('m'):
+        if (deinterleave_threading_parse(optarg, &threading) < 0) {
+          fprintf(stderr, "Error: unknown threading mode '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -o <output file>
+      case('o'):
+        json = fopen(optarg, "w");
+        if (! json) {
+          perror(optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -s <shapes>, ntabs x nchannels x ntimes x padded_size
+      case('s'): {
+        char *token = strtok(optarg, ",");
+        while (token) {
+          shape_t *shape = &shapes[nshapes];
+          if (nshapes == MAXSHAPES || sscanf(token, "%ix%ix%ix%i", &shape->ntabs, &shape->nchannels, &shape->ntimes, &shape->padded_size) != 4 ||
+              shape->ntabs <= 0 || shape->nchannels <= 0 || shape->ntimes <= 0 || shape->padded_size < shape->ntimes) {
+            fprintf(stderr, "Error: illegal shape '%s'\n", token);
+            exit(EXIT_FAILURE);
+          }
+          nshapes++;
+          token = strtok(NULL, ",");
+        }
+        break;
+      }
+
+      // -h
+      case('h'):
+        printOptions();
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        printOptions();
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  if (nshapes == 0) {
+    nshapes = sizeof(default_shapes) / sizeof(shape_t);
+    memcpy(shapes, default_shapes, sizeof(default_shapes));
+  }
+
+#ifdef _OPENMP
+  const int nprocs = omp_get_num_procs();
+#else
+  const int nprocs = 1;
+#endif
+  if (nthreads == 0) {
+    // powers of two, and all cpus
+    int n;
+    for (n = 1; n < nprocs && nthreads < MAXTHREADS - 1; n *= 2) {
+      threads[nthreads++] = n;
+    }
+    threads[nthreads++] = nprocs;
+  }
+
+  // the kernels to run, all supported kernels by default
+  int selected[deinterleave_nvariants];
+  int v;
+  for (v = 0; v < deinterleave_nvariants; v++) {
+    selected[v] = kernels == NULL && deinterleave_variants[v].supported();
+  }
+  if (kernels) {
+    char *name = strtok(kernels, ",");
+    while (name) {
+      const deinterleave_variant_t *variant = deinterleave_find(name);
+      if (! variant) {
+        fprintf(stderr, "Error: unknown or unsupported kernel '%s'\n", name);
+        exit(EXIT_FAILURE);
+      }
+      selected[variant - deinterleave_variants] = 1;
+      name = strtok(NULL, ",");
+    }
+  }
+
+  // before any threads are started, so they inherit the counters
+  if (use_counters && open_counters() == 0) {
+    fprintf(stderr, "Warning: no hardware counters available\n");
+    use_counters = 0;
+  }
+
+  char hostname[256];
+  if (gethostname(hostname, sizeof(hostname)) != 0) {
+    strcpy(hostname, "unknown");
+  }
+  hostname[sizeof(hostname) - 1] = '\0';
+
+  fprintf(json, "{\n  \"host\": \"%s\",\n  \"threading\": \"%s\",\n  \"block\": %i,\n  \"iterations\": %i,\n  \"results\": [",
+      hostname, deinterleave_threading_name(threading), block, niterations);
+
+  int nfailed = 0;
+  int nresults = 0;
+  int s;
+  for (s = 0; s < nshapes; s++) {
+    const shape_t *shape = &shapes[s];
+    const size_t page_size = (size_t) shape->ntabs * shape->nchannels * shape->padded_size;
+    const size_t tab_size = (size_t) shape->nchannels * shape->ntimes;
+    const double bytes = 2.0 * shape->ntabs * tab_size;
+
+    char *page;
+    char *transposed;
+    if (posix_memalign((void **) &page, 4096, page_size) != 0 || posix_memalign((void **) &transposed, 4096, shape->ntabs * tab_size) != 0) {
+      fprintf(stderr, "Error: cannot allocate buffers for %ix%ix%ix%i\n", shape->ntabs, shape->nchannels, shape->ntimes, shape->padded_size);
+      exit(EXIT_FAILURE);
+    }
+    char *tabs[shape->ntabs];
+    int tab;
+    for (tab = 0; tab < shape->ntabs; tab++) {
+      tabs[tab] = &transposed[tab * tab_size];
+    }
+
+    // a pattern that differs per TAB, channel and sample, touching all memory in parallel
+    size_t i;
+#pragma omp parallel for schedule(static)
+    for (i = 0; i < page_size; i++) {
+      page[i] = (char) ((i * 2654435761u) >> 13);
+    }
+
+    for (v = 0; v < deinterleave_nvariants; v++) {
+      const deinterleave_variant_t *variant = &deinterleave_variants[v];
+      if (! selected[v] || (variant->nchannels && variant->nchannels != shape->nchannels)) {
+        continue;
+      }
+
+      // correctness, on a poisoned output
+      memset(transposed, 0x55, shape->ntabs * tab_size);
+      deinterleave_page(variant->kernel, threading, block, page, tabs, shape->ntabs, shape->nchannels, 1, shape->ntimes, shape->padded_size, NULL);
+      const long nerrors = check(page, tabs, shape);
+      if (nerrors) {
+        nfailed++;
+      }
+
+      int t;
+      for (t = 0; t < nthreads; t++) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads[t]);
+#endif
+        double timings[niterations];
+        int64_t values[NCOUNTERS];
+
+        // untimed warm up run
+        deinterleave_page(variant->kernel, threading, block, page, tabs, shape->ntabs, shape->nchannels, 1, shape->ntimes, shape->padded_size, NULL);
+
+        if (use_counters) {
+          start_counters();
+        }
+        int iteration;
+        for (iteration = 0; iteration < niterations; iteration++) {
+          const double start = now();
+          deinterleave_page(variant->kernel, threading, block, page, tabs, shape->ntabs, shape->nchannels, 1, shape->ntimes, shape->padded_size, NULL);
+          timings[iteration] = now() - start;
+        }
+        if (use_counters) {
+          stop_counters(values);
+        }
+
+        qsort(timings, niterations, sizeof(double), compare_doubles);
+        const double min = timings[0];
+        const double median = niterations % 2 ? timings[niterations / 2] : 0.5 * (timings[niterations / 2 - 1] + timings[niterations / 2]);
+        const int p99_index = (99 * niterations + 99) / 100 - 1; // nearest rank
+        const double p99 = timings[p99_index];
+
+        fprintf(stderr, "%2ix%ix%ix%i %-12s %3i threads: %7.3f ms min, %7.3f ms median, %7.3f ms p99, %6.2f GB/s%s\n",
+            shape->ntabs, shape->nchannels, shape->ntimes, shape->padded_size, variant->name, threads[t],
+            min * 1e3, median * 1e3, p99 * 1e3, bytes / median * 1e-9, nerrors ? ", WRONG OUTPUT" : "");
+
+        fprintf(json, "%s\n    {\"ntabs\": %i, \"nchannels\": %i, \"ntimes\": %i, \"padded_size\": %i, \"kernel\": \"%s\", \"threads\": %i, "
+            "\"correct\": %s, \"errors\": %li, \"bytes\": %.0f, "
+            "\"min_ms\": %.6f, \"median_ms\": %.6f, \"p99_ms\": %.6f, "
+            "\"max_gbps\": %.6f, \"median_gbps\": %.6f, \"p99_gbps\": %.6f",
+            nresults ? "," : "", shape->ntabs, shape->nchannels, shape->ntimes, shape->padded_size, variant->name, threads[t],
+            nerrors ? "false" : "true", nerrors, bytes,
+            min * 1e3, median * 1e3, p99 * 1e3,
+            bytes / min * 1e-9, bytes / median * 1e-9, bytes / p99 * 1e-9);
+        if (use_counters) {
+          // per page
+          fprintf(json, ", \"counters\": {");
+          int n = 0;
+          int k;
+          for (k = 0; k < NCOUNTERS; k++) {
+            if (values[k] >= 0) {
+              fprintf(json, "%s\"%s\": %.1f", n++ ? ", " : "", counters[k].name, (double) values[k] / niterations);
+            }
+          }
+          fprintf(json, "}");
+        }
+        fprintf(json, "}");
+        nresults++;
+      }
+#ifdef _OPENMP
+      omp_set_num_threads(nprocs);
+#endif
+    }
+
+    free(page);
+    free(transposed);
+  }
+
+  fprintf(json, "\n  ]\n}\n");
+  if (json != stdout) {
+    fclose(json);
+  }
+
+  if (nfailed) {
+    fprintf(stderr, "Error: %i kernels gave wrong output\n", nfailed);
+    exit(EXIT_FAILURE);
+  }
+  exit(EXIT_SUCCESS);
+}
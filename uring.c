@@ -0,0 +1,191 @@
+/**
+ * Minimal io_uring support for the asynchronous output backend.
+ *
+ * When the kernel headers or the running kernel do not support io_uring,
+ * uring_init fails and the caller falls back to plain write() calls.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "config.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+/**
+ * Set up a ring with the given number of submission queue entries
+ *
+ * @returns {int} 0 on success, -1 on failure with errno set
+ */
+int uring_init(uring_t *ring, const unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(uring_t));
+
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    return -1;
+  }
+  ring->entries = params.sq_entries;
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    int err = errno;
+    uring_exit(ring);
+    errno = err;
+    return -1;
+  }
+
+  char *sq = ring->sq_ring;
+  ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+  char *cq = ring->cq_ring;
+  ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = cq + params.cq_off.cqes;
+
+  return 0;
+}
+
+void uring_exit(uring_t *ring) {
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->cq_ring && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+  if (ring->fd > 0) close(ring->fd);
+  memset(ring, 0, sizeof(uring_t));
+}
+
+/**
+ * Register buffers for use with uring_queue_write and a buf_index
+ *
+ * @returns {int} 0 on success, -1 on failure with errno set
+ */
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, const unsigned n) {
+  return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+/**
+ * Queue a write at an explicit file offset
+ *
+ * Use a registered buffer when buf_index >= 0, otherwise the iovec, which should stay valid until completion.
+ *
+ * @returns {int} 0 on success, -1 when the submission queue is full
+ */
+int uring_queue_write(uring_t *ring, const int fd, const char *data, const unsigned size, const off_t offset,
+    const int buf_index, const struct iovec *iov, const uint64_t user_data) {
+  const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  const unsigned tail = *ring->sq_tail;
+
+  if (tail - head >= ring->entries) {
+    return -1;
+  }
+
+  const unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &((struct io_uring_sqe *) ring->sqes)[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  if (buf_index >= 0) {
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->addr = (unsigned long) data;
+    sqe->len = size;
+    sqe->buf_index = buf_index;
+  } else {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = (unsigned long) iov;
+    sqe->len = 1;
+  }
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->sq_pending++;
+
+  return 0;
+}
+
+/**
+ * Submit all queued requests, and wait for at least 'wait' completions
+ *
+ * @returns {int} 0 on success, -1 on failure with errno set
+ */
+int uring_submit(uring_t *ring, const unsigned wait) {
+  while (1) {
+    int n = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    ring->sq_pending -= n;
+    if (ring->sq_pending == 0 || wait) {
+      return 0;
+    }
+  }
+}
+
+/**
+ * Get the next completion, without waiting
+ *
+ * @param {int *} res Result of the request: bytes written, or -errno
+ * @returns {int} 1 when a completion was available, 0 otherwise
+ */
+int uring_next_completion(uring_t *ring, uint64_t *user_data, int *res) {
+  const unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+
+  const struct io_uring_cqe *cqe = &((struct io_uring_cqe *) ring->cqes)[head & *ring->cq_mask];
+  *user_data = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+#else
+
+int uring_init(uring_t *ring, const unsigned entries) {
+  errno = ENOSYS;
+  return -1;
+}
+
+void uring_exit(uring_t *ring) {
+}
+
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, const unsigned n) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_queue_write(uring_t *ring, const int fd, const char *data, const unsigned size, const off_t offset,
+    const int buf_index, const struct iovec *iov, const uint64_t user_data) {
+  return -1;
+}
+
+int uring_submit(uring_t *ring, const unsigned wait) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_next_completion(uring_t *ring, uint64_t *user_data, int *res) {
+  return 0;
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef __HAVE_URING_H__
+#define __HAVE_URING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Minimal io_uring wrapper using the raw system calls, so there is no dependency on liburing
+ */
+typedef struct {
+  int fd;
+  unsigned entries;
+
+  // submission queue
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  void *sqes;
+  unsigned sq_pending; // queued but not yet submitted
+
+  // completion queue
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  void *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} uring_t;
+
+extern int uring_init(uring_t *ring, const unsigned entries);
+extern void uring_exit(uring_t *ring);
+extern int uring_register_buffers(uring_t *ring, const struct iovec *iov, const unsigned n);
+
+extern int uring_queue_write(uring_t *ring, const int fd, const char *data, const unsigned size, const off_t offset,
+    const int buf_index, const struct iovec *iov, const uint64_t user_data);
+extern int uring_submit(uring_t *ring, const unsigned wait);
+extern int uring_next_completion(uring_t *ring, uint64_t *user_data, int *res);
+#endif